@@ -0,0 +1,104 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * @author Rick Hallman
+ * Flag and result tables for the 8-bit ALU. These are generated at compile
+ * time, so each ADD/ADC/SUB/SBC/INC/DEC/DAA only needs a single lookup to
+ * find its flags.
+ */
+struct AluTables
+{
+    // flags for ADD/ADC and SUB/SBC/CP, indexed by the carry in,
+    // the previous value and the operand
+    uint8_t add[ 2 ][ 256 ][ 256 ];
+    uint8_t sub[ 2 ][ 256 ][ 256 ];
+
+    // flags for INC and DEC other than carry, indexed by the previous value
+    uint8_t inc[ 256 ];
+    uint8_t dec[ 256 ];
+
+    // result (high byte) and flags (low byte) for DAA, indexed by
+    // the N, H and C flags and the value of A
+    uint16_t daa[ 8 ][ 256 ];
+};
+
+/**
+ * Builds the ALU tables.
+ * @return the tables
+ */
+constexpr AluTables makeAluTables( void )
+{
+    const uint8_t zero = 0x80;
+    const uint8_t sub = 0x40;
+    const uint8_t halfCarry = 0x20;
+    const uint8_t carry = 0x10;
+
+    AluTables tables = {};
+
+    for( int c = 0; c < 2; c++ )
+    {
+	for( int prev = 0; prev < 256; prev++ )
+	{
+	    for( int delta = 0; delta < 256; delta++ )
+	    {
+		int sum = prev + delta + c;
+		tables.add[ c ][ prev ][ delta ] =
+		    ( ((sum & 0xFF) == 0) ? zero : 0 ) |
+		    ( (((prev & 0xF) + (delta & 0xF) + c) > 0xF) ? halfCarry : 0 ) |
+		    ( (sum > 0xFF) ? carry : 0 );
+
+		int diff = prev - delta - c;
+		tables.sub[ c ][ prev ][ delta ] = sub |
+		    ( ((diff & 0xFF) == 0) ? zero : 0 ) |
+		    ( (((prev & 0xF) - (delta & 0xF) - c) < 0) ? halfCarry : 0 ) |
+		    ( (diff < 0) ? carry : 0 );
+	    }
+	}
+    }
+
+    for( int prev = 0; prev < 256; prev++ )
+    {
+	tables.inc[ prev ] =
+	    ( (((prev + 1) & 0xFF) == 0) ? zero : 0 ) |
+	    ( ((prev & 0xF) == 0xF) ? halfCarry : 0 );
+
+	tables.dec[ prev ] = sub |
+	    ( (((prev - 1) & 0xFF) == 0) ? zero : 0 ) |
+	    ( ((prev & 0xF) == 0x0) ? halfCarry : 0 );
+    }
+
+    for( int flags = 0; flags < 8; flags++ )
+    {
+	bool c = ( (flags & 0x1) != 0 );
+	bool h = ( (flags & 0x2) != 0 );
+	bool n = ( (flags & 0x4) != 0 );
+
+	for( int a = 0; a < 256; a++ )
+	{
+	    uint8_t delta = 0;
+	    bool nextCarry = false;
+
+	    // if half carry or lower nibble greater than nine, adjust by 6
+	    if( h || ( (n == false) && ((a & 0x0F) > 9) ) ) { delta += 0x06; }
+
+	    // if carry or a is greater than 0x99, adjust by 0x60
+	    if( c || ( (n == false) && (a > 0x99) ) )
+	    {
+		delta += 0x60;
+		nextCarry = true;
+	    }
+
+	    uint8_t result = n ? ( a - delta ) : ( a + delta );
+	    uint8_t resultFlags =
+		( (result == 0) ? zero : 0 ) |
+		( n ? sub : 0 ) |
+		( nextCarry ? carry : 0 );
+
+	    tables.daa[ flags ][ a ] = ( result << 8 ) | resultFlags;
+	}
+    }
+
+    return tables;
+}
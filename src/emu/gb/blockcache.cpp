@@ -0,0 +1,115 @@
+#include "blockcache.h"
+
+#include <algorithm>
+
+BlockCache::BlockCache( void )
+    : m_code( 0x10000, false ),
+      m_bank( 0x01 ),
+      m_generation( 0 )
+{
+}
+
+BlockCache::~BlockCache( void )
+{
+}
+
+bool BlockCache::isCacheable( uint16_t addr )
+{
+    // ROM, WRAM and HRAM (echo RAM, VRAM and external RAM are not cached)
+    return ( addr < 0x8000 ) ||
+	( (addr >= 0xC000) && (addr < 0xE000) ) ||
+	( (addr >= 0xFF80) && (addr < 0xFFFF) );
+}
+
+uint32_t BlockCache::getRegionEnd( uint16_t addr )
+{
+    if( addr < 0x4000 ) { return 0x4000; }
+    else if( addr < 0x8000 ) { return 0x8000; }
+    else if( addr < 0xE000 ) { return 0xE000; }
+
+    return 0xFFFF;
+}
+
+Block* BlockCache::find( uint16_t addr )
+{
+    auto it = m_blocks.find( this->getKey( addr ) );
+    if( it == m_blocks.end() ) { return NULL; }
+
+    return &(it->second);
+}
+
+Block* BlockCache::insert( const Block& block )
+{
+    Block& stored = m_blocks[ this->getKey( block.start ) ];
+    stored = block;
+
+    if( block.start >= 0x8000 ) { this->markCode( stored ); }
+
+    return &stored;
+}
+
+uint32_t BlockCache::getGeneration( void )
+{
+    return m_generation;
+}
+
+void BlockCache::switchBank( uint16_t bank )
+{
+    if( bank == m_bank ) { return; }
+
+    // blocks stay cached under their own bank, but any block being
+    // replayed from 0x4000-0x7FFF is now stale
+    m_bank = bank;
+    m_generation++;
+}
+
+void BlockCache::block( void )
+{
+    m_generation++;
+}
+
+void BlockCache::invalidate( uint16_t addr )
+{
+    if( m_code[ addr ] == false ) { return; }
+
+    // drop every RAM block containing the address
+    for( auto it = m_blocks.begin(); it != m_blocks.end(); )
+    {
+	const Block& block = it->second;
+	if( (block.start >= 0x8000) &&
+	    (addr >= block.start) && (addr < block.end) )
+	{
+	    it = m_blocks.erase( it );
+	}
+	else { it++; }
+    }
+
+    // blocks may overlap, so rebuild the code map from the survivors
+    std::fill( m_code.begin() + 0x8000, m_code.end(), false );
+    for( auto it = m_blocks.begin(); it != m_blocks.end(); it++ )
+    {
+	if( it->second.start >= 0x8000 ) { this->markCode( it->second ); }
+    }
+
+    m_generation++;
+}
+
+uint32_t BlockCache::getKey( uint16_t addr )
+{
+    uint32_t key = addr;
+
+    if( (addr >= 0x4000) && (addr < 0x8000) )
+    {
+	key |= ( (uint32_t)m_bank << 16 );
+    }
+
+    return key;
+}
+
+void BlockCache::markCode( const Block& block )
+{
+    for( uint32_t addr = block.start; addr < block.end; addr++ )
+    {
+	m_code[ addr ] = true;
+    }
+}
@@ -0,0 +1,172 @@
+#pragma once
+
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+class Z80;
+
+/**
+ * @author Rick Hallman
+ * A single predecoded instruction.
+ */
+struct CachedInstruction
+{
+    // the handler that executes this instruction
+    uint8_t (Z80::*handler)( void );
+
+    // the instruction's address
+    uint16_t addr;
+
+    // the opcode (0xCB for CB-prefixed instructions) and its operand bytes
+    uint8_t opcode;
+    uint8_t operands[ 2 ];
+
+    // the instruction's length in bytes
+    uint8_t length;
+
+    // the most ticks this instruction can take
+    uint8_t ticks;
+};
+
+/**
+ * @author Rick Hallman
+ * A place where a block's native code can leave it.
+ */
+struct NativeExit
+{
+    // the index of the next instruction to replay
+    uint8_t index;
+
+    // the ticks taken by the last instruction
+    uint8_t lastTicks;
+
+    // the ticks taken since the last idle loop check, which includes the
+    // last instruction (0 if the last instruction was checked)
+    uint16_t loopTicks;
+};
+
+// native code generated for a block, given the ticks it may take. Returns
+// the ticks it took, shifted left 8 bits, or'd with the exit it left by.
+typedef uint64_t (*NativeBlock)( Z80* z80, uint32_t budget );
+
+/**
+ * @author Rick Hallman
+ * A straight-line run of predecoded instructions. Blocks end at the first
+ * control flow instruction or at the edge of a memory region.
+ */
+struct Block
+{
+    // first address and one past the last address covered by this block
+    uint16_t start, end;
+
+    std::vector<CachedInstruction> instructions;
+
+    // the number of times this block has been entered
+    uint32_t executions;
+
+    // compiled code, the most ticks one pass through it takes, and the
+    // places it can exit
+    NativeBlock native;
+    uint32_t nativeTicks;
+    std::vector<NativeExit> nativeExits;
+};
+
+/**
+ * @author Rick Hallman
+ * Stores predecoded blocks of instructions by ROM bank and address.
+ * Blocks are cached for ROM, WRAM and HRAM. Writes to cached RAM code and
+ * switches of the ROM bank invalidate the affected blocks.
+ */
+class BlockCache
+{
+public:
+    BlockCache( void );
+    ~BlockCache( void );
+
+    // the most instructions stored in a single block
+    static const unsigned int c_maxBlockLength = 64;
+
+    /**
+     * Whether or not code at an address can be cached.
+     * @param addr the address
+     * @return true if yes, false otherwise
+     */
+    static bool isCacheable( uint16_t addr );
+
+    /**
+     * Gets the end of the memory region containing an address. Blocks may
+     * not cross this address.
+     * @param addr the address
+     * @return one past the region's last address
+     */
+    static uint32_t getRegionEnd( uint16_t addr );
+
+    /**
+     * Finds the block starting at an address in the current ROM bank.
+     * @param addr the block's start address
+     * @return the block, or NULL if not cached
+     */
+    Block* find( uint16_t addr );
+
+    /**
+     * Stores a newly decoded block.
+     * @param block the block to store
+     * @return the stored block
+     */
+    Block* insert( const Block& block );
+
+    /**
+     * Gets the cache's generation. This changes whenever a block is
+     * invalidated, so any previously found block must be looked up again.
+     * @return the generation
+     */
+    uint32_t getGeneration( void );
+
+    /**
+     * Called when the cartridge switches ROM banks.
+     * @param bank the newly selected bank for 0x4000-0x7FFF
+     */
+    void switchBank( uint16_t bank );
+
+    /**
+     * Called when the CPU is blocked from memory by OAM DMA. Any block
+     * being replayed must be looked up again, so that blocked code is
+     * fetched from the bus.
+     */
+    void block( void );
+
+    /**
+     * Called when memory is written. Invalidates any RAM blocks
+     * containing the address.
+     * @param addr the address written to
+     */
+    void invalidate( uint16_t addr );
+
+private:
+
+    /**
+     * Calculates the key for a block.
+     * @param addr the block's start address
+     * @return the key
+     */
+    uint32_t getKey( uint16_t addr );
+
+    /**
+     * Marks the addresses covered by a block as code.
+     * @param block the block
+     */
+    void markCode( const Block& block );
+
+    // cached blocks, keyed by bank and address
+    std::unordered_map<uint32_t, Block> m_blocks;
+
+    // whether an address is covered by a cached RAM block
+    std::vector<bool> m_code;
+
+    // the ROM bank mapped to 0x4000-0x7FFF
+    uint16_t m_bank;
+
+    // incremented on invalidation
+    uint32_t m_generation;
+};
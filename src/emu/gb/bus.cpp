@@ -1,9 +1,14 @@
 #include "bus.h"
+#include "blockcache.h"
 #include "debug.h"
 #include "devices.h"
 #include "joypad.h"
 #include "rom/rom.h"
+#include "scheduler.h"
+#include "tilecache.h"
+#include "timer.h"
 
+#include <cstring>
 #include <iostream>
 #include <list>
 #include <iterator>
@@ -13,16 +18,61 @@ using namespace std;
 
 Bus::Bus( Rom* rom, string baseDir ) :
     mp_rom( rom ),
-    mp_joypad( new JoyPad( baseDir ) )
+    mp_joypad( new JoyPad( baseDir ) ),
+    mp_timer( new Timer( this ) ),
+    m_blocked( false ),
+    mp_blockCache( NULL ),
+    mp_tileCache( NULL ),
+    mp_scheduler( NULL ),
+    m_watchpoints( 0x10000, 0 ),
+    mp_watch( NULL ),
+    m_watchCount( 0 ),
+    m_writes( 0 )
 {
     mp_dmaReg = new DMATransferDevice( this );
+    mp_scanline = new ScanlineDevice( this );
     mp_memory = new uint8_t[65536];
+
+    // cartridge ROM (0x0000-0x7FFF) and RAM (0xA000-0xBFFF) are accessed
+    // directly where they can be, otherwise through the cartridge
+    for( unsigned int page = 0x00; page <= 0xFF; page++ )
+    {
+	mp_readPages[ page ] = NULL;
+	mp_writePages[ page ] = NULL;
+    }
+
+    for( unsigned int page = 0x00; page < 0x40; page++ )
+    {
+	mp_readPages[ page ] = mp_rom->getPage( page );
+    }
+
+    mp_rom->setBus( this );
+    this->mapRomBank();
+    this->mapRamBank();
+
+    // VRAM, WRAM, echo RAM and OAM
+    this->mapMemory( 0x80, 0x9F );
+    this->mapMemory( 0xC0, 0xFE );
+
+    // I/O registers and HRAM
+    for( unsigned int i = 0x00; i <= 0xFF; i++ )
+    {
+	mp_ioDevices[ i ] = NULL;
+	m_ioVolatile[ i ] = false;
+    }
+
+    this->registerDevice( mp_joypad );
+    this->registerDevice( mp_timer );
+    this->registerDevice( mp_dmaReg );
+    this->registerDevice( mp_scanline );
 }
 
 Bus::~Bus( void )
 {
     delete mp_joypad; mp_joypad = NULL;
+    delete mp_timer; mp_timer = NULL;
     delete mp_dmaReg; mp_dmaReg = NULL;
+    delete mp_scanline; mp_scanline = NULL;
     delete[] mp_memory; mp_memory = NULL;
 }
 
@@ -34,41 +84,382 @@ void Bus::write( uint16_t addr, uint8_t val )
 
 void Bus::access( uint16_t addr, uint8_t& data, bool write )
 {
-    if( addr <= Rom::c_end ||
-	((addr >= Rom::c_ramStart) && (addr <= Rom::c_ramEnd)))
+    // watched addresses take the slow path
+    if( (mp_watch != NULL) && (mp_watch[ addr ] != 0) )
     {
-	// ROM access
-	mp_rom->access( addr, data, write );
+	this->watchedAccess( addr, data, write );
+	return;
     }
-    else if( addr == JoyPad::c_addr )
+
+    if( m_blocked && (addr < 0xFF00) )
     {
-	// JoyPad access
-	mp_joypad->access( addr, data, write );
+	if( write == READ ) { data = mp_dmaReg->getConflictValue( addr ); }
+	return;
     }
-    else if( addr == DMATransferDevice::c_addr )
+
+    uint8_t page = addr >> 8;
+
+    if( write == READ )
+    {
+	const uint8_t* memory = mp_readPages[ page ];
+	if( memory != NULL )
+	{
+	    data = memory[ addr & 0xFF ];
+	    return;
+	}
+    }
+    else
     {
-	// DMA transfer
-	mp_dmaReg->access( addr, data, write );
+	m_writes++;
+
+	// invalidate any cached code at this address
+	if( (addr >= 0xC000) && (mp_blockCache != NULL) )
+	{
+	    mp_blockCache->invalidate( addr );
+	}
+
+	// mark decoded tiles at this address stale
+	if( (addr >= TileCache::c_start) && (addr <= TileCache::c_end) && (mp_tileCache != NULL) )
+	{
+	    mp_tileCache->invalidate( addr );
+	}
+
+	uint8_t* memory = mp_writePages[ page ];
+	if( memory != NULL )
+	{
+	    memory[ addr & 0xFF ] = data;
+	    return;
+	}
     }
-    else if( ( (addr == 0xFF44) || (addr == 0xFF04) )
-	     && write )
+
+    if( page == 0xFF )
     {
-	// LCDC Y and divider
-	mp_memory[addr] = 0;
+	// I/O registers and HRAM
+	uint8_t index = addr & 0xFF;
+	MemoryDevice* device = mp_ioDevices[ index ];
+
+	if( device != NULL )
+	{
+	    device->access( addr, data, write );
+
+	    // idle loops can poll registers that change without writes
+	    if( m_ioVolatile[ index ] && (write == READ) ) { m_writes++; }
+	}
+	else if( write == READ ) { data = mp_memory[ addr ]; }
+	else { mp_memory[ addr ] = data; }
+
+	if( write && (mp_scheduler != NULL) ) { this->scheduleWrite( addr ); }
     }
     else
     {
-	this->defaultAccess( addr, data, write );
-    }    
+	// ROM bank registers and cartridge RAM
+	mp_rom->access( addr, data, write );
+    }
+}
+
+uint8_t Bus::peek( uint16_t addr )
+{
+    // bring OAM up to date with the transfer the CPU is waiting on
+    if( m_blocked ) { mp_dmaReg->sync(); }
+
+    uint8_t* watch = mp_watch;
+    bool blocked = m_blocked;
+    mp_watch = NULL;
+    m_blocked = false;
+
+    uint8_t val;
+    this->access( addr, val, READ );
+
+    mp_watch = watch;
+    m_blocked = blocked;
+    return val;
+}
+
+uint8_t Bus::fetch( uint16_t addr )
+{
+    if( m_blocked && (addr < 0xFF00) ) { return mp_dmaReg->getConflictValue( addr ); }
+
+    const uint8_t* memory = mp_readPages[ addr >> 8 ];
+    if( memory != NULL ) { return memory[ addr & 0xFF ]; }
+
+    // the cartridge and I/O registers, leaving watchpoints and the
+    // write count untouched
+    uint8_t* watch = mp_watch;
+    uint32_t writes = m_writes;
+    mp_watch = NULL;
+
+    uint8_t val;
+    this->access( addr, val, READ );
+
+    mp_watch = watch;
+    m_writes = writes;
+    return val;
+}
+
+void Bus::readSpan( uint16_t addr, uint8_t* dst, uint16_t len )
+{
+    // bring OAM up to date with the transfer the CPU is waiting on
+    if( m_blocked ) { mp_dmaReg->sync(); }
+
+    while( len > 0 )
+    {
+	// copy up to the end of the page at once
+	uint16_t count = 0x100 - ( addr & 0xFF );
+	if( count > len ) { count = len; }
+
+	const uint8_t* memory = mp_readPages[ addr >> 8 ];
+	if( memory != NULL )
+	{
+	    memcpy( dst, memory + ( addr & 0xFF ), count );
+	}
+	else
+	{
+	    for( uint16_t i = 0; i < count; i++ ) { dst[ i ] = this->peek( addr + i ); }
+	}
+
+	addr += count;
+	dst += count;
+	len -= count;
+    }
+}
+
+void Bus::writeSpan( uint16_t addr, const uint8_t* src, uint16_t len )
+{
+    while( len > 0 )
+    {
+	// copy up to the end of the page at once
+	uint16_t count = 0x100 - ( addr & 0xFF );
+	if( count > len ) { count = len; }
+
+	// watched addresses and devices are written one at a time
+	uint8_t* memory = mp_writePages[ addr >> 8 ];
+	if( (memory != NULL) && (mp_watch == NULL) )
+	{
+	    m_writes++;
+
+	    if( (addr >= 0xC000) && (mp_blockCache != NULL) )
+	    {
+		for( uint16_t i = 0; i < count; i++ ) { mp_blockCache->invalidate( addr + i ); }
+	    }
+
+	    if( (addr >= TileCache::c_start) && (addr <= TileCache::c_end) && (mp_tileCache != NULL) )
+	    {
+		// tiles are 16 bytes, so this marks each tile once
+		for( uint16_t i = 0; i < count; i += 16 ) { mp_tileCache->invalidate( addr + i ); }
+		mp_tileCache->invalidate( addr + count - 1 );
+	    }
+
+	    memcpy( memory + ( addr & 0xFF ), src, count );
+	}
+	else
+	{
+	    for( uint16_t i = 0; i < count; i++ ) { this->write( addr + i, src[ i ] ); }
+	}
+
+	addr += count;
+	src += count;
+	len -= count;
+    }
 }
 
 void Bus::defaultAccess( uint16_t addr, uint8_t& data, bool write )
 {
     if( write == READ ) { data = mp_memory[addr]; }
-    else { mp_memory[addr] = data; }
+    else
+    {
+	// hardware rewrites its registers constantly, so only count changes
+	if( mp_memory[addr] != data ) { m_writes++; }
+	mp_memory[addr] = data;
+    }
+}
+
+bool Bus::registerDevice( MemoryDevice* device )
+{
+    uint16_t start = device->getStart();
+    uint16_t end = device->getEnd();
+
+    if( (start < 0xFF00) || (end < start) ) { return false; }
+
+    for( unsigned int addr = start; addr <= end; addr++ )
+    {
+	mp_ioDevices[ addr & 0xFF ] = device;
+	m_ioVolatile[ addr & 0xFF ] = device->isVolatile( addr );
+    }
+
+    return true;
 }
 
 JoyPad* Bus::getJoyPad( void )
 {
     return mp_joypad;
 }
+
+Timer* Bus::getTimer( void )
+{
+    return mp_timer;
+}
+
+DMATransferDevice* Bus::getDMA( void )
+{
+    return mp_dmaReg;
+}
+
+void Bus::setBlocked( bool blocked )
+{
+    // stop replaying cached code the CPU can no longer read
+    if( blocked && (m_blocked == false) && (mp_blockCache != NULL) )
+    {
+	mp_blockCache->block();
+    }
+
+    m_blocked = blocked;
+}
+
+bool Bus::isBlocked( uint16_t addr )
+{
+    return m_blocked && (addr < 0xFF00);
+}
+
+bool Bus::isMemory( uint16_t addr, bool write )
+{
+    uint8_t page = addr >> 8;
+
+    if( (write == READ) && (mp_readPages[ page ] != NULL) ) { return true; }
+    if( (write == WRITE) && (mp_writePages[ page ] != NULL) ) { return true; }
+
+    // HRAM, unless a device has been registered over it
+    return (addr >= 0xFF80) && (addr < 0xFFFF) && (mp_ioDevices[ addr & 0xFF ] == NULL);
+}
+
+uint16_t Bus::getRomBank( void )
+{
+    return mp_rom->getBank();
+}
+
+void Bus::setScheduler( Scheduler* scheduler )
+{
+    mp_scheduler = scheduler;
+    mp_joypad->setScheduler( scheduler );
+    mp_timer->setScheduler( scheduler );
+    mp_dmaReg->setScheduler( scheduler );
+}
+
+void Bus::scheduleWrite( uint16_t addr )
+{
+    // the new value takes effect before the next instruction
+    switch( addr )
+    {
+    case 0xFF40: // LCDC
+    case 0xFF41: // STAT
+    case 0xFF44: // LY
+	mp_scheduler->schedule( Scheduler::C_EVENT_LCD_WRITE,
+				mp_scheduler->getCycles() );
+	break;
+    default:
+	break;
+    }
+}
+
+void Bus::setWatchpoint( uint16_t addr, uint8_t types )
+{
+    if( (m_watchpoints[ addr ] == 0) && (types != 0) ) { m_watchCount++; }
+    else if( (m_watchpoints[ addr ] != 0) && (types == 0) ) { m_watchCount--; }
+
+    m_watchpoints[ addr ] = types;
+    mp_watch = ( m_watchCount != 0 ) ? m_watchpoints.data() : NULL;
+}
+
+uint8_t Bus::getWatchpoint( uint16_t addr )
+{
+    return m_watchpoints[ addr ];
+}
+
+bool Bus::hasWatchpoints( void )
+{
+    return m_watchCount != 0;
+}
+
+std::vector<Bus::WatchHit>& Bus::getWatchHits( void )
+{
+    return m_watchHits;
+}
+
+void Bus::watchedAccess( uint16_t addr, uint8_t& data, bool write )
+{
+    uint8_t types = mp_watch[ addr ];
+    uint8_t prev = write ? this->peek( addr ) : 0;
+
+    // access normally without hitting the watchpoint again
+    uint8_t* watch = mp_watch;
+    mp_watch = NULL;
+    this->access( addr, data, write );
+    mp_watch = watch;
+
+    // written values can be masked, so read back what was stored
+    uint8_t value = write ? this->peek( addr ) : data;
+    if( write == READ ) { prev = value; }
+
+    WatchHit hit;
+    hit.addr = addr;
+    hit.prev = prev;
+    hit.value = value;
+    hit.cycle = ( mp_scheduler != NULL ) ? mp_scheduler->getCycles() : 0;
+
+    if( (write == READ) && (types & c_watchRead) )
+    {
+	hit.type = c_watchRead;
+	m_watchHits.push_back( hit );
+    }
+    else if( write && (types & c_watchWrite) )
+    {
+	hit.type = c_watchWrite;
+	m_watchHits.push_back( hit );
+    }
+    else if( write && (types & c_watchChange) && (prev != value) )
+    {
+	hit.type = c_watchChange;
+	m_watchHits.push_back( hit );
+    }
+}
+
+uint32_t Bus::getWriteCount( void )
+{
+    return m_writes;
+}
+
+void Bus::mapRomBank( void )
+{
+    for( unsigned int page = 0x40; page < 0x80; page++ )
+    {
+	mp_readPages[ page ] = mp_rom->getPage( page );
+    }
+}
+
+void Bus::mapRamBank( void )
+{
+    for( unsigned int page = 0xA0; page < 0xC0; page++ )
+    {
+	mp_readPages[ page ] = mp_rom->getRamReadPage( page );
+	mp_writePages[ page ] = mp_rom->getRamPage( page );
+    }
+}
+
+void Bus::mapMemory( uint8_t start, uint8_t end )
+{
+    for( unsigned int page = start; page <= end; page++ )
+    {
+	mp_readPages[ page ] = mp_memory + ( page << 8 );
+	mp_writePages[ page ] = mp_memory + ( page << 8 );
+    }
+}
+
+void Bus::setBlockCache( BlockCache* cache )
+{
+    mp_blockCache = cache;
+    mp_rom->setBlockCache( cache );
+}
+
+void Bus::setTileCache( TileCache* cache )
+{
+    mp_tileCache = cache;
+}
@@ -9,15 +9,22 @@
 
 #include <list>
 #include <string>
+#include <vector>
 using std::string;
 
 #include <stdint.h>
 
 
+class BlockCache;
 class DMATransferDevice;
+class MemoryDevice;
+class ScanlineDevice;
 class Rom;
 class JoyPad;
+class Timer;
+class TileCache;
 class Audio;
+class Scheduler;
 
 /**
  * @author Rick Hallman
@@ -27,6 +34,26 @@ class Bus
 {
 public:
 
+    // watchpoint types
+    static const uint8_t c_watchRead = 0x01;
+    static const uint8_t c_watchWrite = 0x02;
+    static const uint8_t c_watchChange = 0x04;
+
+    // an access that hit a watchpoint
+    struct WatchHit
+    {
+	uint16_t addr;
+
+	// the watchpoint type that was hit
+	uint8_t type;
+
+	// the value before and after the access
+	uint8_t prev, value;
+
+	// the cycle the accessing instruction started at
+	uint64_t cycle;
+    };
+
     /**
      * Constructor.
      * @param rom the game's ROM file
@@ -50,6 +77,42 @@ public:
      */
     void access( uint16_t addr, uint8_t& data, bool write );
 
+    /**
+     * Read the bus at a given address without hitting watchpoints, even
+     * while the CPU is blocked.
+     * @param addr the address to read
+     * @return the value read
+     */
+    uint8_t peek( uint16_t addr );
+
+    /**
+     * Read an instruction byte for the CPU's decoder. Like a read access,
+     * but without hitting watchpoints or counting as a poll, since code
+     * is decoded ahead of the instruction being executed.
+     * @param addr the address to read
+     * @return the value read
+     */
+    uint8_t fetch( uint16_t addr );
+
+    /**
+     * Reads a range of addresses, copying whole pages of plain memory at
+     * once. Meant for hardware such as DMA and the LCD, so reads do not
+     * hit watchpoints and see memory even while the CPU is blocked.
+     * @param addr the first address
+     * @param dst the buffer to read into
+     * @param len the number of bytes
+     */
+    void readSpan( uint16_t addr, uint8_t* dst, uint16_t len );
+
+    /**
+     * Writes a range of addresses, copying whole pages of plain memory
+     * at once. Equivalent to writing each address in turn.
+     * @param addr the first address
+     * @param src the data to write
+     * @param len the number of bytes
+     */
+    void writeSpan( uint16_t addr, const uint8_t* src, uint16_t len );
+
     /**
      * Access the bus at a given address WITHOUT looking at registered devices.
      * @param addr the address to access
@@ -58,13 +121,149 @@ public:
      */
     void defaultAccess( uint16_t addr, uint8_t& data, bool write );
 
+    /**
+     * Registers a device in the I/O page (0xFF00-0xFFFF) over its address
+     * range, replacing any device already registered there. Addresses
+     * without a device access the default memory. The bus does not take
+     * ownership of the device.
+     * @param device the device
+     * @return true if registered, false if outside the I/O page
+     */
+    bool registerDevice( MemoryDevice* device );
+
     /**
      * Accessor method for the joypad.
      */
     JoyPad* getJoyPad( void );
+
+    /**
+     * Accessor method for the timer.
+     */
+    Timer* getTimer( void );
+
+    /**
+     * Accessor method for the OAM DMA register.
+     */
+    DMATransferDevice* getDMA( void );
+
+    /**
+     * Blocks the CPU from everything but the I/O registers and HRAM, as
+     * during OAM DMA. Blocked writes are ignored and blocked reads see
+     * the transfer's bus conflicts.
+     * @param blocked whether or not to block
+     */
+    void setBlocked( bool blocked );
+
+    /**
+     * Whether or not the CPU is blocked from an address.
+     * @param addr the address
+     * @return true if yes, false otherwise
+     */
+    bool isBlocked( uint16_t addr );
+
+    /**
+     * Whether or not an address is plain memory (ROM, RAM or HRAM), where
+     * accesses do nothing but read or write the memory.
+     * @param addr the address
+     * @param write whether this is a read or write access
+     * @return true if yes, false otherwise
+     */
+    bool isMemory( uint16_t addr, bool write );
+
+    /**
+     * Gets the cartridge's ROM bank mapped to 0x4000-0x7FFF.
+     * @return the bank number
+     */
+    uint16_t getRomBank( void );
+
+    /**
+     * Sets the CPU's block cache, which is notified of writes to RAM and
+     * cartridge bank switches.
+     * @param cache the block cache (or NULL)
+     */
+    void setBlockCache( BlockCache* cache );
+
+    /**
+     * Sets the LCD's tile cache, which is notified of writes to tile data.
+     * @param cache the tile cache (or NULL)
+     */
+    void setTileCache( TileCache* cache );
+
+    /**
+     * Sets the hardware event scheduler, which is notified of writes to
+     * registers that change when hardware next needs to be updated.
+     * @param scheduler the scheduler (or NULL)
+     */
+    void setScheduler( Scheduler* scheduler );
+
+    /**
+     * Sets the watchpoints on an address.
+     * @param addr the address
+     * @param types the watchpoint types (0 to clear)
+     */
+    void setWatchpoint( uint16_t addr, uint8_t types );
+
+    /**
+     * Gets the watchpoints on an address.
+     * @param addr the address
+     * @return the watchpoint types
+     */
+    uint8_t getWatchpoint( uint16_t addr );
+
+    /**
+     * Whether or not any watchpoints are set.
+     * @return true if yes, false otherwise
+     */
+    bool hasWatchpoints( void );
+
+    /**
+     * Gets the watchpoint hits since they were last cleared.
+     * @return the hits
+     */
+    std::vector<WatchHit>& getWatchHits( void );
+
+    /**
+     * Gets the number of writes that may have changed memory. If this is
+     * unchanged, every read returns the same value it did before.
+     * @return the write count
+     */
+    uint32_t getWriteCount( void );
+
+    /**
+     * Maps the cartridge's current ROM bank into the page table. Called
+     * by the cartridge when it switches banks.
+     */
+    void mapRomBank( void );
+
+    /**
+     * Maps the cartridge's current RAM bank into the page table. Called
+     * by the cartridge when RAM is switched, enabled or disabled.
+     */
+    void mapRamBank( void );
     
 private:
 
+    /**
+     * Maps a range of pages to the default memory.
+     * @param start the first page
+     * @param end the last page
+     */
+    void mapMemory( uint8_t start, uint8_t end );
+
+    /**
+     * Schedules the hardware that depends on a register that was written.
+     * @param addr the address written to
+     */
+    void scheduleWrite( uint16_t addr );
+
+    /**
+     * Accesses a watched address, recording any watchpoint hits.
+     * @param addr the address to access
+     * @param data the data read from / written to based on the write flag
+     * @param write whether this is a read or write access
+     */
+    void watchedAccess( uint16_t addr, uint8_t& data, bool write );
+
     // ROM file
     Rom* mp_rom;
 
@@ -74,7 +273,45 @@ private:
     // Default memory
     uint8_t* mp_memory;
 
+    // Divider and timer
+    Timer* mp_timer;
+
     // DMA Transfer Device
     DMATransferDevice* mp_dmaReg;
 
+    // LCDC Y
+    ScanlineDevice* mp_scanline;
+
+    // whether the CPU is blocked by OAM DMA
+    bool m_blocked;
+
+    // CPU block cache
+    BlockCache* mp_blockCache;
+
+    // LCD tile cache
+    TileCache* mp_tileCache;
+
+    // hardware event scheduler
+    Scheduler* mp_scheduler;
+
+    // watchpoint types for every address, and the number of watched
+    // addresses. mp_watch is NULL unless an address is watched.
+    std::vector<uint8_t> m_watchpoints;
+    uint8_t* mp_watch;
+    unsigned int m_watchCount;
+    std::vector<WatchHit> m_watchHits;
+
+    // the memory backing each 256-byte page, or NULL where accesses go
+    // through the cartridge or the I/O devices
+    const uint8_t* mp_readPages[ 256 ];
+    uint8_t* mp_writePages[ 256 ];
+
+    // the device registered at each address in 0xFF00-0xFFFF (or NULL),
+    // and whether reading it can change its value
+    MemoryDevice* mp_ioDevices[ 256 ];
+    bool m_ioVolatile[ 256 ];
+
+    // counts writes for idle loop detection
+    uint32_t m_writes;
+
 };
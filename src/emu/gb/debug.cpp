@@ -1,17 +1,20 @@
 #include "debug.h"
 
+#include <ctype.h>
 #include <iostream>
-#include <regex>
 #include <string>
 #include <sstream>
 
+using std::string;
+using std::vector;
+
 
 Debug::Debug( Z80* z80, Bus* bus )
     : mp_z80( z80 ),
       mp_bus( bus ),
       m_step( true ),
-      m_bFlag( false ),
-      m_bAddr( 0x0000 )
+      m_count( 0 ),
+      m_instruction( 0x0000 )
 {
 }
 
@@ -21,68 +24,431 @@ uint8_t Debug::repl( void )
 
     if( DEBUG_MODE == false ) { return 0; }
 
-    uint16_t addr = mp_z80->getPC();
-
     // Only debug if stepping or at breakpoint
-    if( (m_step == false) &&
-	(!((addr == m_bAddr) && m_bFlag)) ) { return 0; }
-    
+    if( this->isBreakpoint() == false ) { return 0; }
+
+    this->printWatchHits();
+    m_instruction = mp_z80->getPC();
+
     m_step = false;
     string input;
-    while( true )
+    bool done = false;
+    while( done == false )
     {
 	cout << "gb>";
-	getline( cin, input );
-	
-	if( input.compare("q") == 0 )
+	if( !getline( cin, input ) ) { return 1; }
+
+	// split the command into words
+	vector<string> args;
+	istringstream ss( input );
+	string word;
+	while( ss >> word ) { args.push_back( word ); }
+
+	if( args.empty() ) { continue; }
+	if( this->execute( args, done ) != 0 ) { return 1; }
+    }
+
+    return 0;
+}
+
+bool Debug::isActive( void )
+{
+    if( DEBUG_MODE == false ) { return false; }
+
+    return m_step || ( m_count != 0 ) || mp_bus->hasWatchpoints();
+}
+
+bool Debug::isBreakpoint( void )
+{
+    if( DEBUG_MODE == false ) { return false; }
+
+    // keep the instruction that hit a watchpoint until it is reported
+    if( mp_bus->getWatchHits().empty() == false ) { return true; }
+
+    uint16_t pc = mp_z80->getPC();
+    m_instruction = pc;
+
+    if( m_step ) { return true; }
+    if( m_count == 0 ) { return false; }
+
+    uint16_t bank = this->getBank( pc, mp_bus->getRomBank() );
+
+    auto bitmap = m_breakpoints.find( bank );
+    if( bitmap == m_breakpoints.end() ) { return false; }
+    if( (bitmap->second[ pc / 64 ] & (1ULL << (pc % 64))) == 0 ) { return false; }
+
+    // unconditional breakpoints always stop
+    auto condition = m_conditions.find( ((uint32_t)bank << 16) | pc );
+    return ( condition == m_conditions.end() ) || condition->second();
+}
+
+uint8_t Debug::execute( const vector<string>& args, bool& done )
+{
+    using namespace std;
+
+    const string& command = args[0];
+
+    if( command == "q" )
+    {
+	return 1;
+    }
+    else if( (command == "i") && (args.size() == 2) )
+    {
+	uint16_t addr;
+	if( this->parseNumber( args[1], addr ) == false )
 	{
-	    return 1;
+	    cout << "Invalid address " << args[1] << endl;
+	    return 0;
 	}
-	else if( regex_match( input, regex("i ([0-9]|[a-f]|[A-F]){1,4}") ) )
+
+	uint8_t val = mp_bus->peek( addr );
+
+	cout << "Value at " << hex << addr
+	     << ": " << hex << (int)val << endl;
+    }
+    else if( command == "b" )
+    {
+	this->setBreakpoint( args );
+    }
+    else if( command == "d" )
+    {
+	this->deleteBreakpoint( args );
+    }
+    else if( command == "l" )
+    {
+	this->listBreakpoints();
+    }
+    else if( (command == "w") || (command == "dw") )
+    {
+	this->setWatchpoint( args );
+    }
+    else if( command == "s" )
+    {
+	m_step = true;
+	done = true;
+    }
+    else if( command == "i" )
+    {
+	mp_z80->printStatus();
+    }
+    else if( command == "r" )
+    {
+	done = true;
+    }
+    else
+    {
+	cout << "Unknown command " << command << endl;
+    }
+
+    return 0;
+}
+
+void Debug::setBreakpoint( const vector<string>& args )
+{
+    using namespace std;
+
+    bool conditional = ( args.size() == 6 ) && ( args[2] == "if" );
+
+    uint32_t key;
+    if( ((args.size() != 2) && (conditional == false)) ||
+	(this->parseAddress( args[1], key ) == false) )
+    {
+	cout << "Usage: b [bank:]addr [if operand op value]" << endl;
+	return;
+    }
+
+    Condition condition;
+    if( conditional &&
+	(this->compileCondition( args[3], args[4], args[5], condition ) == false) )
+    {
+	cout << "Invalid condition" << endl;
+	return;
+    }
+
+    uint16_t bank = key >> 16;
+    uint16_t addr = key & 0xFFFF;
+
+    vector<uint64_t>& bitmap = m_breakpoints[ bank ];
+    if( bitmap.empty() ) { bitmap.resize( 0x10000 / 64, 0 ); }
+
+    uint64_t bit = 1ULL << (addr % 64);
+    if( (bitmap[ addr / 64 ] & bit) == 0 )
+    {
+	bitmap[ addr / 64 ] |= bit;
+	m_count++;
+    }
+
+    if( conditional )
+    {
+	m_conditions[ key ] = condition;
+	m_conditionText[ key ] = args[3] + " " + args[4] + " " + args[5];
+    }
+    else
+    {
+	m_conditions.erase( key );
+	m_conditionText.erase( key );
+    }
+
+    cout << endl << "Breakpoint set at " << hex << (int)addr
+	 << endl;
+}
+
+void Debug::deleteBreakpoint( const vector<string>& args )
+{
+    using namespace std;
+
+    uint32_t key;
+    if( (args.size() != 2) || (this->parseAddress( args[1], key ) == false) )
+    {
+	cout << "Usage: d [bank:]addr" << endl;
+	return;
+    }
+
+    uint16_t addr = key & 0xFFFF;
+    uint64_t bit = 1ULL << (addr % 64);
+
+    auto bitmap = m_breakpoints.find( key >> 16 );
+    if( (bitmap == m_breakpoints.end()) ||
+	((bitmap->second[ addr / 64 ] & bit) == 0) )
+    {
+	cout << "No breakpoint at " << args[1] << endl;
+	return;
+    }
+
+    bitmap->second[ addr / 64 ] &= ~bit;
+    m_count--;
+
+    m_conditions.erase( key );
+    m_conditionText.erase( key );
+}
+
+void Debug::listBreakpoints( void )
+{
+    using namespace std;
+
+    for( auto it = m_breakpoints.begin(); it != m_breakpoints.end(); it++ )
+    {
+	for( uint32_t addr = 0; addr < 0x10000; addr++ )
 	{
-	    string second = input.substr( 1, ' ' );
-	    stringstream ss;
-	    ss << second;
+	    if( (it->second[ addr / 64 ] & (1ULL << (addr % 64))) == 0 ) { continue; }
+
+	    uint32_t key = ( (uint32_t)it->first << 16 ) | addr;
+	    cout << hex << it->first << ":" << addr;
+
+	    auto text = m_conditionText.find( key );
+	    if( text != m_conditionText.end() ) { cout << " if " << text->second; }
+	    cout << endl;
+	}
+    }
 
-	    uint16_t addr;
-	    ss >> hex >> addr;
+    // coalesce watched addresses into ranges
+    uint32_t start = 0;
+    while( start < 0x10000 )
+    {
+	uint8_t types = mp_bus->getWatchpoint( start );
 
-	    uint8_t val;
-	    mp_bus->access( addr, val, READ );
+	uint32_t end = start;
+	while( (end < 0xFFFF) && (mp_bus->getWatchpoint( end + 1 ) == types) ) { end++; }
 
-	    cout << "Value at " << hex << addr
-		 << ": " << hex << (int)val << endl;
+	if( types != 0 )
+	{
+	    cout << "watch " << hex << start << "-" << end << " "
+		 << ( (types & Bus::c_watchRead) ? "r" : "" )
+		 << ( (types & Bus::c_watchWrite) ? "w" : "" )
+		 << ( (types & Bus::c_watchChange) ? "c" : "" ) << endl;
 	}
-	else if( regex_match( input, regex("b ([0-9]|[a-f]|[A-F]){1,4}") ) )
-	{   
-	    string second = input.substr( 1, ' ' );
-	    stringstream ss;
-	    ss << second;
-
-	    uint16_t addr;
-	    ss >> hex >> addr;
-
-	    m_bAddr = addr;
-	    m_bFlag = true;
-
-	    cout << endl << "Breakpoint set at " << hex << (int)m_bAddr
-		 << endl;
-	}	
-	else if( input.compare("s") == 0 )
+
+	start = end + 1;
+    }
+}
+
+void Debug::setWatchpoint( const vector<string>& args )
+{
+    using namespace std;
+
+    bool set = ( args[0] == "w" );
+    size_t expected = set ? 3 : 2;
+
+    uint16_t start, end;
+    if( (args.size() != expected) ||
+	(this->parseRange( args[ expected - 1 ], start, end ) == false) )
+    {
+	cout << "Usage: w r|w|c addr[-addr], dw addr[-addr]" << endl;
+	return;
+    }
+
+    uint8_t type = 0;
+    if( set )
+    {
+	if( args[1] == "r" ) { type = Bus::c_watchRead; }
+	else if( args[1] == "w" ) { type = Bus::c_watchWrite; }
+	else if( args[1] == "c" ) { type = Bus::c_watchChange; }
+	else
 	{
-	    m_step = true;
-	    break;
+	    cout << "Unknown watchpoint type " << args[1] << endl;
+	    return;
 	}
-	else if( input.compare("i") == 0 )
+    }
+
+    for( uint32_t addr = start; addr <= end; addr++ )
+    {
+	uint8_t types = set ? ( mp_bus->getWatchpoint( addr ) | type ) : 0;
+	mp_bus->setWatchpoint( addr, types );
+    }
+}
+
+void Debug::printWatchHits( void )
+{
+    using namespace std;
+
+    vector<Bus::WatchHit>& hits = mp_bus->getWatchHits();
+
+    for( size_t i = 0; i < hits.size(); i++ )
+    {
+	const Bus::WatchHit& hit = hits[i];
+
+	if( hit.type == Bus::c_watchRead )
 	{
-	    mp_z80->printStatus();
+	    cout << "Read " << hex << (int)hit.value << " from " << hit.addr;
 	}
-	else if( input.compare("r") == 0 )
+	else
 	{
-	    break;
+	    cout << ( (hit.type == Bus::c_watchWrite) ? "Write " : "Change " )
+		 << hex << (int)hit.prev << " -> " << (int)hit.value
+		 << " at " << hit.addr;
 	}
+
+	cout << " by instruction at " << hex << m_instruction
+	     << ", cycle " << dec << hit.cycle << endl;
     }
 
+    hits.clear();
+}
+
+bool Debug::compileCondition( const string& operand, const string& op,
+			      const string& value, Condition& condition )
+{
+    Operand read;
+    Z80* z80 = mp_z80;
+    Bus* bus = mp_bus;
+
+    if( (operand.size() > 2) && (operand.front() == '[') && (operand.back() == ']') )
+    {
+	// memory operand
+	uint16_t addr;
+	if( this->parseNumber( operand.substr( 1, operand.size() - 2 ), addr ) == false )
+	{
+	    return false;
+	}
+
+	read = [bus, addr]( void ) -> uint16_t { return bus->peek( addr ); };
+    }
+    else
+    {
+	// register operand
+	typedef uint16_t (*RegisterRead)( const Registers& regs );
+	static const struct { const char* name; RegisterRead read; } registers[] =
+	{
+	    { "a", []( const Registers& r ) -> uint16_t { return r.a; } },
+	    { "f", []( const Registers& r ) -> uint16_t { return r.f; } },
+	    { "b", []( const Registers& r ) -> uint16_t { return r.b; } },
+	    { "c", []( const Registers& r ) -> uint16_t { return r.c; } },
+	    { "d", []( const Registers& r ) -> uint16_t { return r.d; } },
+	    { "e", []( const Registers& r ) -> uint16_t { return r.e; } },
+	    { "h", []( const Registers& r ) -> uint16_t { return r.h; } },
+	    { "l", []( const Registers& r ) -> uint16_t { return r.l; } },
+	    { "af", []( const Registers& r ) -> uint16_t { return r.af; } },
+	    { "bc", []( const Registers& r ) -> uint16_t { return r.bc; } },
+	    { "de", []( const Registers& r ) -> uint16_t { return r.de; } },
+	    { "hl", []( const Registers& r ) -> uint16_t { return r.hl; } },
+	    { "sp", []( const Registers& r ) -> uint16_t { return r.sp; } },
+	    { "pc", []( const Registers& r ) -> uint16_t { return r.pc; } }
+	};
+
+	for( const auto& reg : registers )
+	{
+	    if( operand != reg.name ) { continue; }
+
+	    RegisterRead get = reg.read;
+	    read = [z80, get]( void ) { return get( z80->getRegisters() ); };
+	}
+
+	if( !read ) { return false; }
+    }
+
+    uint16_t rhs;
+    if( this->parseNumber( value, rhs ) == false ) { return false; }
+
+    if( op == "==" ) { condition = [read, rhs]( void ) { return read() == rhs; }; }
+    else if( op == "!=" ) { condition = [read, rhs]( void ) { return read() != rhs; }; }
+    else if( op == "<" ) { condition = [read, rhs]( void ) { return read() < rhs; }; }
+    else if( op == "<=" ) { condition = [read, rhs]( void ) { return read() <= rhs; }; }
+    else if( op == ">" ) { condition = [read, rhs]( void ) { return read() > rhs; }; }
+    else if( op == ">=" ) { condition = [read, rhs]( void ) { return read() >= rhs; }; }
+    else { return false; }
+
+    return true;
+}
+
+bool Debug::parseNumber( const string& text, uint16_t& value )
+{
+    // an optional 0x followed by one to four hex digits
+    size_t start = 0;
+    if( (text.size() > 2) && (text[0] == '0') && ((text[1] == 'x') || (text[1] == 'X')) )
+    {
+	start = 2;
+    }
+
+    if( (text.size() == start) || (text.size() - start > 4) ) { return false; }
+
+    value = 0;
+    for( size_t i = start; i < text.size(); i++ )
+    {
+	char c = text[i];
+	if( isxdigit( (unsigned char)c ) == 0 ) { return false; }
+
+	uint16_t digit = isdigit( (unsigned char)c ) ? ( c - '0' ) : ( tolower( c ) - 'a' + 10 );
+	value = ( value << 4 ) | digit;
+    }
+
+    return true;
+}
+
+bool Debug::parseRange( const string& text, uint16_t& start, uint16_t& end )
+{
+    size_t dash = text.find( '-' );
+    if( dash == string::npos )
+    {
+	if( parseNumber( text, start ) == false ) { return false; }
+	end = start;
+	return true;
+    }
+
+    return parseNumber( text.substr( 0, dash ), start ) &&
+	parseNumber( text.substr( dash + 1 ), end ) &&
+	( start <= end );
+}
+
+bool Debug::parseAddress( const string& text, uint32_t& key )
+{
+    uint16_t bank = mp_bus->getRomBank();
+    uint16_t addr;
+
+    size_t colon = text.find( ':' );
+    if( colon != string::npos )
+    {
+	if( this->parseNumber( text.substr( 0, colon ), bank ) == false ) { return false; }
+	if( this->parseNumber( text.substr( colon + 1 ), addr ) == false ) { return false; }
+    }
+    else if( this->parseNumber( text, addr ) == false ) { return false; }
+
+    key = ( (uint32_t)this->getBank( addr, bank ) << 16 ) | addr;
+    return true;
+}
+
+uint16_t Debug::getBank( uint16_t addr, uint16_t bank )
+{
+    if( (addr >= 0x4000) && (addr < 0x8000) ) { return bank; }
     return 0;
 }
 
@@ -9,15 +9,33 @@
 #include "z80.h"
 #include "bus.h"
 
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
 /**
  * @author Rick Hallman
  * Command line debugger.
  * Commands:
  *          r : run
  *          s : step
+ *          q : quit
  *   b [addr] : set breakpoint to addr
+ *   b [addr] if [operand] [op] [value] : set conditional breakpoint
+ *   d [addr] : delete breakpoint at addr
+ *   w [type] [range] : set watchpoint on range (addr or addr-addr) for
+ *                      reads (r), writes (w) or writes that change
+ *                      the value (c)
+ *  dw [range] : delete watchpoints in range
+ *          l : list breakpoints and watchpoints
  *          i : display registers
  *   i [addr] : display value at address
+ *
+ * Addresses in 0x4000-0x7FFF may be given as bank:addr, otherwise they
+ * refer to the current bank. Operands are registers (a, f, b, c, d, e,
+ * h, l, af, bc, de, hl, sp, pc) or memory ([addr]). Operators are ==,
+ * !=, <, <=, > and >=. Numbers are hexadecimal.
  */
 class Debug
 {
@@ -30,18 +48,128 @@ public:
      * @return 0, or 1 to quit
      */
     uint8_t repl( void );
-    
+
+    /**
+     * Whether or not the debugger needs to check every instruction, i.e.
+     * it is stepping or has breakpoints. Otherwise the emulator can run
+     * without checking for breakpoints.
+     * @return true if yes, false otherwise
+     */
+    bool isActive( void );
+
+    /**
+     * Whether or not the debugger stops before the next instruction,
+     * either because it is stepping, the last instruction hit a
+     * watchpoint, or at a breakpoint whose condition holds.
+     * @return true if yes, false otherwise
+     */
+    bool isBreakpoint( void );
+
 private:
-    
+
+    // a compiled breakpoint condition
+    typedef std::function<bool( void )> Condition;
+
+    // a compiled operand of a condition
+    typedef std::function<uint16_t( void )> Operand;
+
+    /**
+     * Executes a single command.
+     * @param args the command's words
+     * @param done set to true if emulation should continue
+     * @return 0, or 1 to quit
+     */
+    uint8_t execute( const std::vector<std::string>& args, bool& done );
+
+    /**
+     * Sets a breakpoint.
+     * @param args the command's words
+     */
+    void setBreakpoint( const std::vector<std::string>& args );
+
+    /**
+     * Deletes a breakpoint.
+     * @param args the command's words
+     */
+    void deleteBreakpoint( const std::vector<std::string>& args );
+
+    /**
+     * Lists every breakpoint and watchpoint.
+     */
+    void listBreakpoints( void );
+
+    /**
+     * Sets or deletes watchpoints.
+     * @param args the command's words
+     */
+    void setWatchpoint( const std::vector<std::string>& args );
+
+    /**
+     * Prints and clears the watchpoint hits since the last instruction.
+     */
+    void printWatchHits( void );
+
+    /**
+     * Compiles a condition.
+     * @param operand the operand's text
+     * @param op the operator's text
+     * @param value the value's text
+     * @param condition set to the compiled condition
+     * @return true if the condition is valid, false otherwise
+     */
+    bool compileCondition( const std::string& operand, const std::string& op,
+			   const std::string& value, Condition& condition );
+
+    /**
+     * Parses a hexadecimal number.
+     * @param text the text to parse
+     * @param value set to the number
+     * @return true if the text is a valid 16-bit number, false otherwise
+     */
+    static bool parseNumber( const std::string& text, uint16_t& value );
+
+    /**
+     * Parses an address range (addr or addr-addr).
+     * @param text the text to parse
+     * @param start set to the first address
+     * @param end set to the last address
+     * @return true if valid, false otherwise
+     */
+    static bool parseRange( const std::string& text, uint16_t& start, uint16_t& end );
+
+    /**
+     * Parses a breakpoint address, optionally preceded by a bank.
+     * @param text the text to parse
+     * @param key set to the breakpoint's key
+     * @return true if valid, false otherwise
+     */
+    bool parseAddress( const std::string& text, uint32_t& key );
+
+    /**
+     * Gets the bank that code at an address is in. Only 0x4000-0x7FFF
+     * is banked.
+     * @param addr the address
+     * @param bank the ROM bank mapped to 0x4000-0x7FFF
+     * @return the bank, or 0 if not banked
+     */
+    static uint16_t getBank( uint16_t addr, uint16_t bank );
+
     Z80* mp_z80;
     Bus* mp_bus;
 
-
     // Step flag
     bool m_step;
-    
-    // The debugger's break address. 
-    bool m_bFlag;
-    uint16_t m_bAddr;
 
+    // one bit per address for each bank with breakpoints
+    std::unordered_map<uint16_t, std::vector<uint64_t>> m_breakpoints;
+
+    // breakpoint conditions, keyed by bank and address
+    std::unordered_map<uint32_t, Condition> m_conditions;
+    std::unordered_map<uint32_t, std::string> m_conditionText;
+
+    // the number of breakpoints set
+    unsigned int m_count;
+
+    // the address of the last instruction, for reporting watchpoint hits
+    uint16_t m_instruction;
 };
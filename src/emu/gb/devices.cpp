@@ -1,5 +1,6 @@
 #include "devices.h"
 #include "bus.h"
+#include "scheduler.h"
 
 MemoryDevice::MemoryDevice( uint16_t start, uint16_t end ) :
     m_start( start ),
@@ -21,6 +22,11 @@ uint16_t MemoryDevice::getEnd( void )
     return m_end;
 }
 
+bool MemoryDevice::isVolatile( uint16_t /* addr */ )
+{
+    return false;
+}
+
 GenericDevice::GenericDevice( uint16_t start, uint16_t end )
     : MemoryDevice( start, end ),
       mp_memory( NULL )
@@ -83,7 +89,13 @@ void ReadOnlyDevice::forceWrite( uint16_t addr, uint8_t data )
 
 DMATransferDevice::DMATransferDevice( Bus* bus )
     : MemoryDevice( c_addr, c_addr ),
-      mp_bus( bus )
+      mp_bus( bus ),
+      mp_scheduler( NULL ),
+      m_reg( 0xFF ),
+      m_source( 0x0000 ),
+      m_start( 0 ),
+      m_copied( 0 ),
+      m_active( false )
 {
 }
 
@@ -91,16 +103,120 @@ DMATransferDevice::~DMATransferDevice( void )
 {
 }
 
-void DMATransferDevice::access( uint16_t addr, uint8_t& data, bool write )
+void DMATransferDevice::access( uint16_t /* addr */, uint8_t& data, bool write )
 {
-    if( write == READ ) { return; }
+    if( write == READ )
+    {
+	data = m_reg;
+	return;
+    }
+
+    // a new transfer replaces the one running
+    this->sync();
 
-    uint16_t src = (uint16_t)data << 8;
+    m_reg = data;
+    m_source = (uint16_t)data << 8;
+    m_copied = 0;
 
-    for( uint16_t i = 0x00; i <= 0x9F; i++ )
+    if( mp_scheduler == NULL )
     {
-	uint8_t val;
-	mp_bus->access( src + i, val, READ );
-	mp_bus->access( 0xFE00 + i, val, WRITE );
-    }    
+	uint8_t buffer[ c_length ];
+	mp_bus->readSpan( m_source, buffer, c_length );
+	mp_bus->writeSpan( 0xFE00, buffer, c_length );
+	return;
+    }
+
+    // copying starts a machine cycle after the write
+    m_start = mp_scheduler->getCycles() + c_byteTicks;
+    m_active = true;
+    mp_bus->setBlocked( true );
+
+    this->scheduleTransfer();
+}
+
+void DMATransferDevice::setScheduler( Scheduler* scheduler )
+{
+    mp_scheduler = scheduler;
+}
+
+void DMATransferDevice::sync( void )
+{
+    if( m_active == false ) { return; }
+
+    uint16_t due = this->getProgress();
+    if( due <= m_copied ) { return; }
+
+    // the CPU is blocked from memory, the transfer itself is not
+    uint8_t buffer[ c_length ];
+    uint16_t count = due - m_copied;
+
+    mp_bus->setBlocked( false );
+    mp_bus->readSpan( m_source + m_copied, buffer, count );
+    mp_bus->writeSpan( 0xFE00 + m_copied, buffer, count );
+    mp_bus->setBlocked( true );
+
+    m_copied = due;
+}
+
+uint8_t DMATransferDevice::getConflictValue( uint16_t addr )
+{
+    if( addr >= 0xFE00 ) { return 0xFF; }
+
+    uint16_t index = this->getProgress();
+    if( index >= c_length ) { index = c_length - 1; }
+
+    return mp_bus->peek( m_source + index );
+}
+
+void DMATransferDevice::handleTransfer( void )
+{
+    this->sync();
+
+    if( m_copied < c_length )
+    {
+	this->scheduleTransfer();
+	return;
+    }
+
+    m_active = false;
+    mp_bus->setBlocked( false );
+}
+
+uint16_t DMATransferDevice::getProgress( void )
+{
+    uint64_t now = mp_scheduler->getCycles();
+    if( now < m_start ) { return 0; }
+
+    uint64_t due = ( now - m_start ) / c_byteTicks;
+    return ( due < c_length ) ? (uint16_t)due : c_length;
+}
+
+void DMATransferDevice::scheduleTransfer( void )
+{
+    // nothing sees OAM change unless it looks, so wake up once at the end
+    uint16_t bytes = mp_bus->hasWatchpoints() ? ( m_copied + 1 ) : c_length;
+    mp_scheduler->schedule( Scheduler::C_EVENT_DMA, m_start + (bytes * c_byteTicks) );
+}
+
+ScanlineDevice::ScanlineDevice( Bus* bus )
+    : MemoryDevice( c_addr, c_addr ),
+      mp_bus( bus )
+{
+}
+
+ScanlineDevice::~ScanlineDevice( void )
+{
+}
+
+void ScanlineDevice::access( uint16_t addr, uint8_t& data, bool write )
+{
+    if( write == READ )
+    {
+	mp_bus->defaultAccess( addr, data, READ );
+    }
+    else
+    {
+	uint8_t reset = 0x00;
+	mp_bus->defaultAccess( addr, reset, WRITE );
+    }
 }
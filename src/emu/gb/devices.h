@@ -3,6 +3,7 @@
 #include <stdint.h>
 
 class Bus;
+class Scheduler;
 
 /**
  * @author Rick Hallman
@@ -39,6 +40,14 @@ public:
      * @return the device's end address
      */
     uint16_t getEnd( void );
+
+    /**
+     * Whether or not reading an address can return a different value
+     * without any write, e.g. a register that counts time.
+     * @param addr the address
+     * @return true if yes, false otherwise
+     */
+    virtual bool isVolatile( uint16_t addr );
     
 protected:
     
@@ -95,8 +104,14 @@ public:
 };
 
 /**
- * When this device is written to, a DMA transfer is executed.
+ * When this device is written to, a DMA transfer to OAM starts.
  * Hard coded to 0xFF46.
+ *
+ * The transfer copies one byte per machine cycle, during which the CPU
+ * can only reach the I/O registers and HRAM. Bytes are copied lazily:
+ * only when the transfer ends or something is about to look at OAM, so
+ * usually the whole transfer is one bulk copy. With watchpoints set, every
+ * byte is copied at its own cycle so hits are reported when they happen.
  */
 class DMATransferDevice : public MemoryDevice
 {
@@ -104,6 +119,10 @@ public:
 
     static const uint16_t c_addr = 0xFF46;
 
+    // the number of bytes copied, and the ticks each byte takes
+    static const uint16_t c_length = 0xA0;
+    static const uint32_t c_byteTicks = 4;
+
     /**
      * Constructor.
      * @param bus the device's bus
@@ -113,7 +132,80 @@ public:
 
     virtual void access( uint16_t addr, uint8_t& data, bool write );
 
+    /**
+     * Sets the scheduler that times transfers. Without one, transfers
+     * complete instantly.
+     * @param scheduler the hardware event scheduler
+     */
+    void setScheduler( Scheduler* scheduler );
+
+    /**
+     * Copies every byte due by the current cycle.
+     */
+    void sync( void );
+
+    /**
+     * Gets the value the CPU reads from a blocked address during a
+     * transfer. OAM reads 0xFF, and other memory shares the bus with the
+     * transfer, so reads return the byte being transferred.
+     * @param addr the address read
+     * @return the value read
+     */
+    uint8_t getConflictValue( uint16_t addr );
+
+    /**
+     * Called when the transfer's next update is due.
+     */
+    void handleTransfer( void );
+
 private:
+
+    /**
+     * Gets the number of bytes due by the current cycle.
+     * @return the number of bytes
+     */
+    uint16_t getProgress( void );
+
+    /**
+     * Schedules the transfer's next update.
+     */
+    void scheduleTransfer( void );
+
     Bus* mp_bus;
+    Scheduler* mp_scheduler;
+
+    // the last value written
+    uint8_t m_reg;
+
+    // the transfer's source, the cycle it started copying at and the
+    // number of bytes copied so far
+    uint16_t m_source;
+    uint64_t m_start;
+    uint16_t m_copied;
+    bool m_active;
 };
 
+/**
+ * @author Rick Hallman
+ * LCDC Y coordinate. The LCD updates it through the bus' default memory,
+ * and any write from the CPU resets it to 0.
+ * Hard coded to 0xFF44.
+ */
+class ScanlineDevice : public MemoryDevice
+{
+public:
+
+    static const uint16_t c_addr = 0xFF44;
+
+    /**
+     * Constructor.
+     * @param bus the device's bus
+     */
+    ScanlineDevice( Bus* bus );
+    virtual ~ScanlineDevice( void );
+
+    virtual void access( uint16_t addr, uint8_t& data, bool write );
+
+private:
+    Bus* mp_bus;
+};
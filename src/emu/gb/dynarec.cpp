@@ -0,0 +1,942 @@
+#include "dynarec.h"
+
+#ifdef DYNAREC_ENABLED
+
+#include "z80.h"
+
+#include <sys/mman.h>
+#include <string.h>
+#include <unistd.h>
+
+Dynarec::Dynarec( Z80* z80 )
+    : mp_code( NULL ),
+      m_codeSize( 0 ),
+      m_codeUsed( 0 ),
+      m_passStart( 0 ),
+      m_index( 0 ),
+      m_addr( 0 ),
+      m_ticks( 0 ),
+      m_lastTicks( 0 ),
+      m_passTicks( 0 ),
+      m_loopBranchTicks( 0 ),
+      m_op( Z80::C_FLAGS_EVALUATED )
+{
+    const uint8_t* cpu = (const uint8_t*)z80;
+    Registers& regs = z80->m_regs;
+
+    m_reg[ 0 ] = (const uint8_t*)&regs.b - cpu;
+    m_reg[ 1 ] = (const uint8_t*)&regs.c - cpu;
+    m_reg[ 2 ] = (const uint8_t*)&regs.d - cpu;
+    m_reg[ 3 ] = (const uint8_t*)&regs.e - cpu;
+    m_reg[ 4 ] = (const uint8_t*)&regs.h - cpu;
+    m_reg[ 5 ] = (const uint8_t*)&regs.l - cpu;
+    m_reg[ 6 ] = (const uint8_t*)&regs.f - cpu;
+    m_reg[ 7 ] = (const uint8_t*)&regs.a - cpu;
+
+    m_bc = (const uint8_t*)&regs.bc - cpu;
+    m_de = (const uint8_t*)&regs.de - cpu;
+    m_hl = (const uint8_t*)&regs.hl - cpu;
+    m_af = (const uint8_t*)&regs.af - cpu;
+    m_sp = (const uint8_t*)&regs.sp - cpu;
+    m_pc = (const uint8_t*)&regs.pc - cpu;
+
+    m_flagOp = (const uint8_t*)&z80->m_flagOp - cpu;
+    m_flagResult = (const uint8_t*)&z80->m_flagResult - cpu;
+    m_flagPrev = (const uint8_t*)&z80->m_flagPrev - cpu;
+    m_flagDelta = (const uint8_t*)&z80->m_flagDelta - cpu;
+    m_flagCarry = (const uint8_t*)&z80->m_flagCarry - cpu;
+
+    // code pages are made writable while a block is copied in, then
+    // executable once it is there
+    void* code = mmap( NULL, c_codeSize, PROT_NONE,
+		       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+
+    // without memory for code, everything stays interpreted
+    if( code != MAP_FAILED )
+    {
+	mp_code = (uint8_t*)code;
+	m_codeSize = c_codeSize;
+    }
+}
+
+Dynarec::~Dynarec( void )
+{
+    if( mp_code != NULL )
+    {
+	munmap( mp_code, m_codeSize );
+	mp_code = NULL;
+    }
+}
+
+bool Dynarec::isAvailable( void )
+{
+    return ( mp_code != NULL ) && ( m_codeUsed < m_codeSize );
+}
+
+bool Dynarec::compile( Block& block )
+{
+    if( this->isAvailable() == false ) { return false; }
+
+    // translate up to the first instruction that must be interpreted
+    unsigned int length = 0;
+    m_passTicks = 0;
+    while( (length < block.instructions.size()) &&
+	   this->canTranslate( block.instructions[ length ] ) )
+    {
+	m_passTicks += block.instructions[ length ].ticks;
+	length++;
+    }
+
+    if( length == 0 ) { return false; }
+
+    // a block whose branch leads back to its start loops natively
+    const CachedInstruction& last = block.instructions[ length - 1 ];
+    uint16_t next = last.addr + last.length;
+    int32_t target = -1;
+    m_loopBranchTicks = 0;
+
+    switch( last.opcode )
+    {
+    case 0x18: case 0x20: case 0x28: case 0x30: case 0x38: // JR
+	target = (uint16_t)( next + (int8_t)last.operands[ 0 ] );
+	m_loopBranchTicks = 12;
+	break;
+    case 0xC2: case 0xC3: case 0xCA: case 0xD2: case 0xDA: // JP
+	target = ( last.operands[ 1 ] << 8 ) | last.operands[ 0 ];
+	m_loopBranchTicks = 16;
+	break;
+    default:
+	break;
+    }
+
+    if( target != block.start ) { m_loopBranchTicks = 0; }
+
+    m_buffer.clear();
+    m_exits.clear();
+    m_op = Z80::C_FLAGS_EVALUATED;
+    m_ticks = 0;
+    m_lastTicks = m_loopBranchTicks;
+
+    // push rbx; push rbp; push r12; push r13; push r14; push r15
+    // sub rsp, 24 (the budget and a temporary, keeping rsp 16-byte aligned)
+    // mov rbx, rdi; mov [rsp], esi; xor r12d, r12d
+    static const uint8_t prologue[] = { 0x53, 0x55, 0x41, 0x54, 0x41, 0x55,
+					 0x41, 0x56, 0x41, 0x57,
+					 0x48, 0x83, 0xEC, 0x18,
+					 0x48, 0x89, 0xFB,
+					 0x89, 0x34, 0x24,
+					 0x45, 0x31, 0xE4 };
+    for( unsigned int i = 0; i < sizeof(prologue); i++ ) { this->emit( prologue[ i ] ); }
+
+    m_passStart = m_buffer.size();
+
+    for( unsigned int i = 0; i < length; i++ )
+    {
+	m_index = i;
+	m_addr = block.instructions[ i ].addr;
+	this->translate( block, i );
+    }
+
+    // branches leave by themselves, anything else continues in the
+    // interpreter after the last translated instruction
+    if( (length < block.instructions.size()) ||
+	(Z80::endsBlock( last.opcode ) == false) )
+    {
+	this->emitExit( length, m_lastTicks, m_ticks, m_ticks, next );
+    }
+
+    // exits are numbered in the low byte of the return value
+    if( m_exits.size() > 0x100 ) { return false; }
+
+    uint32_t start = ( m_codeUsed + 15 ) & ~15;
+    uint32_t end = start + m_buffer.size();
+    if( end > m_codeSize )
+    {
+	m_codeUsed = m_codeSize;
+	return false;
+    }
+
+    // only the pages being written are writable, and never executable
+    uint32_t pageSize = sysconf( _SC_PAGESIZE );
+    uint32_t first = start & ~( pageSize - 1 );
+    uint32_t size = ( ( end + pageSize - 1 ) & ~( pageSize - 1 ) ) - first;
+
+    if( mprotect( mp_code + first, size, PROT_READ | PROT_WRITE ) != 0 ) { return false; }
+    memcpy( mp_code + start, m_buffer.data(), m_buffer.size() );
+
+    if( mprotect( mp_code + first, size, PROT_READ | PROT_EXEC ) != 0 )
+    {
+	// the code cannot run, so stop compiling
+	m_codeUsed = m_codeSize;
+	return false;
+    }
+
+    m_codeUsed = end;
+
+    block.native = (NativeBlock)( mp_code + start );
+    block.nativeTicks = m_passTicks;
+    block.nativeExits = m_exits;
+
+    return true;
+}
+
+bool Dynarec::canTranslate( const CachedInstruction& instruction )
+{
+    switch( instruction.opcode )
+    {
+    case 0x08: // LD (a16),SP
+    case 0x10: // STOP
+    case 0x76: // HALT
+    case 0xD9: // RETI
+    case 0xF3: // DI
+    case 0xFB: // EI
+    case 0xD3: case 0xDB: case 0xDD: case 0xE3: case 0xE4: // undefined
+    case 0xEB: case 0xEC: case 0xED: case 0xF4: case 0xFC: case 0xFD:
+	return false;
+    default:
+	return true;
+    }
+}
+
+bool Dynarec::isCalled( uint8_t opcode )
+{
+    switch( opcode )
+    {
+    case 0x07: case 0x0F: case 0x17: case 0x1F: // rotates of A
+    case 0x27: case 0x2F: case 0x37: case 0x3F: // DAA, CPL, SCF, CCF
+    case 0x09: case 0x19: case 0x29: case 0x39: // ADD HL,rr
+    case 0xE8: case 0xF8: // ADD SP,r8 and LD HL,SP+r8
+    case 0xCB:
+	return true;
+    default:
+	return false;
+    }
+}
+
+void Dynarec::translate( Block& block, unsigned int index )
+{
+    const CachedInstruction& instruction = block.instructions[ index ];
+    uint8_t opcode = instruction.opcode;
+    uint8_t imm8 = instruction.operands[ 0 ];
+    uint16_t imm16 = ( instruction.operands[ 1 ] << 8 ) | instruction.operands[ 0 ];
+
+    // the 16-bit register encoded in bits 4-5 (BC, DE, HL, SP)
+    int32_t pairs[ 4 ] = { m_bc, m_de, m_hl, m_sp };
+    int32_t pair = pairs[ (opcode >> 4) & 0x03 ];
+
+    if( Z80::endsBlock( opcode ) )
+    {
+	this->translateBranch( block, index );
+	return;
+    }
+
+    if( this->isCalled( opcode ) )
+    {
+	// the handler works on the flags register
+	this->emitFlushFlags();
+	this->emit( 0x48 ); this->emit( 0xBE ); // mov rsi, instruction
+	this->emitValue( (uint64_t)&instruction, 8 );
+	this->emitCall( (const void*)&Z80::nativeExecute );
+
+	// only CB operations on (HL) access memory
+	if( (opcode == 0xCB) && ((imm8 & 0x07) == 0x06) ) { this->emitBailCheck(); }
+
+	m_op = Z80::C_FLAGS_EVALUATED;
+    }
+    else if( (opcode >= 0x40) && (opcode <= 0x7F) )
+    {
+	// LD r,r'
+	uint8_t dst = (opcode >> 3) & 0x07;
+	uint8_t src = opcode & 0x07;
+
+	if( src == 0x06 )
+	{
+	    this->emitLoadWord( C_RSI, m_hl );
+	    this->emitRead();
+	    this->emitStoreByte( m_reg[ dst ], C_RAX );
+	}
+	else if( dst == 0x06 )
+	{
+	    this->emitLoadByte( C_RDX, m_reg[ src ] );
+	    this->emitLoadWord( C_RSI, m_hl );
+	    this->emitWrite();
+	}
+	else
+	{
+	    this->emitLoadByte( C_RAX, m_reg[ src ] );
+	    this->emitStoreByte( m_reg[ dst ], C_RAX );
+	}
+    }
+    else if( (opcode >= 0x80) && (opcode <= 0xBF) )
+    {
+	// arithmetic and logic on A
+	uint8_t src = opcode & 0x07;
+
+	if( src == 0x06 )
+	{
+	    this->emitLoadWord( C_RSI, m_hl );
+	    this->emitRead();
+	    this->emitMove( C_RDX, C_RAX );
+	}
+	else { this->emitLoadByte( C_RDX, m_reg[ src ] ); }
+
+	this->translateAlu( (opcode >> 3) & 0x07 );
+    }
+    else if( (opcode >= 0xC6) && ((opcode & 0x07) == 0x06) )
+    {
+	// arithmetic and logic on A with an immediate
+	this->emitMoveImm( C_RDX, imm8 );
+	this->translateAlu( (opcode >> 3) & 0x07 );
+    }
+    else
+    {
+	switch( opcode )
+	{
+	case 0x01: case 0x11: case 0x21: case 0x31: // LD rr,d16
+	    this->emitStoreWordImm( pair, imm16 );
+	    break;
+	case 0x03: case 0x13: case 0x23: case 0x33: // INC rr
+	    this->emitAddWordImm( pair, 1 );
+	    break;
+	case 0x0B: case 0x1B: case 0x2B: case 0x3B: // DEC rr
+	    this->emitAddWordImm( pair, -1 );
+	    break;
+	case 0x04: case 0x0C: case 0x14: case 0x1C: case 0x24: case 0x2C: case 0x3C: // INC r
+	    this->translateIncDec( (opcode >> 3) & 0x07, false );
+	    break;
+	case 0x05: case 0x0D: case 0x15: case 0x1D: case 0x25: case 0x2D: case 0x3D: // DEC r
+	    this->translateIncDec( (opcode >> 3) & 0x07, true );
+	    break;
+	case 0x34: // INC (HL)
+	case 0x35: // DEC (HL)
+	    this->translateIncDec( 0x06, opcode == 0x35 );
+	    break;
+	case 0x06: case 0x0E: case 0x16: case 0x1E: case 0x26: case 0x2E: case 0x3E: // LD r,d8
+	    this->emitStoreByteImm( m_reg[ (opcode >> 3) & 0x07 ], imm8 );
+	    break;
+	case 0x36: // LD (HL),d8
+	    this->emitMoveImm( C_RDX, imm8 );
+	    this->emitLoadWord( C_RSI, m_hl );
+	    this->emitWrite();
+	    break;
+	case 0x02: // LD (BC),A
+	case 0x12: // LD (DE),A
+	case 0x22: // LD (HL+),A
+	case 0x32: // LD (HL-),A
+	    this->emitLoadByte( C_RDX, m_reg[ 7 ] );
+	    this->emitLoadWord( C_RSI, ( opcode < 0x20 ) ? pair : m_hl );
+	    this->emitWrite();
+	    if( opcode == 0x22 ) { this->emitAddWordImm( m_hl, 1 ); }
+	    if( opcode == 0x32 ) { this->emitAddWordImm( m_hl, -1 ); }
+	    break;
+	case 0x0A: // LD A,(BC)
+	case 0x1A: // LD A,(DE)
+	case 0x2A: // LD A,(HL+)
+	case 0x3A: // LD A,(HL-)
+	    this->emitLoadWord( C_RSI, ( opcode < 0x20 ) ? pair : m_hl );
+	    this->emitRead();
+	    this->emitStoreByte( m_reg[ 7 ], C_RAX );
+	    if( opcode == 0x2A ) { this->emitAddWordImm( m_hl, 1 ); }
+	    if( opcode == 0x3A ) { this->emitAddWordImm( m_hl, -1 ); }
+	    break;
+	case 0xE0: // LDH (a8),A
+	case 0xE2: // LD (C),A
+	case 0xEA: // LD (a16),A
+	    this->emitLoadByte( C_RDX, m_reg[ 7 ] );
+	    if( opcode == 0xE0 ) { this->emitMoveImm( C_RSI, 0xFF00 | imm8 ); }
+	    else if( opcode == 0xEA ) { this->emitMoveImm( C_RSI, imm16 ); }
+	    else
+	    {
+		this->emitLoadByte( C_RSI, m_reg[ 1 ] );
+		this->emitAluImm( C_ALU_OR, C_RSI, 0xFF00 );
+	    }
+	    this->emitWrite();
+	    break;
+	case 0xF0: // LDH A,(a8)
+	case 0xF2: // LD A,(C)
+	case 0xFA: // LD A,(a16)
+	    if( opcode == 0xF0 ) { this->emitMoveImm( C_RSI, 0xFF00 | imm8 ); }
+	    else if( opcode == 0xFA ) { this->emitMoveImm( C_RSI, imm16 ); }
+	    else
+	    {
+		this->emitLoadByte( C_RSI, m_reg[ 1 ] );
+		this->emitAluImm( C_ALU_OR, C_RSI, 0xFF00 );
+	    }
+	    this->emitRead();
+	    this->emitStoreByte( m_reg[ 7 ], C_RAX );
+	    break;
+	case 0xC5: case 0xD5: case 0xE5: case 0xF5: // PUSH rr
+	    if( opcode == 0xF5 ) { this->emitEvaluateFlags(); }
+	    this->emitLoadWord( C_RSI, m_sp );
+	    this->emitAluImm( C_ALU_ADD, C_RSI, 0xFFFE );
+	    this->emitAluImm( C_ALU_AND, C_RSI, 0xFFFF );
+	    this->emitLoadWord( C_RDX, ( opcode == 0xF5 ) ? m_af : pair );
+	    this->emitCall( (const void*)&Z80::nativePush );
+	    this->emitBailCheck();
+	    this->emitAddWordImm( m_sp, -2 );
+	    break;
+	case 0xC1: case 0xD1: case 0xE1: case 0xF1: // POP rr
+	    this->emitLoadWord( C_RSI, m_sp );
+	    this->emitCall( (const void*)&Z80::nativePop );
+	    this->emitBailCheck();
+	    if( opcode == 0xF1 )
+	    {
+		// the lower four bits of F are always zero
+		this->emitAluImm( C_ALU_AND, C_RAX, 0xFFF0 );
+		m_op = Z80::C_FLAGS_EVALUATED;
+	    }
+	    this->emitStoreWord( ( opcode == 0xF1 ) ? m_af : pair, C_RAX );
+	    this->emitAddWordImm( m_sp, 2 );
+	    break;
+	case 0xF9: // LD SP,HL
+	    this->emitLoadWord( C_RAX, m_hl );
+	    this->emitStoreWord( m_sp, C_RAX );
+	    break;
+	case 0x00: // NOP
+	default:
+	    break;
+	}
+    }
+
+    m_ticks += instruction.ticks;
+    m_lastTicks = instruction.ticks;
+}
+
+void Dynarec::translateAlu( uint8_t operation )
+{
+    switch( operation )
+    {
+    case 0x00: // ADD
+    case 0x01: // ADC
+    case 0x02: // SUB
+    case 0x03: // SBC
+    case 0x07: // CP
+	{
+	    bool add = ( operation <= 0x01 );
+	    AluOp op = add ? C_ALU_ADD : C_ALU_SUB;
+
+	    if( (operation == 0x01) || (operation == 0x03) ) { this->emitCarry( C_RCX ); }
+	    else { this->emitMoveImm( C_RCX, 0 ); }
+
+	    // result = A +/- value +/- carry, keeping A, value and carry
+	    this->emitLoadByte( C_R14, m_reg[ 7 ] );
+	    this->emitMove( C_R15, C_RDX );
+	    this->emitMove( C_RBP, C_RCX );
+	    this->emitMove( C_R13, C_R14 );
+	    this->emitAlu( op, C_R13, C_R15 );
+	    this->emitAlu( op, C_R13, C_RBP );
+	    this->emitZeroExtend( C_R13, C_R13 );
+
+	    if( operation != 0x07 ) { this->emitStoreByte( m_reg[ 7 ], C_R13 ); }
+
+	    m_op = add ? Z80::C_FLAGS_ADD : Z80::C_FLAGS_SUB;
+	}
+	break;
+    case 0x04: // AND
+    case 0x05: // XOR
+    case 0x06: // OR
+	{
+	    AluOp ops[ 3 ] = { C_ALU_AND, C_ALU_XOR, C_ALU_OR };
+
+	    this->emitLoadByte( C_R13, m_reg[ 7 ] );
+	    this->emitAlu( ops[ operation - 0x04 ], C_R13, C_RDX );
+	    this->emitStoreByte( m_reg[ 7 ], C_R13 );
+	    this->emitMoveImm( C_R14, 0 );
+	    this->emitMoveImm( C_R15, 0 );
+	    this->emitMoveImm( C_RBP, 0 );
+
+	    m_op = ( operation == 0x04 ) ? Z80::C_FLAGS_AND : Z80::C_FLAGS_LOGIC;
+	}
+	break;
+    default:
+	break;
+    }
+}
+
+void Dynarec::translateIncDec( uint8_t reg, bool decrement )
+{
+    AluOp op = decrement ? C_ALU_SUB : C_ALU_ADD;
+
+    if( reg == 0x06 )
+    {
+	// (HL): nothing changes until the write has been done
+	this->emitLoadWord( C_RSI, m_hl );
+	this->emitRead();
+
+	this->emit( 0x89 ); this->emit( 0x44 ); // mov [rsp+8], eax
+	this->emit( 0x24 ); this->emit( 0x08 );
+
+	this->emitMove( C_RDX, C_RAX );
+	this->emitAluImm( op, C_RDX, 1 );
+	this->emitAluImm( C_ALU_AND, C_RDX, 0xFF );
+	this->emitLoadWord( C_RSI, m_hl );
+	this->emitWrite();
+
+	this->emitCarry( C_RBP );
+	this->emit( 0x44 ); this->emit( 0x8B ); // mov r14d, [rsp+8]
+	this->emit( 0x74 ); this->emit( 0x24 ); this->emit( 0x08 );
+	this->emitMove( C_R13, C_R14 );
+	this->emitAluImm( op, C_R13, 1 );
+	this->emitZeroExtend( C_R13, C_R13 );
+    }
+    else
+    {
+	// carry is unaffected
+	this->emitCarry( C_RBP );
+	this->emitLoadByte( C_R14, m_reg[ reg ] );
+	this->emitMove( C_R13, C_R14 );
+	this->emitAluImm( op, C_R13, 1 );
+	this->emitZeroExtend( C_R13, C_R13 );
+	this->emitStoreByte( m_reg[ reg ], C_R13 );
+    }
+
+    this->emitMoveImm( C_R15, 1 );
+    m_op = decrement ? Z80::C_FLAGS_DEC : Z80::C_FLAGS_INC;
+}
+
+void Dynarec::translateBranch( Block& block, unsigned int index )
+{
+    const CachedInstruction& instruction = block.instructions[ index ];
+    uint8_t opcode = instruction.opcode;
+    uint16_t next = instruction.addr + instruction.length;
+    uint16_t imm16 = ( instruction.operands[ 1 ] << 8 ) | instruction.operands[ 0 ];
+    uint8_t length = index + 1;
+
+    // the condition (bits 3-4: NZ, Z, NC, C), and the ticks if not taken
+    int cond = C_COND_ALWAYS;
+    uint8_t skipTicks = 0;
+
+    switch( opcode )
+    {
+    case 0x20: case 0x28: case 0x30: case 0x38: skipTicks = 8; break;
+    case 0xC2: case 0xCA: case 0xD2: case 0xDA: skipTicks = 12; break;
+    case 0xC4: case 0xCC: case 0xD4: case 0xDC: skipTicks = 12; break;
+    case 0xC0: case 0xC8: case 0xD0: case 0xD8: skipTicks = 8; break;
+    default: break;
+    }
+
+    if( skipTicks != 0 )
+    {
+	cond = this->emitFlag( (opcode & 0x10) ? c_carry : c_zero );
+
+	// NZ and NC branch when the flag is clear
+	if( (opcode & 0x08) == 0 )
+	{
+	    if( cond == C_COND_ALWAYS ) { cond = C_COND_NEVER; }
+	    else if( cond == C_COND_NEVER ) { cond = C_COND_ALWAYS; }
+	    else { cond ^= 0x01; }
+	}
+    }
+
+    uint8_t op = m_op;
+    uint32_t skip = 0;
+
+    if( cond != C_COND_NEVER )
+    {
+	if( cond != C_COND_ALWAYS ) { skip = this->emitJump( cond ^ 0x01 ); }
+
+	switch( opcode )
+	{
+	case 0x18: case 0x20: case 0x28: case 0x30: case 0x38: // JR
+	    this->emitTaken( block, next + (int8_t)instruction.operands[ 0 ], 12 );
+	    break;
+	case 0xC2: case 0xC3: case 0xCA: case 0xD2: case 0xDA: // JP
+	    this->emitTaken( block, imm16, 16 );
+	    break;
+	case 0xE9: // JP (HL)
+	    this->emitLoadWord( C_RAX, m_hl );
+	    this->emitStoreWord( m_pc, C_RAX );
+	    this->emitExit( length, 4, m_ticks + 4, m_ticks + 4, -1 );
+	    break;
+	case 0xC4: case 0xCC: case 0xCD: case 0xD4: case 0xDC: // CALL
+	case 0xC7: case 0xCF: case 0xD7: case 0xDF: // RST
+	case 0xE7: case 0xEF: case 0xF7: case 0xFF:
+	    this->emitLoadWord( C_RSI, m_sp );
+	    this->emitAluImm( C_ALU_ADD, C_RSI, 0xFFFE );
+	    this->emitAluImm( C_ALU_AND, C_RSI, 0xFFFF );
+	    this->emitMoveImm( C_RDX, next );
+	    this->emitCall( (const void*)&Z80::nativePush );
+	    this->emitBailCheck();
+	    this->emitAddWordImm( m_sp, -2 );
+
+	    if( (opcode & 0x07) == 0x07 ) { this->emitTaken( block, opcode & 0x38, 16 ); }
+	    else { this->emitTaken( block, imm16, 24 ); }
+	    break;
+	case 0xC0: case 0xC8: case 0xC9: case 0xD0: case 0xD8: // RET
+	    {
+		uint8_t ticks = ( opcode == 0xC9 ) ? 16 : 20;
+
+		this->emitLoadWord( C_RSI, m_sp );
+		this->emitCall( (const void*)&Z80::nativePop );
+		this->emitBailCheck();
+		this->emitAddWordImm( m_sp, 2 );
+		this->emitStoreWord( m_pc, C_RAX );
+		this->emitExit( length, ticks, m_ticks + ticks, m_ticks + ticks, -1 );
+	    }
+	    break;
+	default:
+	    break;
+	}
+    }
+
+    // the branch was not taken
+    if( cond != C_COND_ALWAYS )
+    {
+	m_op = op;
+	if( cond != C_COND_NEVER ) { this->bindJump( skip, m_buffer.size() ); }
+	this->emitExit( length, skipTicks, m_ticks + skipTicks, m_ticks + skipTicks, next );
+    }
+}
+
+void Dynarec::emitTaken( Block& block, uint16_t target, uint8_t ticks )
+{
+    uint16_t total = m_ticks + ticks;
+
+    if( (target != block.start) || (m_loopBranchTicks == 0) )
+    {
+	this->emitStoreWordImm( m_pc, target );
+	this->emitExit( block.instructions.size(), ticks, total, total, -1 );
+	return;
+    }
+
+    // back at the start: the CPU checks for an idle loop, as it would
+    // after the branch
+    this->emitFlushFlags();
+    this->emitStoreWordImm( m_pc, target );
+    this->emitMoveImm( C_RSI, m_addr );
+    this->emitMoveImm( C_RDX, total );
+    this->emitCall( (const void*)&Z80::nativeLoop );
+    this->emitAluImm( C_ALU_ADD, C_R12, total );
+    m_op = Z80::C_FLAGS_EVALUATED;
+
+    this->emitAlu( C_ALU_TEST, C_RAX, C_RAX );
+    uint32_t idle = this->emitJump( C_COND_NE );
+
+    // go around again if another full pass fits in the budget
+    this->emitMove( C_RAX, C_R12 );
+    this->emitAluImm( C_ALU_ADD, C_RAX, m_passTicks );
+    this->emit( 0x3B ); this->emit( 0x04 ); this->emit( 0x24 ); // cmp eax, [rsp]
+    uint32_t full = this->emitJump( C_COND_A );
+    this->bindJump( this->emitJump( C_COND_ALWAYS ), m_passStart );
+
+    this->bindJump( idle, m_buffer.size() );
+    this->bindJump( full, m_buffer.size() );
+    this->emitExit( 0, ticks, 0, 0, -1 );
+}
+
+int Dynarec::emitFlag( uint8_t mask )
+{
+    if( m_op == Z80::C_FLAGS_EVALUATED )
+    {
+	this->emitTestByteImm( m_reg[ 6 ], mask );
+	return C_COND_NE;
+    }
+
+    if( mask == c_zero )
+    {
+	this->emitAlu( C_ALU_TEST, C_R13, C_R13 );
+	return C_COND_E;
+    }
+
+    switch( m_op )
+    {
+    case Z80::C_FLAGS_ADD:
+	// A + value + carry > 0xFF
+	this->emitMove( C_RAX, C_R14 );
+	this->emitAlu( C_ALU_ADD, C_RAX, C_R15 );
+	this->emitAlu( C_ALU_ADD, C_RAX, C_RBP );
+	this->emitAluImm( C_ALU_CMP, C_RAX, 0xFF );
+	return C_COND_A;
+    case Z80::C_FLAGS_SUB:
+	// A < value + carry
+	this->emitMove( C_RAX, C_R15 );
+	this->emitAlu( C_ALU_ADD, C_RAX, C_RBP );
+	this->emitAlu( C_ALU_CMP, C_R14, C_RAX );
+	return C_COND_B;
+    case Z80::C_FLAGS_AND:
+    case Z80::C_FLAGS_LOGIC:
+	return C_COND_NEVER;
+    default:
+	// INC and DEC carry the previous carry forward
+	this->emitAlu( C_ALU_TEST, C_RBP, C_RBP );
+	return C_COND_NE;
+    }
+}
+
+void Dynarec::emitCarry( uint8_t reg )
+{
+    if( m_op == Z80::C_FLAGS_EVALUATED )
+    {
+	this->emitLoadByte( reg, m_reg[ 6 ] );
+	this->emitShiftRight( reg, 4 );
+	this->emitAluImm( C_ALU_AND, reg, 0x01 );
+	return;
+    }
+
+    if( (m_op == Z80::C_FLAGS_INC) || (m_op == Z80::C_FLAGS_DEC) )
+    {
+	if( reg != C_RBP ) { this->emitMove( reg, C_RBP ); }
+	return;
+    }
+
+    int cond = this->emitFlag( c_carry );
+
+    if( cond == C_COND_NEVER ) { this->emitMoveImm( reg, 0 ); }
+    else
+    {
+	this->emitSetCondition( cond, reg );
+	this->emitZeroExtend( reg, reg );
+    }
+}
+
+void Dynarec::emitFlushFlags( void )
+{
+    if( m_op == Z80::C_FLAGS_EVALUATED ) { return; }
+
+    this->emitStoreByteImm( m_flagOp, m_op );
+    this->emitStoreByte( m_flagResult, C_R13 );
+    this->emitStoreByte( m_flagPrev, C_R14 );
+    this->emitStoreByte( m_flagDelta, C_R15 );
+    this->emitStoreByte( m_flagCarry, C_RBP );
+}
+
+void Dynarec::emitEvaluateFlags( void )
+{
+    if( m_op == Z80::C_FLAGS_EVALUATED ) { return; }
+
+    this->emitFlushFlags();
+    this->emitCall( (const void*)&Z80::nativeEvaluate );
+    m_op = Z80::C_FLAGS_EVALUATED;
+}
+
+void Dynarec::emitRead( void )
+{
+    this->emitCall( (const void*)&Z80::nativeRead );
+    this->emitBailCheck();
+}
+
+void Dynarec::emitWrite( void )
+{
+    this->emitCall( (const void*)&Z80::nativeWrite );
+    this->emitBailCheck();
+}
+
+void Dynarec::emitCall( const void* thunk )
+{
+    // mov rdi, rbx; mov rax, thunk; call rax
+    this->emit( 0x48 ); this->emit( 0x89 ); this->emit( 0xDF );
+    this->emit( 0x48 ); this->emit( 0xB8 );
+    this->emitValue( (uint64_t)thunk, 8 );
+    this->emit( 0xFF ); this->emit( 0xD0 );
+}
+
+void Dynarec::emitBailCheck( void )
+{
+    // cmp eax, c_bail
+    this->emit( 0x3D );
+    this->emitValue( c_bail, 4 );
+
+    uint32_t done = this->emitJump( C_COND_NE );
+    this->emitExit( m_index, m_lastTicks, m_ticks, m_ticks, m_addr );
+    this->bindJump( done, m_buffer.size() );
+}
+
+void Dynarec::emitExit( uint8_t index, uint8_t lastTicks, uint16_t loopTicks,
+			uint16_t ticks, int32_t pc )
+{
+    this->emitFlushFlags();
+    if( pc >= 0 ) { this->emitStoreWordImm( m_pc, pc ); }
+
+    // return ( (r12d + ticks) << 8 ) | exit
+    this->emitMove( C_RAX, C_R12 );
+    if( ticks != 0 ) { this->emitAluImm( C_ALU_ADD, C_RAX, ticks ); }
+    this->emit( 0x48 ); this->emit( 0xC1 ); this->emit( 0xE0 ); this->emit( 0x08 );
+    this->emit( 0x0C ); this->emit( m_exits.size() & 0xFF );
+
+    // add rsp, 24; pop r15; pop r14; pop r13; pop r12; pop rbp; pop rbx; ret
+    static const uint8_t epilogue[] = { 0x48, 0x83, 0xC4, 0x18,
+					 0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D,
+					 0x41, 0x5C, 0x5D, 0x5B, 0xC3 };
+    for( unsigned int i = 0; i < sizeof(epilogue); i++ ) { this->emit( epilogue[ i ] ); }
+
+    NativeExit exit;
+    exit.index = index;
+    exit.lastTicks = lastTicks;
+    exit.loopTicks = loopTicks;
+    m_exits.push_back( exit );
+}
+
+void Dynarec::emit( uint8_t byte )
+{
+    m_buffer.push_back( byte );
+}
+
+void Dynarec::emitValue( uint64_t value, unsigned int size )
+{
+    for( unsigned int i = 0; i < size; i++ )
+    {
+	this->emit( ( value >> (i * 8) ) & 0xFF );
+    }
+}
+
+void Dynarec::emitRex( bool wide, uint8_t reg, uint8_t rm, bool byteRegs )
+{
+    uint8_t rex = 0x40;
+    if( wide ) { rex |= 0x08; }
+    if( reg & 0x08 ) { rex |= 0x04; }
+    if( rm & 0x08 ) { rex |= 0x01; }
+
+    // spl, bpl, sil and dil are only reachable with a REX prefix
+    bool lowBytes = byteRegs && ( ((reg >= 4) && (reg < 8)) || ((rm >= 4) && (rm < 8)) );
+
+    if( (rex != 0x40) || lowBytes ) { this->emit( rex ); }
+}
+
+void Dynarec::emitCpuOperand( uint8_t reg, int32_t offset )
+{
+    // [rbx + disp32]
+    this->emit( 0x80 | ((reg & 0x07) << 3) | C_RBX );
+    this->emitValue( (uint32_t)offset, 4 );
+}
+
+void Dynarec::emitLoadByte( uint8_t reg, int32_t offset )
+{
+    // movzx reg, byte [rbx + offset]
+    this->emitRex( false, reg, C_RBX, false );
+    this->emit( 0x0F ); this->emit( 0xB6 );
+    this->emitCpuOperand( reg, offset );
+}
+
+void Dynarec::emitStoreByte( int32_t offset, uint8_t reg )
+{
+    // mov byte [rbx + offset], reg
+    this->emitRex( false, reg, C_RBX, true );
+    this->emit( 0x88 );
+    this->emitCpuOperand( reg, offset );
+}
+
+void Dynarec::emitStoreByteImm( int32_t offset, uint8_t imm )
+{
+    // mov byte [rbx + offset], imm
+    this->emit( 0xC6 );
+    this->emitCpuOperand( 0, offset );
+    this->emit( imm );
+}
+
+void Dynarec::emitLoadWord( uint8_t reg, int32_t offset )
+{
+    // movzx reg, word [rbx + offset]
+    this->emitRex( false, reg, C_RBX, false );
+    this->emit( 0x0F ); this->emit( 0xB7 );
+    this->emitCpuOperand( reg, offset );
+}
+
+void Dynarec::emitStoreWord( int32_t offset, uint8_t reg )
+{
+    // mov word [rbx + offset], reg
+    this->emit( 0x66 );
+    this->emitRex( false, reg, C_RBX, false );
+    this->emit( 0x89 );
+    this->emitCpuOperand( reg, offset );
+}
+
+void Dynarec::emitStoreWordImm( int32_t offset, uint16_t imm )
+{
+    // mov word [rbx + offset], imm
+    this->emit( 0x66 ); this->emit( 0xC7 );
+    this->emitCpuOperand( 0, offset );
+    this->emitValue( imm, 2 );
+}
+
+void Dynarec::emitAddWordImm( int32_t offset, int8_t imm )
+{
+    // add word [rbx + offset], imm
+    this->emit( 0x66 ); this->emit( 0x83 );
+    this->emitCpuOperand( 0, offset );
+    this->emit( (uint8_t)imm );
+}
+
+void Dynarec::emitTestByteImm( int32_t offset, uint8_t imm )
+{
+    // test byte [rbx + offset], imm
+    this->emit( 0xF6 );
+    this->emitCpuOperand( 0, offset );
+    this->emit( imm );
+}
+
+void Dynarec::emitMoveImm( uint8_t reg, uint32_t imm )
+{
+    // mov reg, imm
+    this->emitRex( false, 0, reg, false );
+    this->emit( 0xB8 | (reg & 0x07) );
+    this->emitValue( imm, 4 );
+}
+
+void Dynarec::emitMove( uint8_t dst, uint8_t src )
+{
+    // mov dst, src
+    this->emitRex( false, src, dst, false );
+    this->emit( 0x89 );
+    this->emit( 0xC0 | ((src & 0x07) << 3) | (dst & 0x07) );
+}
+
+void Dynarec::emitZeroExtend( uint8_t dst, uint8_t src )
+{
+    // movzx dst, src (low byte)
+    this->emitRex( false, dst, src, true );
+    this->emit( 0x0F ); this->emit( 0xB6 );
+    this->emit( 0xC0 | ((dst & 0x07) << 3) | (src & 0x07) );
+}
+
+void Dynarec::emitAlu( AluOp op, uint8_t dst, uint8_t src )
+{
+    // op dst, src
+    this->emitRex( false, src, dst, false );
+    this->emit( op );
+    this->emit( 0xC0 | ((src & 0x07) << 3) | (dst & 0x07) );
+}
+
+void Dynarec::emitAluImm( AluOp op, uint8_t reg, uint32_t imm )
+{
+    // op reg, imm (the opcode extension is bits 3-5 of the reg, reg opcode)
+    this->emitRex( false, 0, reg, false );
+    this->emit( 0x81 );
+    this->emit( 0xC0 | (op & 0x38) | (reg & 0x07) );
+    this->emitValue( imm, 4 );
+}
+
+void Dynarec::emitSetCondition( int cond, uint8_t reg )
+{
+    // setcc reg (low byte)
+    this->emitRex( false, 0, reg, true );
+    this->emit( 0x0F ); this->emit( 0x90 | cond );
+    this->emit( 0xC0 | (reg & 0x07) );
+}
+
+void Dynarec::emitShiftRight( uint8_t reg, uint8_t count )
+{
+    // shr reg, count
+    this->emitRex( false, 0, reg, false );
+    this->emit( 0xC1 );
+    this->emit( 0xE8 | (reg & 0x07) );
+    this->emit( count );
+}
+
+uint32_t Dynarec::emitJump( int cond )
+{
+    // jmp rel32 or jcc rel32, bound later
+    if( cond == C_COND_ALWAYS ) { this->emit( 0xE9 ); }
+    else { this->emit( 0x0F ); this->emit( 0x80 | cond ); }
+
+    uint32_t jump = m_buffer.size();
+    this->emitValue( 0, 4 );
+    return jump;
+}
+
+void Dynarec::bindJump( uint32_t jump, uint32_t target )
+{
+    uint32_t rel = target - ( jump + 4 );
+    memcpy( &m_buffer[ jump ], &rel, 4 );
+}
+
+#endif
@@ -0,0 +1,274 @@
+#pragma once
+
+// The recompiler is opt-in (make dynarec), x86-64 only, and disabled in
+// debug builds so that breakpoints are checked on every instruction.
+#if defined(DYNAREC) && defined(__x86_64__) && !defined(DEBUG)
+#define DYNAREC_ENABLED
+#endif
+
+#include "blockcache.h"
+
+#include <stdint.h>
+#include <vector>
+
+class Z80;
+
+/**
+ * @author Rick Hallman
+ * Translates hot blocks of cached ROM code into native x86-64 code.
+ *
+ * Loads, 8-bit arithmetic and logic, 16-bit increments, stack operations
+ * and branches are translated directly. The CPU's registers stay in the
+ * CPU, and the inputs of the last flag-setting operation are kept in host
+ * registers until something needs the flags register. Other register-only
+ * instructions call their interpreter handler. Translation stops at the
+ * first instruction that changes interrupts or halts the CPU.
+ *
+ * Memory is accessed through the CPU, and only plain memory (ROM, RAM and
+ * HRAM) is accessed natively. Any other access leaves the native code
+ * before the instruction runs, so the interpreter performs it with exact
+ * timing. A block that jumps back to its own start loops natively until
+ * its tick budget runs out or the CPU finds an idle loop.
+ *
+ * The code buffer is never writable and executable at the same time.
+ */
+class Dynarec
+{
+public:
+
+    // returned by a memory access thunk when the access is not to plain
+    // memory, so the instruction must be interpreted
+    static const uint32_t c_bail = 0x10000;
+
+    // the number of times a block runs before it is compiled
+    static const uint32_t c_hotThreshold = 16;
+
+    /**
+     * Constructor.
+     * @param z80 the CPU whose code is translated
+     */
+    Dynarec( Z80* z80 );
+    ~Dynarec( void );
+
+    /**
+     * Whether or not native code can be generated. False if memory could
+     * not be mapped for code or the code buffer is full.
+     * @return true if yes, false otherwise
+     */
+    bool isAvailable( void );
+
+    /**
+     * Compiles a block, setting its native entry point and exits.
+     * @param block the block to compile (must be ROM code)
+     * @return true if compiled, false otherwise
+     */
+    bool compile( Block& block );
+
+private:
+
+    // host registers
+    typedef enum
+    {
+	C_RAX, C_RCX, C_RDX, C_RBX, C_RSP, C_RBP, C_RSI, C_RDI,
+	C_R8, C_R9, C_R10, C_R11, C_R12, C_R13, C_R14, C_R15
+    } HostRegister;
+
+    // host condition codes, and conditions known while translating
+    typedef enum
+    {
+	C_COND_NEVER = -2,
+	C_COND_ALWAYS = -1,
+	C_COND_B = 0x2,
+	C_COND_E = 0x4,
+	C_COND_NE = 0x5,
+	C_COND_A = 0x7
+    } Condition;
+
+    // register/memory operations (opcode for reg, reg) and their
+    // extension for immediate operands
+    typedef enum
+    {
+	C_ALU_ADD = 0x01,
+	C_ALU_OR = 0x09,
+	C_ALU_AND = 0x21,
+	C_ALU_SUB = 0x29,
+	C_ALU_XOR = 0x31,
+	C_ALU_CMP = 0x39,
+	C_ALU_TEST = 0x85
+    } AluOp;
+
+    /**
+     * Whether or not an instruction can be translated.
+     * @param instruction the instruction
+     * @return true if yes, false otherwise
+     */
+    bool canTranslate( const CachedInstruction& instruction );
+
+    /**
+     * Whether or not an instruction is run by its interpreter handler.
+     * @param opcode the instruction's opcode
+     * @return true if yes, false otherwise
+     */
+    bool isCalled( uint8_t opcode );
+
+    /**
+     * Translates one instruction of the block being compiled.
+     * @param block the block
+     * @param index the instruction's index
+     */
+    void translate( Block& block, unsigned int index );
+
+    /**
+     * Translates an 8-bit arithmetic or logic operation on A. The operand
+     * is in edx.
+     * @param operation the operation (bits 3-5 of the opcode)
+     */
+    void translateAlu( uint8_t operation );
+
+    /**
+     * Translates an 8-bit increment or decrement of a register.
+     * @param reg the register (bits 3-5 of the opcode)
+     * @param decrement true for DEC, false for INC
+     */
+    void translateIncDec( uint8_t reg, bool decrement );
+
+    /**
+     * Translates a branch ending the block.
+     * @param block the block
+     * @param index the branch's index
+     */
+    void translateBranch( Block& block, unsigned int index );
+
+    /**
+     * Emits the code after a taken branch with a known target.
+     * @param block the block
+     * @param target the branch target
+     * @param ticks the ticks the taken branch took
+     */
+    void emitTaken( Block& block, uint16_t target, uint8_t ticks );
+
+    /**
+     * Emits code that tests a flag.
+     * @param mask the flag's mask
+     * @return the condition under which the flag is set
+     */
+    int emitFlag( uint8_t mask );
+
+    /**
+     * Emits code that loads the carry flag into a host register as 0 or 1.
+     * @param reg the host register
+     */
+    void emitCarry( uint8_t reg );
+
+    /**
+     * Emits code that stores the deferred flag operation in the CPU.
+     */
+    void emitFlushFlags( void );
+
+    /**
+     * Emits code that evaluates the deferred flags into the flags register.
+     */
+    void emitEvaluateFlags( void );
+
+    /**
+     * Emits code that reads a byte of plain memory into eax, leaving the
+     * native code if the address is anything else. The address must be
+     * in esi.
+     */
+    void emitRead( void );
+
+    /**
+     * Emits code that writes edx to plain memory, leaving the native code
+     * if the address is anything else. The address must be in esi.
+     */
+    void emitWrite( void );
+
+    /**
+     * Emits a call to a CPU thunk. Its first argument is the CPU.
+     * @param thunk the thunk
+     */
+    void emitCall( const void* thunk );
+
+    /**
+     * Emits code that leaves the native code before the current
+     * instruction if the last thunk returned c_bail.
+     */
+    void emitBailCheck( void );
+
+    /**
+     * Emits code that leaves the native code.
+     * @param index the index of the next instruction to replay
+     * @param lastTicks the ticks taken by the last instruction
+     * @param loopTicks the ticks since the last idle loop check
+     * @param ticks the ticks taken in this pass through the block
+     * @param pc the next address, or -1 if already stored
+     */
+    void emitExit( uint8_t index, uint8_t lastTicks, uint16_t loopTicks,
+		   uint16_t ticks, int32_t pc );
+
+    // instruction encoding
+    void emit( uint8_t byte );
+    void emitValue( uint64_t value, unsigned int size );
+    void emitRex( bool wide, uint8_t reg, uint8_t rm, bool byteRegs );
+    void emitCpuOperand( uint8_t reg, int32_t offset );
+    void emitLoadByte( uint8_t reg, int32_t offset );
+    void emitStoreByte( int32_t offset, uint8_t reg );
+    void emitStoreByteImm( int32_t offset, uint8_t imm );
+    void emitLoadWord( uint8_t reg, int32_t offset );
+    void emitStoreWord( int32_t offset, uint8_t reg );
+    void emitStoreWordImm( int32_t offset, uint16_t imm );
+    void emitAddWordImm( int32_t offset, int8_t imm );
+    void emitTestByteImm( int32_t offset, uint8_t imm );
+    void emitMoveImm( uint8_t reg, uint32_t imm );
+    void emitMove( uint8_t dst, uint8_t src );
+    void emitZeroExtend( uint8_t dst, uint8_t src );
+    void emitAlu( AluOp op, uint8_t dst, uint8_t src );
+    void emitAluImm( AluOp op, uint8_t reg, uint32_t imm );
+    void emitSetCondition( int cond, uint8_t reg );
+    void emitShiftRight( uint8_t reg, uint8_t count );
+    uint32_t emitJump( int cond );
+    void bindJump( uint32_t jump, uint32_t target );
+
+    // offsets from the CPU of its registers, indexed as in opcodes
+    // (B, C, D, E, H, L, F, A), and of its register pairs
+    int32_t m_reg[ 8 ];
+    int32_t m_bc, m_de, m_hl, m_af, m_sp, m_pc;
+
+    // offsets from the CPU of the deferred flag operation and its inputs
+    int32_t m_flagOp, m_flagResult, m_flagPrev, m_flagDelta, m_flagCarry;
+
+    // executable memory
+    uint8_t* mp_code;
+    uint32_t m_codeSize;
+    uint32_t m_codeUsed;
+
+    // code for the block being compiled
+    std::vector<uint8_t> m_buffer;
+    std::vector<NativeExit> m_exits;
+
+    // the block being compiled: the start of one pass through it, the
+    // instruction being translated and its address, the ticks taken
+    // before it in this pass, and the ticks taken by the instruction
+    // before it
+    uint32_t m_passStart;
+    unsigned int m_index;
+    uint16_t m_addr;
+    uint16_t m_ticks;
+    uint8_t m_lastTicks;
+
+    // the ticks of one full pass, and the ticks of the branch back to the
+    // start (0 if the block does not loop)
+    uint32_t m_passTicks;
+    uint8_t m_loopBranchTicks;
+
+    // the deferred flag operation at the current instruction. Its inputs
+    // are kept in r13d (result), r14d (previous value), r15d (change) and
+    // ebp (carry).
+    uint8_t m_op;
+
+    // flag masks
+    static const uint8_t c_zero = 0x80;
+    static const uint8_t c_carry = 0x10;
+
+    static const uint32_t c_codeSize = 0x100000;
+};
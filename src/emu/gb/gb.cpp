@@ -1,15 +1,24 @@
 #include "gb.h"
 #include "joypad.h"
+#include "timer.h"
 
+#include <algorithm>
 #include <iostream>
 
 GB::GB( Rom* rom, string baseDir )
     : mp_rom( rom ),
-      m_counter( 0x0000 )
+      m_haltSkippedTicks( 0 ),
+      m_idleSkippedTicks( 0 ),
+      m_saveInterval( 0 )
 {
     mp_bus = new Bus( rom, baseDir );    
     mp_z80 = new Z80( mp_bus );
-    mp_lcd = new LCD( mp_z80, mp_bus );
+
+    // hardware registers are set up, so writes can now schedule events
+    mp_scheduler = new Scheduler();
+    mp_bus->setScheduler( mp_scheduler );
+    mp_lcd = new LCD( mp_z80, mp_bus, mp_scheduler );
+    this->setSaveInterval( c_saveInterval );
 
     // initialize debugger
     mp_debug = new Debug( mp_z80, mp_bus );
@@ -17,103 +26,183 @@ GB::GB( Rom* rom, string baseDir )
 
 GB::~GB( void )
 {
+    // the LCD and CPU detach their caches from the bus
+    delete mp_lcd; mp_lcd = NULL;
     delete mp_z80; mp_z80 = NULL;
     delete mp_bus; mp_bus = NULL;    
-    delete mp_lcd; mp_lcd = NULL;
+    delete mp_scheduler; mp_scheduler = NULL;
     delete mp_debug; mp_debug = NULL;
 }
 
 uint8_t GB::update( void )
 {    
-    uint8_t ticks = mp_z80->executeNextInstruction();
-    updateHardware( ticks );
-    
+    this->step<DEBUG_MODE>( mp_scheduler->getCycles() );
     return mp_debug->repl();
 }
 
-void GB::close( void )
+GB::StopReason GB::runFrame( void )
 {
-    mp_rom->save();
+    return this->run( c_frameTicks, true );
 }
 
-int GB::getTicks( void )
+GB::StopReason GB::runCycles( uint32_t ticks )
 {
-    return m_counter;
+    return this->run( ticks, false );
 }
 
-LCD* GB::getLCD( void )
+uint8_t GB::debug( void )
 {
-    return mp_lcd;
+    return mp_debug->repl();
 }
 
-JoyPad* GB::getJoyPad( void )
+GB::StopReason GB::run( uint32_t ticks, bool toFrameEnd )
 {
-    return mp_bus->getJoyPad();
+    // breakpoints can only change at the debugger's prompt
+    if( mp_debug->isActive() ) { return this->runLoop<true>( ticks, toFrameEnd ); }
+
+    return this->runLoop<false>( ticks, toFrameEnd );
 }
 
-void GB::updateHardware( uint8_t ticks )
+template <bool debugging>
+GB::StopReason GB::runLoop( uint32_t ticks, bool toFrameEnd )
 {
-    this->updateTimers( ticks );
-    mp_lcd->update( ticks );
+    uint64_t end = mp_scheduler->getCycles() + ticks;
+    uint32_t frame = mp_lcd->getFrameCount();
 
-    if( mp_bus->getJoyPad()->stateChanged() )
+    while( mp_scheduler->getCycles() < end )
     {
-	mp_z80->triggerInterrupt( Z80::c_joypad );
+	this->step<debugging>( end );
+
+	if( debugging && mp_debug->isBreakpoint() ) { return C_STOP_BREAKPOINT; }
+
+	if( toFrameEnd && (mp_lcd->getFrameCount() != frame) ) { return C_STOP_FRAME; }
     }
-    
-    m_counter += ticks;
+
+    return toFrameEnd ? C_STOP_FRAME : C_STOP_CYCLES;
 }
 
-void GB::updateTimers( uint8_t ticks )
+template <bool debugging>
+void GB::step( uint64_t end )
 {
-    uint32_t prev = m_counter;
-    uint32_t curr = m_counter + ticks;
-    
-    if( (prev / 256) < (curr / 256) )
+    uint64_t cycles = mp_scheduler->getCycles();
+    uint64_t limit = std::min( mp_scheduler->getNextDeadline(), end );
+    uint32_t budget = 0;
+
+    if( (debugging == false) && (limit > cycles) )
     {
-	// DIV (0xFF04) register increments every 256 cycles (16384Hz)
-	uint8_t divider;
-	mp_bus->defaultAccess( 0xFF04, divider, READ );
-	mp_bus->defaultAccess( 0xFF04, ++divider, WRITE );
+	budget = std::min<uint64_t>( limit - cycles, c_maxNativeTicks );
     }
 
-    // increment TIMA (0xFF05) based on TAC (0xFF07)
-    uint8_t tima, tma, tac;
-    mp_bus->defaultAccess( 0xFF05, tima, READ );
-    mp_bus->defaultAccess( 0xFF06, tma, READ );
-    mp_bus->defaultAccess( 0xFF07, tac, READ );
-    
-    if( BIT( tac, 2 ) ) // if running flag set, increment TIMA
+    uint32_t ticks = mp_z80->executeNextInstruction( budget );
+
+    // hardware sees the last instruction start when it did
+    uint8_t last = mp_z80->getInstructionTicks();
+    if( ticks != last ) { mp_scheduler->advance( ticks - last ); }
+    mp_scheduler->advance( last );
+
+    // hardware is only updated when one of its deadlines passes
+    if( mp_scheduler->isDue() ) { this->runEvents(); }
+
+    if( mp_z80->isHalting() )
     {
-	uint16_t t;
-	// game boy runs at 4194304 Hz	
-	switch( tac & 0x03 )
-	{
-	case 0x00: // 4096 hz
-	    t = 1024; break;
-	case 0x01: // 262144 hz
-	    t = 16; break;
-	case 0x02: // 65536 hz
-	    t = 64; break;
-	case 0x03: // 16384 hz
-	default:
-	    t = 256;
-	    break;
-	}
+	m_haltSkippedTicks += this->skipIdle( 4 );
+    }
+    else if( (debugging == false) && (mp_z80->getIdleLoopTicks() != 0) )
+    {
+	// idle loops run while debugging so breakpoints inside them are hit
+	m_idleSkippedTicks += this->skipIdle( mp_z80->getIdleLoopTicks() );
+    }
+}
 
-        if( (prev / t) < (curr / t) )
-	{
-	    tima++;
+void GB::close( void )
+{
+    mp_rom->save();
+}
+
+void GB::setSaveInterval( uint64_t ticks )
+{
+    m_saveInterval = ticks;
+
+    if( ticks == 0 ) { mp_scheduler->cancel( Scheduler::C_EVENT_SAVE ); }
+    else { mp_scheduler->schedule( Scheduler::C_EVENT_SAVE, mp_scheduler->getCycles() + ticks ); }
+}
+
+int GB::getTicks( void )
+{
+    return (int)mp_scheduler->getCycles();
+}
+
+uint64_t GB::getHaltSkippedTicks( void )
+{
+    return m_haltSkippedTicks;
+}
+
+uint64_t GB::getIdleSkippedTicks( void )
+{
+    return m_idleSkippedTicks;
+}
 
-	    // trigger timer interrupt if overflow
-	    if( tima == 0x00 )
+LCD* GB::getLCD( void )
+{
+    return mp_lcd;
+}
+
+JoyPad* GB::getJoyPad( void )
+{
+    return mp_bus->getJoyPad();
+}
+
+void GB::runEvents( void )
+{
+    Scheduler::Event event;
+    while( mp_scheduler->popDueEvent( event ) )
+    {
+	switch( event )
+	{
+	case Scheduler::C_EVENT_LCD_WRITE:
+	    mp_lcd->handleWrite(); break;
+	case Scheduler::C_EVENT_LCD_STATUS:
+	    mp_lcd->handleStatus(); break;
+	case Scheduler::C_EVENT_LCD_LINE:
+	    mp_lcd->handleLine(); break;
+	case Scheduler::C_EVENT_TIMER:
+	    mp_bus->getTimer()->handleOverflow(); break;
+	case Scheduler::C_EVENT_DMA:
+	    mp_bus->getDMA()->handleTransfer(); break;
+	case Scheduler::C_EVENT_JOYPAD:
+	    if( mp_bus->getJoyPad()->stateChanged() )
 	    {
-		tima = tma;
-		mp_z80->triggerInterrupt( Z80::c_timer );
+		mp_z80->triggerInterrupt( Z80::c_joypad );
 	    }
-
-	    mp_bus->defaultAccess( 0xFF05, tima, WRITE );
+	    break;
+	case Scheduler::C_EVENT_SAVE:
+	    mp_rom->flush();
+	    mp_scheduler->schedule( Scheduler::C_EVENT_SAVE,
+				    mp_scheduler->getCycles() + m_saveInterval );
+	    break;
+	default:
+	    break;
 	}
     }
 }
 
+uint32_t GB::skipIdle( uint32_t period )
+{
+    // a pending interrupt ends the halt on the next instruction
+    uint8_t ieReg, ifReg;
+    mp_bus->defaultAccess( 0xFFFF, ieReg, READ );
+    mp_bus->defaultAccess( 0xFF0F, ifReg, READ );
+    if( (ieReg & ifReg) != 0 ) { return 0; }
+
+    // with nothing scheduled, only a key press can end the wait
+    uint64_t next = mp_scheduler->getNextDeadline() - mp_scheduler->getCycles();
+    if( next > c_maxIdleSkip ) { next = c_maxIdleSkip; }
+
+    // skip every step that would end before the next event
+    if( next <= period ) { return 0; }
+    uint32_t ticks = ( (next - 1) / period ) * period;
+
+    mp_scheduler->skip( ticks );
+
+    return ticks;
+}
@@ -4,6 +4,7 @@
 #include "rom/rom.h"
 #include "z80.h"
 #include "lcd.h"
+#include "scheduler.h"
 #include "debug.h"
 #include "devices.h"
 
@@ -17,6 +18,24 @@ using std::string;
 class GB
 {
 public:
+
+    // why runFrame or runCycles returned
+    typedef enum
+    {
+	C_STOP_FRAME,
+	C_STOP_CYCLES,
+	C_STOP_BREAKPOINT
+    } StopReason;
+
+    // the number of ticks in one frame
+    static const uint32_t c_frameTicks = 70224;
+
+    // the number of ticks in one second
+    static const uint32_t c_secondTicks = 4194304;
+
+    // the default ticks between flushes of battery-backed RAM
+    static const uint32_t c_saveInterval = c_secondTicks;
+
     /**
      * Constructor.
      * @param rom the loaded ROM file
@@ -32,16 +51,57 @@ public:
      */
     uint8_t update( void );
 
+    /**
+     * Runs until the LCD finishes a frame. Stops after c_frameTicks if
+     * the LCD is off.
+     * @return C_STOP_FRAME, or C_STOP_BREAKPOINT if the debugger stopped
+     */
+    StopReason runFrame( void );
+
+    /**
+     * Runs for a number of ticks. May run over by part of an instruction
+     * or halt.
+     * @param ticks the number of ticks to run
+     * @return C_STOP_CYCLES, or C_STOP_BREAKPOINT if the debugger stopped
+     */
+    StopReason runCycles( uint32_t ticks );
+
+    /**
+     * Opens the debugger after runFrame or runCycles stopped at a
+     * breakpoint.
+     * @return 0, or 1 if exiting
+     */
+    uint8_t debug( void );
+
     /**
      * Called to close and save off external RAM.
      */
     void close( void );
     
+    /**
+     * Sets how often battery-backed RAM is written through to the save
+     * file. At most this much progress is lost if the process dies.
+     * @param ticks the ticks between flushes, or 0 to save only on close
+     */
+    void setSaveInterval( uint64_t ticks );
+
     /**
      * Gets the number of ticks performed by this device.
      * @return the number of ticks taken so far
      */
     int getTicks( void );
+
+    /**
+     * Gets the number of ticks skipped while the CPU was halted.
+     * @return the number of ticks
+     */
+    uint64_t getHaltSkippedTicks( void );
+
+    /**
+     * Gets the number of ticks skipped while the CPU was in an idle loop.
+     * @return the number of ticks
+     */
+    uint64_t getIdleSkippedTicks( void );
    
     /**
      * Accessor method for the Game Boy's LCD.
@@ -58,17 +118,56 @@ public:
 private:
 
     /**
-     * Updates hardware based on the number of ticks the previous instruction
-     * took.
-     * @param ticks the number of ticks the previous instruction took
+     * Executes the next instruction and updates hardware.
+     * @tparam debugging whether or not the debugger checks every
+     * instruction, in which case idle loops are not skipped and compiled
+     * code does not run
+     * @param end the cycle the current run ends at. Compiled code may run
+     * several instructions, but not past this or the next hardware event.
      */
-    void updateHardware( uint8_t ticks );
-    
+    template <bool debugging>
+    void step( uint64_t end );
+
     /**
-     * Updates timer and divider registers based on number of ticks.
-     * @param ticks the number of ticks the previous instruction took
+     * Runs instructions until a number of ticks have passed, a frame
+     * ends or the debugger stops. Breakpoints are only checked while the
+     * debugger is active.
+     * @param ticks the most ticks to run
+     * @param toFrameEnd whether or not to stop at the end of a frame
+     * @return why running stopped
      */
-    void updateTimers( uint8_t ticks );
+    StopReason run( uint32_t ticks, bool toFrameEnd );
+
+    /**
+     * The run loop behind run.
+     * @tparam debugging whether or not to check for breakpoints
+     * @param ticks the most ticks to run
+     * @param toFrameEnd whether or not to stop at the end of a frame
+     * @return why running stopped
+     */
+    template <bool debugging>
+    StopReason runLoop( uint32_t ticks, bool toFrameEnd );
+
+    /**
+     * Runs every hardware event that is due.
+     */
+    void runEvents( void );
+
+    /**
+     * While the CPU is halted or spinning in an idle loop, skips ahead to
+     * just before the next hardware event instead of updating hardware
+     * after every instruction. Nothing observable happens in the skipped
+     * ticks, so timing is unchanged.
+     * @param period the ticks per halt step or loop iteration
+     * @return the number of ticks skipped
+     */
+    uint32_t skipIdle( uint32_t period );
+
+    // the most ticks skipped at once
+    static const uint32_t c_maxIdleSkip = c_frameTicks;
+
+    // the most ticks compiled code runs at once
+    static const uint32_t c_maxNativeTicks = c_frameTicks;
 
     // Debugger
     Debug* mp_debug;
@@ -79,8 +178,15 @@ private:
     LCD* mp_lcd;
     Z80* mp_z80;
 
-    // the cpu counter
-    int m_counter;
+    // hardware event scheduler
+    Scheduler* mp_scheduler;
+
+    // ticks fast-forwarded while halted or in an idle loop
+    uint64_t m_haltSkippedTicks;
+    uint64_t m_idleSkippedTicks;
+
+    // ticks between flushes of battery-backed RAM (0 if never)
+    uint64_t m_saveInterval;
     
 };
 
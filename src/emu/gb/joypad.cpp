@@ -1,5 +1,6 @@
 #include "joypad.h"
 #include "bus.h"
+#include "scheduler.h"
 #include "../../buttons.h"
 
 #include <SDL2/SDL.h>
@@ -16,7 +17,9 @@ JoyPad::JoyPad( string baseDir ) : ReadOnlyDevice( c_addr, c_addr ),
 				   m_a( false ),
 				   m_b( false ),
 				   m_start( false ),
-				   m_select( false )
+				   m_select( false ),
+				   m_stateChanged( false ),
+				   mp_scheduler( NULL )
 {
     // initialize all buttons to unpressed
     mp_memory[0] = 0xFF;
@@ -99,6 +102,12 @@ void JoyPad::readKeyboard( void )
     m_select = nextSelect;
 
     this->setButtonValues();
+
+    // raise the joypad interrupt before the next instruction
+    if( m_stateChanged && (mp_scheduler != NULL) )
+    {
+	mp_scheduler->schedule( Scheduler::C_EVENT_JOYPAD, mp_scheduler->getCycles() );
+    }
 }
 
 bool JoyPad::stateChanged( void )
@@ -112,6 +121,11 @@ bool JoyPad::stateChanged( void )
     return false;
 }
 
+void JoyPad::setScheduler( Scheduler* scheduler )
+{
+    mp_scheduler = scheduler;
+}
+
 void JoyPad::setKeyMapping( string key, int value )
 {
     if( key == BTN_START ) { m_keyStart = value; }
@@ -2,6 +2,8 @@
 
 #include "devices.h"
 
+class Scheduler;
+
 #include <string>
 using std::string;
 
@@ -37,6 +39,12 @@ public:
      * @return true if yes, false otherwise
      */
     bool stateChanged( void );
+
+    /**
+     * Sets the scheduler notified when a button is pressed.
+     * @param scheduler the hardware event scheduler (or NULL)
+     */
+    void setScheduler( Scheduler* scheduler );
     
 protected:
 
@@ -72,4 +80,7 @@ protected:
     
     // State changed flag
     bool m_stateChanged;    
+
+    // hardware event scheduler
+    Scheduler* mp_scheduler;
 };
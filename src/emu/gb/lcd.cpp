@@ -2,16 +2,26 @@
 
 #include <iostream>
 
-LCD::LCD( Z80* z80, Bus* bus )
+LCD::LCD( Z80* z80, Bus* bus, Scheduler* scheduler )
     : mp_z80( z80 ),
       mp_bus( bus ),
-      m_counter( 0x0000 ),
-      m_readyToDraw( false )
+      mp_scheduler( scheduler ),
+      mp_tileCache( new TileCache( bus ) ),
+      m_lineStart( 0 ),
+      m_statusTime( 0 ),
+      m_enabled( true ),
+      m_readyToDraw( false ),
+      m_frames( 0 )
 {
+    mp_bus->setTileCache( mp_tileCache );
+    this->scheduleStatus( 0 );
+    mp_scheduler->schedule( Scheduler::C_EVENT_LCD_LINE, c_cycle );
 }
 
 LCD::~LCD( void )
 {
+    mp_bus->setTileCache( NULL );
+    delete mp_tileCache; mp_tileCache = NULL;
 }
 
 int LCD::getPixel( int x, int y )
@@ -24,53 +34,73 @@ int LCD::getPixel( int x, int y )
     return m_pixels[y][x];
 }
 
-void LCD::update( uint8_t ticks )
+uint32_t LCD::getFrameCount( void )
 {
-    // set the LCD's status
-    this->setStatus();
+    return m_frames;
+}
 
-    // update LCD counter based on ticks
-    m_counter += ticks;
+void LCD::handleWrite( void )
+{
+    this->setStatus();
+}
 
-    if( m_counter >= c_cycle )
+void LCD::handleStatus( void )
+{
+    // the status is only set between instructions, so a mode change
+    // is seen by the first instruction that starts after it
+    if( mp_scheduler->getInstructionStart() < m_statusTime )
     {
-	m_counter -= c_cycle;
+	mp_scheduler->schedule( Scheduler::C_EVENT_LCD_STATUS,
+				mp_scheduler->getCycles() + 1 );
+	return;
+    }
 
-	uint8_t scanline;
-	mp_bus->defaultAccess( 0xFF44, scanline, READ );
+    this->setStatus();
+}
 
-	scanline++;
-	if( scanline > 153 ) { scanline = 0; }
+void LCD::handleLine( void )
+{
+    m_lineStart += c_cycle;
+    mp_scheduler->schedule( Scheduler::C_EVENT_LCD_LINE, m_lineStart + c_cycle );
 
-        // Handle coincidence register
-	uint8_t lyc, stat;
-	mp_bus->defaultAccess( 0xFF45, lyc, READ );
-	mp_bus->defaultAccess( 0xFF41, stat, READ ); 
-	if( lyc == scanline )
-	{
-	    stat = SET( stat, 2 );
-	    if( BIT( stat, 6 ) == true )
-	    {
-		mp_z80->triggerInterrupt( Z80::c_LCDStat );
-	    }
-	}
-	else
+    uint8_t scanline;
+    mp_bus->defaultAccess( 0xFF44, scanline, READ );
+
+    scanline++;
+    if( scanline > 153 ) { scanline = 0; }
+
+    // Handle coincidence register
+    uint8_t lyc, stat;
+    mp_bus->defaultAccess( 0xFF45, lyc, READ );
+    mp_bus->defaultAccess( 0xFF41, stat, READ ); 
+    if( lyc == scanline )
+    {
+	stat = SET( stat, 2 );
+	if( BIT( stat, 6 ) == true )
 	{
-	    stat = RES( stat, 2 );
+	    mp_z80->triggerInterrupt( Z80::c_LCDStat );
 	}
-	mp_bus->defaultAccess( 0xFF41, stat, WRITE );
+    }
+    else
+    {
+	stat = RES( stat, 2 );
+    }
+    mp_bus->defaultAccess( 0xFF41, stat, WRITE );
+    
+    if( scanline == 144 )
+    {
+	m_readyToDraw = true;
+	m_frames++;
 	
-	if( scanline == 144 )
-	{
-	    m_readyToDraw = true;
-	    
-	    // vblank interrupt
-	    mp_z80->triggerInterrupt( Z80::c_vBlank );
-	}
-
-	// write updated scanline to address
-	mp_bus->defaultAccess( 0xFF44, scanline, WRITE );
+	// vblank interrupt
+	mp_z80->triggerInterrupt( Z80::c_vBlank );
     }
+
+    // write updated scanline to address
+    mp_bus->defaultAccess( 0xFF44, scanline, WRITE );
+
+    // the new scanline starts in a different mode
+    this->scheduleStatus( m_lineStart );
 }
 
 bool LCD::isEnabled( void )
@@ -129,10 +159,8 @@ void LCD::drawTiles( uint8_t lcdc, uint8_t scanline )
     mp_bus->defaultAccess( 0xFF4A, wy, READ );
     mp_bus->defaultAccess( 0xFF4B, wx, READ );
 
-    // set tile data address
-    uint16_t tileData;
-    if( BIT( lcdc, 4 ) ) { tileData = 0x8000; }
-    else { tileData = 0x9000; }
+    // tiles are numbered from 0x8000, or signed from 0x9000
+    bool unsignedTiles = BIT( lcdc, 4 );
 
     // using window or not
     bool windowEnabled = BIT( lcdc, 5 );
@@ -156,6 +184,18 @@ void LCD::drawTiles( uint8_t lcdc, uint8_t scanline )
 				BIT( palette, 0 ) );
 
     
+    // fetch the rows of the tile maps this scanline crosses
+    uint8_t bgRow[ 32 ], windowRow[ 32 ];
+    mp_bus->readSpan( bgMap + ((((scanline + scy) / 8) % 32) * 32), bgRow, 32 );
+    if( windowEnabled && (scanline >= wy) )
+    {
+	mp_bus->readSpan( windowMap + ((((scanline - wy) / 8) % 32) * 32), windowRow, 32 );
+    }
+
+    // the decoded row of the current tile
+    const uint8_t* tileRow = NULL;
+    int fetched = -1;
+    
     // loop across pixels in scanline
     for( int x = 0; x < 160; x++ )
     {
@@ -163,8 +203,8 @@ void LCD::drawTiles( uint8_t lcdc, uint8_t scanline )
 	int yPos = scanline + scy;
 	int xPos = x + scx;
 
-	// calculate map address
-	uint16_t map = bgMap;
+	// select the map row
+	uint8_t* row = bgRow;
 	
 	if( windowEnabled )
 	{
@@ -173,48 +213,26 @@ void LCD::drawTiles( uint8_t lcdc, uint8_t scanline )
 	    {
 		xPos = x - windowX;
 		yPos = scanline - wy;
-		map = windowMap;
+		row = windowRow;
 	    }
 	}
 	
-	// calculate tile address
-	int tileRow = (yPos / 8) % 32;
+	// calculate tile number
 	int tileCol = (xPos / 8) % 32;
-	int tileIndex = (tileRow * 32) + tileCol;
-        uint8_t tileOffset;
+        uint8_t tileOffset = row[ tileCol ];
 
-	mp_bus->defaultAccess( map + tileIndex, tileOffset, READ );
+	int tile = tileOffset;
+	if( unsignedTiles == false ) { tile = 256 + (int8_t)tileOffset; }
 
-	uint16_t tileAddr = 0;
-	if( tileData == 0x8000 )
+	// get tile color, fetching each tile row once
+	int tileLine = ( tile * 8 ) + ( yPos % 8 );
+	if( tileLine != fetched )
 	{
-	    tileAddr = tileData + (tileOffset * 16);
+	    tileRow = mp_tileCache->getRow( tile, yPos % 8 );
+	    fetched = tileLine;
 	}
-	else
-	{
-	    if( BIT( tileOffset, 7 ) == false )
-	    {
-		tileAddr = tileData + (tileOffset * 16);
-	    }
-	    else
-	    {
-		uint8_t offset = ~tileOffset;
-		offset = offset + 1;
-		tileAddr = tileData - (offset * 16);
-	    }
-	}
-	
-	tileAddr += ( 2 * (yPos % 8) );
-
-	// get tile color
-	uint8_t line1, line2;
-	mp_bus->defaultAccess( tileAddr, line1, READ );
-	mp_bus->defaultAccess( tileAddr + 1, line2, READ );
-	
-	bool low = BIT( line1, (7 - (xPos % 8)) );
-	bool high = BIT( line2, (7 - (xPos % 8)) );
 
-	uint8_t colorIndex = ( high ? 2 : 0 ) + ( low ? 1 : 0 );
+	uint8_t colorIndex = tileRow[ xPos % 8 ];
 	this->drawPixel( x, scanline, colors[colorIndex] );
     }
 }
@@ -235,26 +253,29 @@ void LCD::drawSprites( uint8_t lcdc, uint8_t scanline )
     // keeps track of whether or not pixels were set
     bool pixelsSet[160] = {false};
     
+    // sprite attribute table
+    uint8_t oam[ 0xA0 ];
+    mp_bus->readSpan( 0xFE00, oam, 0xA0 );
+
     // loop over sprites
     int spriteCount = 0;
 
-    for( uint16_t addr = 0xFE00; addr < 0xFEA0; addr += 4 )
+    for( int index = 0; index < 0xA0; index += 4 )
     {
 	if( spriteCount == 10 ) { break; }
 	
-	bool valid = this->drawSprite( addr, scanline, size, bgColor0, pixelsSet );
+	bool valid = this->drawSprite( oam + index, scanline, size, bgColor0, pixelsSet );
 	if( valid ) { spriteCount++; }
     }
 }
 
-bool LCD::drawSprite( uint16_t addr, uint8_t scanline, int size, int bgColor0, bool pixelsSet[] )
+bool LCD::drawSprite( const uint8_t* sprite, uint8_t scanline, int size, int bgColor0, bool pixelsSet[] )
 {
     // sprite information
-    uint8_t x, y, tileNum, attributes;
-    mp_bus->defaultAccess( addr, y, READ );
-    mp_bus->defaultAccess( addr + 1, x, READ );
-    mp_bus->defaultAccess( addr + 2, tileNum, READ );
-    mp_bus->defaultAccess( addr + 3, attributes, READ );
+    uint8_t y = sprite[0];
+    uint8_t x = sprite[1];
+    uint8_t tileNum = sprite[2];
+    uint8_t attributes = sprite[3];
     int yPos = y - 16;
     int xPos = x - 8;
 	
@@ -288,12 +309,8 @@ bool LCD::drawSprite( uint16_t addr, uint8_t scanline, int size, int bgColor0, b
     int line = scanline - yPos;
     if( yFlip ) { line = size - line - 1; }
 	
-    // sprite data
-    uint16_t spriteAddr = 0x8000 + (tileNum << 4) + (line * 2);
-    if( size == 16 ) { spriteAddr -= (spriteAddr % 2); }
-    uint8_t line1, line2;
-    mp_bus->defaultAccess( spriteAddr, line1, READ );
-    mp_bus->defaultAccess( spriteAddr + 1, line2, READ );
+    // sprite data, continuing into the next tile for 8x16 sprites
+    const uint8_t* spriteRow = mp_tileCache->getRow( tileNum + (line / 8), line % 8 );
 
     // whether or not the current pixel has priority
     bool hasPriority = !pixelsSet[xPos];
@@ -317,11 +334,7 @@ bool LCD::drawSprite( uint16_t addr, uint8_t scanline, int size, int bgColor0, b
 	if( bgPriority && ( bgColor != bgColor0 ) ) { continue; }
 	    
 	// get color
-	uint8_t bit = pixel;
-	if( xFlip == false ) { bit = 7 - pixel; }
-	bool low = BIT( line1, bit );
-	bool high = BIT( line2, bit );
-	uint8_t colorIndex = ( high ? 2 : 0 ) + ( low ? 1 : 0 );
+	uint8_t colorIndex = spriteRow[ xFlip ? (7 - pixel) : pixel ];
 
 	if( colorIndex == 0 ) { continue; }
 	int color = colors[colorIndex];
@@ -372,12 +385,26 @@ void LCD::setStatus( void )
 	// reset LCD y coordinate
 	uint8_t s = 0;
 	mp_bus->defaultAccess( 0xFF44, s, WRITE );
-	
-	m_counter = 0;
+
+	// nothing happens until the LCD is enabled again
+	m_enabled = false;
+	mp_scheduler->cancel( Scheduler::C_EVENT_LCD_STATUS );
+	mp_scheduler->cancel( Scheduler::C_EVENT_LCD_LINE );
 	
 	return;
     }
 
+    if( m_enabled == false )
+    {
+	// the first scanline started with the instruction that enabled the LCD
+	m_enabled = true;
+	m_lineStart = mp_scheduler->getPreviousInstructionStart();
+	mp_scheduler->schedule( Scheduler::C_EVENT_LCD_LINE, m_lineStart + c_cycle );
+    }
+
+    // ticks into the current scanline
+    uint64_t counter = mp_scheduler->getInstructionStart() - m_lineStart;
+
     uint8_t scanline;
     mp_bus->defaultAccess( 0xFF44, scanline, READ );
 
@@ -393,13 +420,13 @@ void LCD::setStatus( void )
     }
     else
     {
-	if( m_counter < c_mode2 )
+	if( counter < c_mode2 )
 	{  
 	    // MODE 2
 	    this->setMode( stat, 0x02 );
 	    interrupt = BIT( stat, 5 );
 	}
-	else if( m_counter < c_mode3 )
+	else if( counter < c_mode3 )
 	{
 	    // MODE 3
 	    this->setMode( stat, 0x03 );
@@ -416,6 +443,20 @@ void LCD::setStatus( void )
 	    interrupt = BIT( stat, 3 );
 	}
     }    
+
+    // the next mode change is at the end of mode 2 or mode 3
+    if( (scanline < 144) && (counter < c_mode2) )
+    {
+	this->scheduleStatus( m_lineStart + c_mode2 );
+    }
+    else if( (scanline < 144) && (counter < c_mode3) )
+    {
+	this->scheduleStatus( m_lineStart + c_mode3 );
+    }
+    else
+    {
+	mp_scheduler->cancel( Scheduler::C_EVENT_LCD_STATUS );
+    }
     
     // Handle interrupts
     uint8_t mode = stat & 0x03;
@@ -427,6 +468,12 @@ void LCD::setStatus( void )
     mp_bus->defaultAccess( 0xFF41, stat, WRITE );
 }
 
+void LCD::scheduleStatus( uint64_t when )
+{
+    m_statusTime = when;
+    mp_scheduler->schedule( Scheduler::C_EVENT_LCD_STATUS, when );
+}
+
 void LCD::setMode( uint8_t& stat, uint8_t mode )
 {
     mode = mode & 0x03;
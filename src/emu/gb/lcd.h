@@ -2,6 +2,8 @@
 
 #include "bus.h"
 #include "devices.h"
+#include "scheduler.h"
+#include "tilecache.h"
 #include "z80.h"
 
 #include <SDL2/SDL.h>
@@ -23,8 +25,9 @@ public:
      * Constructor.
      * @param z80 the cpu
      * @param bus the system's bus
+     * @param scheduler the hardware event scheduler
      */
-    LCD( Z80* z80, Bus* bus );
+    LCD( Z80* z80, Bus* bus, Scheduler* scheduler );
     ~LCD( void );
 
     /**
@@ -36,10 +39,19 @@ public:
     int getPixel( int x, int y );
     
     /**
-     * Update the LCD.
-     * @param ticks the number of CPU ticks taken by the last instruction
+     * Called when a write to LCDC, STAT or LY is due.
      */
-    void update( uint8_t ticks );
+    void handleWrite( void );
+
+    /**
+     * Called when the LCD's status is due to change mode.
+     */
+    void handleStatus( void );
+
+    /**
+     * Called when the LCD is due to finish its current scanline.
+     */
+    void handleLine( void );
 
     /**
      * Whether or not the LCD is enabled.
@@ -53,16 +65,36 @@ public:
      * @return true if yes, false otherwise
      */
     bool readyToDraw( void );
-    
+
+    /**
+     * Gets the number of frames completed so far. Increments when the LCD
+     * enters V-Blank.
+     * @return the frame count
+     */
+    uint32_t getFrameCount( void );
+
 private:
 
     Z80* mp_z80;
     Bus* mp_bus;
-    uint32_t m_counter;
+    Scheduler* mp_scheduler;
+
+    // tile data decoded into color indices
+    TileCache* mp_tileCache;
+
+    // the cycle at which the current scanline started
+    uint64_t m_lineStart;
+
+    // the mode change the pending status event is for
+    uint64_t m_statusTime;
+
+    // whether or not the LCD was enabled when its status was last set
+    bool m_enabled;
 
     int m_pixels[144][160];
     
     bool m_readyToDraw;
+    uint32_t m_frames;
     
     static const uint32_t c_cycle = 456;
     static const uint32_t c_mode2 = 80;
@@ -97,14 +129,14 @@ private:
 
     /**
      * Draws an individual sprite.
-     * @param addr the sprite's address
+     * @param sprite the sprite's four bytes of attributes
      * @param scanline the scanline y position
      * @param size the sprite's size (8 or 16)
      * @param bgColor0 the background palette's color assigned to 0
      * @param pixelsSet keeps track of which pixels have been drawn
      * @return true if drawing succeeded, false otherwise
      */
-    bool drawSprite( uint16_t addr, uint8_t scanline, int size, int bgColor0, bool pixelsSet[] );
+    bool drawSprite( const uint8_t* sprite, uint8_t scanline, int size, int bgColor0, bool pixelsSet[] );
     
     /**
      * Gets the palette color
@@ -118,9 +150,16 @@ private:
      * Sets the LCD's status.
      * If the status changes from 3 to 0 (i.e, the
      * LCD has entered H-Blank), this method will
-     * draw the next scanline.
+     * draw the next scanline. Schedules the next mode change.
      */
     void setStatus( void );
+
+    /**
+     * Schedules a status update for the first instruction that starts
+     * at or after a given cycle.
+     * @param when the cycle
+     */
+    void scheduleStatus( uint64_t when );
     
     /**
      * Sets the LCD status register's mode. Does NOT write back to the bus.
@@ -3,14 +3,15 @@
 #include <iostream>
 #include <fstream>
 
-MBC1::MBC1( char* buffer, uint32_t bufferSize, bool ram, bool battery, std::string savePath ) :
-    Rom( buffer, bufferSize, ram, battery, savePath ),
+MBC1::MBC1( RomImage* image, bool ram, bool battery, std::string savePath ) :
+    Rom( image, ram, battery, savePath ),
     m_romBankNum( 0x01 ),
     m_ramBankNum( 0x00 ),
     m_ramEnabled( false )
 {
     this->setRAMSize();
     this->loadSave();
+    this->mapRam();
 }
 
 MBC1::~MBC1( void )
@@ -28,17 +29,19 @@ void MBC1::access( uint16_t addr, uint8_t& data, bool write )
 	}
 	else if( addr < 0x8000 )
 	{
-	    uint32_t romAddr = addr - 0x4000;
-	    romAddr += (m_romBankNum * 0x4000);
-	    
-	    data = mp_buffer[romAddr];
+	    // switchable ROM bank
+	    if( mp_romBank != NULL ) { data = mp_romBank[ addr - 0x4000 ]; }
+	    else { data = 0xFF; }
 	}
-	else if( m_ram && m_ramEnabled )
+	else if( (mp_ramBank != NULL) && ((uint32_t)(addr - 0xA000) < m_ramSize) )
 	{
 	    // read from RAM
-	    uint16_t dest = addr - 0xA000;
-	    dest += (m_ramBankNum * 0x2000);
-	    data = mp_ramArray[ dest ];
+	    data = mp_ramBank[ addr - 0xA000 ];
+	}
+	else
+	{
+	    // disabled RAM
+	    data = 0xFF;
 	}
     }
     else
@@ -52,6 +55,7 @@ void MBC1::access( uint16_t addr, uint8_t& data, bool write )
 	    else {
 		m_ramEnabled = false;
 	    }
+	    this->mapRam();
 	}
 	else if( addr < 0x4000 )
 	{
@@ -60,6 +64,7 @@ void MBC1::access( uint16_t addr, uint8_t& data, bool write )
 	    if( val == 0x00 ) { val = 0x01; }
 	    m_romBankNum = m_romBankNum & 0xE0;
 	    m_romBankNum = m_romBankNum | val;
+	    this->switchBank( m_romBankNum );
 	}
 	else if( addr < 0x6000)
 	{
@@ -69,11 +74,13 @@ void MBC1::access( uint16_t addr, uint8_t& data, bool write )
 		uint8_t val = data & 0x03;
 		val = val << 5;
 		m_romBankNum = m_romBankNum | val;
+		this->switchBank( m_romBankNum );
 	    }
 	    else
 	    {
 		// RAM bank number
 		m_ramBankNum = data & 0x03;
+		this->mapRam();
 	    }
 	}
 	else if( addr < 0x8000 )
@@ -82,13 +89,17 @@ void MBC1::access( uint16_t addr, uint8_t& data, bool write )
 	    if( data == 0x00 ) { m_romMode = true; }
 	    else { m_romMode = false; }
 	}
-	else if( m_ram && m_ramEnabled )
+	else if( (mp_ramBank != NULL) && ((uint32_t)(addr - 0xA000) < m_ramSize) )
 	{
 	    // write to RAM
-	    uint16_t dest = addr - 0xA000;
-	    dest += (m_ramBankNum * 0x2000);
-	    mp_ramArray[ dest ] = data;
+	    mp_ramBank[ addr - 0xA000 ] = data;
 	}
     }
 }
 
+void MBC1::mapRam( void )
+{
+    if( m_ram && m_ramEnabled ) { this->switchRamBank( m_ramBankNum ); }
+    else { this->switchRamBank( c_ramDisabled ); }
+}
+
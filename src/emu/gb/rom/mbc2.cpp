@@ -0,0 +1,78 @@
+#include "mbc2.h"
+
+#include <cstring>
+
+MBC2::MBC2( RomImage* image, bool battery, std::string savePath ) :
+    Rom( image, true, battery, savePath ),
+    m_romBankNum( 0x01 ),
+    m_ramEnabled( false )
+{
+    // the RAM size isn't in the header
+    m_ramSize = c_ramSize;
+    mp_ramArray = new uint8_t[ m_ramSize ];
+    memset( mp_ramArray, 0x00, m_ramSize );
+
+    this->loadSave();
+    this->switchRamBank( c_ramDisabled );
+}
+
+MBC2::~MBC2( void )
+{
+}
+
+void MBC2::access( uint16_t addr, uint8_t& data, bool write )
+{
+    if( write == READ )
+    {
+	if( addr < 0x4000 )
+	{
+	    // first ROM bank
+	    data = mp_buffer[addr];
+	}
+	else if( addr < 0x8000 )
+	{
+	    // switchable ROM bank
+	    if( mp_romBank != NULL ) { data = mp_romBank[ addr - 0x4000 ]; }
+	    else { data = 0xFF; }
+	}
+	else if( m_ramEnabled )
+	{
+	    // read from RAM (only the lower half of each byte is stored)
+	    data = 0xF0 | mp_ramArray[ (addr - 0xA000) % c_ramSize ];
+	}
+	else
+	{
+	    // disabled RAM
+	    data = 0xFF;
+	}
+    }
+    else
+    {
+	if( addr < 0x4000 )
+	{
+	    // bit 8 of the address selects the register
+	    if( BIT( addr, 8 ) )
+	    {
+		// ROM bank number
+		m_romBankNum = data & 0x0F;
+		if( m_romBankNum == 0x00 ) { m_romBankNum = 0x01; }
+		this->switchBank( m_romBankNum );
+	    }
+	    else
+	    {
+		// enable / disable RAM
+		m_ramEnabled = ( data & 0x0F ) == 0x0A;
+		this->switchRamBank( m_ramEnabled ? c_ramRegisters : c_ramDisabled );
+	    }
+	}
+	else if( addr < 0x8000 )
+	{
+	    // unused
+	}
+	else if( m_ramEnabled )
+	{
+	    // write to RAM
+	    mp_ramArray[ (addr - 0xA000) % c_ramSize ] = data & 0x0F;
+	}
+    }
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "rom.h"
+
+/**
+ * @author Rick Hallman
+ * This class represents a ROM with an MBC2 bank controller. MBC2 has
+ * up to 256 KB of ROM and 512 half-bytes of built-in RAM, which are
+ * repeated across 0xA000-0xBFFF. The upper half of each RAM byte reads
+ * as 1s, so RAM is accessed through the cartridge rather than mapped.
+ */
+class MBC2 final : public Rom
+{
+public:
+
+    /**
+     * Constructor.
+     * @param image the ROM file's image
+     * @param battery whether or not this cartridge has a built-in battery
+     * @param savePath the game file's save path
+     */
+    MBC2( RomImage* image, bool battery, std::string savePath );
+    virtual ~MBC2( void );
+    virtual void access( uint16_t addr, uint8_t& data, bool write );
+    
+private:
+
+    // the size of the built-in RAM
+    static const unsigned int c_ramSize = 0x200;
+
+    // the rom bank number
+    uint8_t m_romBankNum;
+
+    // RAM enabled flag
+    bool m_ramEnabled;
+};
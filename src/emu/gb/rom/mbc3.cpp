@@ -2,24 +2,32 @@
 
 #include <iostream>
 #include <fstream>
+#include <cstring>
+#include <ctime>
 
-MBC3::MBC3( char* buffer, uint32_t bufferSize, bool ram, bool battery, bool timer, std::string savePath ) :
-    Rom( buffer, bufferSize, ram, battery, savePath ),
+MBC3::MBC3( RomImage* image, bool ram, bool battery, bool timer, std::string savePath ) :
+    Rom( image, ram, battery, savePath ),
     m_timer( timer ),
     m_romBankNum( 0x01 ),
-    m_ramRtcBankNum( 0x00 )
+    m_ramRtcBankNum( 0x00 ),
+    m_ramRtcEnabled( false ),
+    m_clockStart( time( NULL ) ),
+    m_clockHalted( 0 ),
+    m_halted( false ),
+    m_carry( false ),
+    m_latch( 0xFF )
 {
+    memset( m_clockCounterRegs, 0x00, sizeof( m_clockCounterRegs ) );
+    if( m_timer ) { m_saveExtraSize = c_clockSaveSize; }
+
     this->setRAMSize();
     this->loadSave();
+    this->loadClock();
+    this->mapRam();
 }
 
 MBC3::~MBC3( void )
 {
-    if( mp_ramArray != NULL )
-    {
-	delete[] mp_ramArray;
-	mp_ramArray = NULL;
-    }
 }
 
 void MBC3::access( uint16_t addr, uint8_t& data, bool write )
@@ -33,23 +41,25 @@ void MBC3::access( uint16_t addr, uint8_t& data, bool write )
 	}
 	else if( addr < 0x8000 )
 	{
-	    uint32_t romAddr = addr - 0x4000;
-	    romAddr += (m_romBankNum * 0x4000);
-	    data = mp_buffer[romAddr];
+	    // switchable ROM bank
+	    if( mp_romBank != NULL ) { data = mp_romBank[ addr - 0x4000 ]; }
+	    else { data = 0xFF; }
 	}
 	else if( addr < 0xC000 )
 	{
-	    if( m_ramRtcBankNum < 0x04 ) {	    
+	    data = 0xFF;
+
+	    if( m_ramRtcBankNum < 0x04 ) {
 		// read from RAM
-		uint16_t dest = addr - 0xA000;
-		dest += (m_ramRtcBankNum * 0x2000);
-		data = mp_ramArray[ dest ];
+		if( (mp_ramBank != NULL) && ((uint32_t)(addr - 0xA000) < m_ramSize) )
+		{
+		    data = mp_ramBank[ addr - 0xA000 ];
+		}
 	    }
-	    else if( m_timer )
+	    else if( m_ramRtcEnabled && m_timer && (m_ramRtcBankNum >= 0x08) && (m_ramRtcBankNum <= 0x0C) )
 	    {
 		// RTC register
-		uint8_t num = m_ramRtcBankNum - 0x08;
-		data = m_clockCounterRegs[ num ];
+		data = m_clockCounterRegs[ m_ramRtcBankNum - 0x08 ];
 	    }
 	}
     }
@@ -64,6 +74,7 @@ void MBC3::access( uint16_t addr, uint8_t& data, bool write )
 	    else {
 		m_ramRtcEnabled = false;
 	    }
+	    this->mapRam();
 	}
 	else if( addr < 0x4000 )
 	{
@@ -71,31 +82,183 @@ void MBC3::access( uint16_t addr, uint8_t& data, bool write )
 	    uint8_t bankNum = data & 0x7F;
 	    if( bankNum == 0x0 ) { bankNum = 0x1; }
 	    m_romBankNum = bankNum;
+	    this->switchBank( m_romBankNum );
 	}
 	else if( addr < 0x6000 )
 	{
 	    // RAM bank num or RTC register select
 	    m_ramRtcBankNum = data;
+	    this->mapRam();
 	}
 	else if( addr < 0x8000 )
 	{
-	    // latch clock data
+	    // latch clock data when 0x00 then 0x01 is written
+	    if( m_timer && (m_latch == 0x00) && (data == 0x01) ) { this->latchClock(); }
+	    m_latch = data;
 	}
 	else if( addr < 0xC000 )
 	{
-	    if( m_ramRtcBankNum < 0x04 ) {	    
+	    if( m_ramRtcBankNum < 0x04 ) {
 		// write to RAM
-		uint16_t dest = addr - 0xA000;
-		dest += (m_ramRtcBankNum * 0x2000);
-		mp_ramArray[ dest ] = data;
+		if( (mp_ramBank != NULL) && ((uint32_t)(addr - 0xA000) < m_ramSize) )
+		{
+		    mp_ramBank[ addr - 0xA000 ] = data;
+		}
 	    }
-	    else if( m_timer )
+	    else if( m_ramRtcEnabled && m_timer && (m_ramRtcBankNum >= 0x08) && (m_ramRtcBankNum <= 0x0C) )
 	    {
 		// RTC register
-		uint8_t num = m_ramRtcBankNum - 0x08;
-		m_clockCounterRegs[ num ] = data;
-	    }		
+		this->writeClock( m_ramRtcBankNum - 0x08, data );
+	    }
+	}
+    }
+}
+
+void MBC3::mapRam( void )
+{
+    if( m_ramRtcEnabled == false ) { this->switchRamBank( c_ramDisabled ); }
+    else if( m_ram && (m_ramRtcBankNum < 0x04) ) { this->switchRamBank( m_ramRtcBankNum ); }
+    else if( m_timer && (m_ramRtcBankNum >= 0x08) && (m_ramRtcBankNum <= 0x0C) )
+    {
+	this->switchRamBank( c_ramRegisters );
+    }
+    else { this->switchRamBank( c_ramDisabled ); }
+}
+
+uint64_t MBC3::getClock( void )
+{
+    if( m_halted ) { return m_clockHalted; }
+
+    // the host clock may have been set back
+    int64_t seconds = (int64_t)time( NULL ) - m_clockStart;
+    return ( seconds > 0 ) ? (uint64_t)seconds : 0;
+}
+
+void MBC3::setClock( uint64_t seconds )
+{
+    if( seconds >= c_clockPeriod )
+    {
+	m_carry = true;
+	seconds %= c_clockPeriod;
+    }
+
+    if( m_halted ) { m_clockHalted = seconds; }
+    else { m_clockStart = (int64_t)time( NULL ) - (int64_t)seconds; }
+}
+
+void MBC3::splitClock( uint64_t seconds, uint8_t regs[] )
+{
+    uint64_t days = seconds / 86400;
+
+    regs[ C_RTC_SECONDS ] = seconds % 60;
+    regs[ C_RTC_MINUTES ] = (seconds / 60) % 60;
+    regs[ C_RTC_HOURS ] = (seconds / 3600) % 24;
+    regs[ C_RTC_DAYS_LOW ] = days & 0xFF;
+    regs[ C_RTC_DAYS_HIGH ] = ( (days >> 8) & 0x01 ) |
+	( m_halted ? 0x40 : 0x00 ) | ( m_carry ? 0x80 : 0x00 );
+}
+
+void MBC3::latchClock( void )
+{
+    // wrap the day counter before reading it
+    this->setClock( this->getClock() );
+    this->splitClock( this->getClock(), m_clockCounterRegs );
+    this->saveClock();
+}
+
+void MBC3::writeClock( uint8_t reg, uint8_t data )
+{
+    uint64_t seconds = this->getClock();
+    uint64_t days = seconds / 86400;
+    uint64_t time = seconds % 86400;
+
+    switch( reg )
+    {
+    case C_RTC_SECONDS:
+	time = time - (time % 60) + (data % 60); break;
+    case C_RTC_MINUTES:
+	time = time - (((time / 60) % 60) * 60) + ((data % 60) * 60); break;
+    case C_RTC_HOURS:
+	time = time - ((time / 3600) * 3600) + ((data % 24) * 3600); break;
+    case C_RTC_DAYS_LOW:
+	days = ( days & 0x100 ) | data; break;
+    case C_RTC_DAYS_HIGH:
+    default:
+	days = ( days & 0xFF ) | ( (data & 0x01) << 8 );
+	m_carry = BIT( data, 7 );
+
+	// halting freezes the clock where it is
+	if( BIT( data, 6 ) != m_halted )
+	{
+	    m_clockHalted = seconds;
+	    m_clockStart = (int64_t)::time( NULL ) - (int64_t)seconds;
+	    m_halted = BIT( data, 6 );
 	}
+	break;
     }
+
+    this->setClock( (days * 86400) + time );
+    m_clockCounterRegs[ reg ] = data;
+    this->saveClock();
 }
 
+void MBC3::loadClock( void )
+{
+    if( mp_saveExtra == NULL ) { return; }
+
+    // 32-bit little endian registers, then the 64-bit save time
+    uint32_t values[ 2 * C_RTC_COUNT ];
+    for( unsigned int i = 0; i < 2 * C_RTC_COUNT; i++ )
+    {
+	const uint8_t* value = mp_saveExtra + (i * 4);
+	values[ i ] = value[0] | (value[1] << 8) | (value[2] << 16) | ((uint32_t)value[3] << 24);
+    }
+
+    int64_t saved = 0;
+    for( unsigned int i = 0; i < 8; i++ )
+    {
+	saved |= (int64_t)mp_saveExtra[ (4 * 2 * C_RTC_COUNT) + i ] << (8 * i);
+    }
+
+    // a cleared save file has no clock yet
+    if( saved == 0 ) { return; }
+
+    uint64_t seconds = (values[ C_RTC_SECONDS ] % 60) +
+	((values[ C_RTC_MINUTES ] % 60) * 60) +
+	((values[ C_RTC_HOURS ] % 24) * 3600) +
+	((uint64_t)( values[ C_RTC_DAYS_LOW ] & 0xFF ) * 86400) +
+	((uint64_t)( values[ C_RTC_DAYS_HIGH ] & 0x01 ) * 256 * 86400);
+
+    m_halted = BIT( values[ C_RTC_DAYS_HIGH ], 6 );
+    m_carry = BIT( values[ C_RTC_DAYS_HIGH ], 7 );
+
+    // a running clock kept counting while the game was closed
+    if( m_halted ) { m_clockHalted = seconds; }
+    else { m_clockStart = saved - (int64_t)seconds; }
+
+    for( unsigned int i = 0; i < C_RTC_COUNT; i++ )
+    {
+	m_clockCounterRegs[ i ] = (uint8_t)values[ C_RTC_COUNT + i ];
+    }
+}
+
+void MBC3::saveClock( void )
+{
+    if( mp_saveExtra == NULL ) { return; }
+
+    uint8_t regs[ C_RTC_COUNT ];
+    this->splitClock( this->getClock(), regs );
+
+    memset( mp_saveExtra, 0x00, c_clockSaveSize );
+    for( unsigned int i = 0; i < C_RTC_COUNT; i++ )
+    {
+	mp_saveExtra[ i * 4 ] = regs[ i ];
+	mp_saveExtra[ (C_RTC_COUNT + i) * 4 ] = m_clockCounterRegs[ i ];
+    }
+
+    int64_t now = time( NULL );
+    for( unsigned int i = 0; i < 8; i++ )
+    {
+	mp_saveExtra[ (4 * 2 * C_RTC_COUNT) + i ] = (uint8_t)( now >> (8 * i) );
+    }
+}
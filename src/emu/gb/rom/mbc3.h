@@ -5,16 +5,87 @@
 /**
  * @author Rick Hallman
  * This class represents a ROM with an MBC3 bank controller.
+ *
+ * The real time clock is never ticked. It is kept as the host time at
+ * which the clock read zero, and the seconds, minutes, hours and days are
+ * only calculated when the clock is latched or written. Battery-backed
+ * clocks are saved after RAM in the common 48-byte format (the current and
+ * latched registers as 32-bit values, then the host time as 64 bits).
  */
-class MBC3 : public Rom
+class MBC3 final : public Rom
 {
 public:
-    MBC3( char* buffer, uint32_t bufferSize, bool ram, bool battery, bool timer, std::string savePath );
+    MBC3( RomImage* image, bool ram, bool battery, bool timer, std::string savePath );
     virtual ~MBC3( void );
     virtual void access( uint16_t addr, uint8_t& data, bool write );
     
 private:
 
+    // clock registers
+    typedef enum
+    {
+	C_RTC_SECONDS,
+	C_RTC_MINUTES,
+	C_RTC_HOURS,
+	C_RTC_DAYS_LOW,
+	C_RTC_DAYS_HIGH,
+	C_RTC_COUNT
+    } ClockRegister;
+
+    // the size of the saved clock state
+    static const unsigned int c_clockSaveSize = 48;
+
+    // the clock's range, after which the day counter carries
+    static const uint64_t c_clockPeriod = 512 * 86400;
+
+    /**
+     * Maps the selected RAM bank or the RTC registers, or nothing while
+     * they are disabled.
+     */
+    void mapRam( void );
+
+    /**
+     * Gets the seconds counted by the clock.
+     * @return the seconds since the clock read zero
+     */
+    uint64_t getClock( void );
+
+    /**
+     * Sets the seconds counted by the clock, wrapping the day counter.
+     * @param seconds the seconds since the clock read zero
+     */
+    void setClock( uint64_t seconds );
+
+    /**
+     * Splits the clock into its registers.
+     * @param seconds the seconds since the clock read zero
+     * @param regs set to the register values
+     */
+    void splitClock( uint64_t seconds, uint8_t regs[] );
+
+    /**
+     * Copies the current time to the latched registers.
+     */
+    void latchClock( void );
+
+    /**
+     * Writes a clock register.
+     * @param reg the register
+     * @param data the value to write
+     */
+    void writeClock( uint8_t reg, uint8_t data );
+
+    /**
+     * Reads the clock from the save file, counting the time since it was
+     * saved.
+     */
+    void loadClock( void );
+
+    /**
+     * Writes the clock to the save file.
+     */
+    void saveClock( void );
+
     // Whether or not this chip comes with a timer
     bool m_timer;
 
@@ -27,6 +98,18 @@ private:
     // RAM / RTC enabled flag
     bool m_ramRtcEnabled;
 
-    // clock counter registers
-    uint8_t m_clockCounterRegs[ 5 ];
+    // latched clock counter registers
+    uint8_t m_clockCounterRegs[ C_RTC_COUNT ];
+
+    // the host time at which the clock read zero, and the clock while
+    // it is halted
+    int64_t m_clockStart;
+    uint64_t m_clockHalted;
+    bool m_halted;
+
+    // day counter carry flag
+    bool m_carry;
+
+    // the last value written to the latch register
+    uint8_t m_latch;
 };
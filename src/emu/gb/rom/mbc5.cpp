@@ -0,0 +1,87 @@
+#include "mbc5.h"
+
+MBC5::MBC5( RomImage* image, bool ram, bool battery, bool rumble, std::string savePath ) :
+    Rom( image, ram, battery, savePath ),
+    m_rumble( rumble ),
+    m_romBankNum( 0x01 ),
+    m_ramBankNum( 0x00 ),
+    m_ramEnabled( false )
+{
+    this->setRAMSize();
+    this->loadSave();
+    this->mapRam();
+}
+
+MBC5::~MBC5( void )
+{
+}
+
+void MBC5::access( uint16_t addr, uint8_t& data, bool write )
+{
+    if( write == READ )
+    {
+	if( addr < 0x4000 )
+	{
+	    // first ROM bank
+	    data = mp_buffer[addr];
+	}
+	else if( addr < 0x8000 )
+	{
+	    // switchable ROM bank
+	    if( mp_romBank != NULL ) { data = mp_romBank[ addr - 0x4000 ]; }
+	    else { data = 0xFF; }
+	}
+	else if( (mp_ramBank != NULL) && ((uint32_t)(addr - 0xA000) < m_ramSize) )
+	{
+	    // read from RAM
+	    data = mp_ramBank[ addr - 0xA000 ];
+	}
+	else
+	{
+	    // disabled RAM
+	    data = 0xFF;
+	}
+    }
+    else
+    {
+	if( addr < 0x2000 )
+	{
+	    // enable / disable external RAM
+	    m_ramEnabled = ( data & 0x0F ) == 0x0A;
+	    this->mapRam();
+	}
+	else if( addr < 0x3000 )
+	{
+	    // ROM bank number (bits 0-7). Unlike MBC1, bank 0 can be mapped.
+	    m_romBankNum = ( m_romBankNum & 0x100 ) | data;
+	    this->switchBank( m_romBankNum );
+	}
+	else if( addr < 0x4000 )
+	{
+	    // ROM bank number (bit 8)
+	    m_romBankNum = ( m_romBankNum & 0xFF ) | ( (data & 0x01) << 8 );
+	    this->switchBank( m_romBankNum );
+	}
+	else if( addr < 0x6000 )
+	{
+	    // RAM bank number. Rumble cartridges use bit 3 for the motor.
+	    m_ramBankNum = data & ( m_rumble ? 0x07 : 0x0F );
+	    this->mapRam();
+	}
+	else if( addr < 0x8000 )
+	{
+	    // unused
+	}
+	else if( (mp_ramBank != NULL) && ((uint32_t)(addr - 0xA000) < m_ramSize) )
+	{
+	    // write to RAM
+	    mp_ramBank[ addr - 0xA000 ] = data;
+	}
+    }
+}
+
+void MBC5::mapRam( void )
+{
+    if( m_ram && m_ramEnabled ) { this->switchRamBank( m_ramBankNum ); }
+    else { this->switchRamBank( c_ramDisabled ); }
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "rom.h"
+
+/**
+ * @author Rick Hallman
+ * This class represents a ROM with an MBC5 bank controller, which
+ * supports up to 8 MB of ROM and 128 KB of RAM.
+ */
+class MBC5 final : public Rom
+{
+public:
+
+    /**
+     * Constructor.
+     * @param image the ROM file's image
+     * @param ram whether or not this cartridge has built in RAM
+     * @param battery whether or not this cartridge has a built-in battery
+     * @param rumble whether or not this cartridge has a rumble motor
+     * @param savePath the game file's save path
+     */
+    MBC5( RomImage* image, bool ram, bool battery, bool rumble, std::string savePath );
+    virtual ~MBC5( void );
+    virtual void access( uint16_t addr, uint8_t& data, bool write );
+    
+private:
+
+    /**
+     * Maps the selected RAM bank, or unmaps RAM if it is disabled.
+     */
+    void mapRam( void );
+
+    // Whether or not the RAM bank register's bit 3 drives a rumble motor
+    bool m_rumble;
+
+    // the rom (9 bits) and ram bank numbers
+    uint16_t m_romBankNum;
+    uint8_t m_ramBankNum;
+
+    // RAM enabled flag
+    bool m_ramEnabled;
+};
@@ -1,79 +1,126 @@
 #include "rom.h"
 #include "mbc1.h"
+#include "mbc2.h"
 #include "mbc3.h"
+#include "mbc5.h"
+#include "romimage.h"
+#include "../blockcache.h"
 
 #include <iostream>
 #include <fstream>
+#include <cstring>
 
-Rom::Rom( char* buffer, uint32_t bufferSize, bool ram, bool battery, std::string savePath )
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+Rom::Rom( RomImage* image, bool ram, bool battery, std::string savePath )
     : MemoryDevice( c_start, c_end ),
       m_savePath( savePath ),
       m_ram( ram ),
       m_battery( battery ),
       m_romMode( false ),
       mp_ramArray( NULL ),
-      mp_buffer( buffer ),
-      m_bufferSize( bufferSize )
+      m_ramSize( 0 ),
+      mp_saveExtra( NULL ),
+      m_saveExtraSize( 0 ),
+      mp_saveMap( NULL ),
+      mp_image( image ),
+      mp_buffer( image->getData() ),
+      m_bufferSize( image->getSize() ),
+      mp_blockCache( NULL ),
+      m_bank( 0x01 ),
+      mp_romBank( NULL ),
+      mp_ramBank( NULL ),
+      m_ramRegisters( false ),
+      mp_bus( NULL )
 {
+    memset( m_openBus, 0xFF, sizeof( m_openBus ) );
+    this->switchBank( m_bank );
 }
 
 Rom* Rom::Load( std::string path, std::string savePath )
 {
     using namespace std;
     
-    // load the file
-    ifstream file( path, ios::binary | ios::ate );
-    if( file.good() == false ) { return NULL; }
-
-    // load the ROM buffer
-    unsigned int bufferSize = file.tellg();
-    char* buffer;
-    buffer = new char[bufferSize];
-    file.seekg( 0, ios::beg );
-    file.read( buffer, bufferSize );
-    file.close();
-    
+    // map the file, or share it if it is already loaded
+    RomImage* image = RomImage::Acquire( path );
+    if( image == NULL ) { return NULL; }
+
+    // the cartridge header ends at 0x014F
+    if( image->getSize() < 0x150 )
+    {
+	image->release();
+	return NULL;
+    }
+
     // MBC type is stored at 0x0147 in cartridge header
-    uint8_t type = buffer[0x147];
+    uint8_t type = image->getData()[0x147];
 
     Rom* rom = NULL;
     
     switch( type )
     {
     case C_ROM_ONLY:
-	rom = new Rom( buffer, bufferSize, false, false, savePath );
+	rom = new Rom( image, false, false, savePath );
 	break;
     case C_ROM_RAM:
-	rom = new Rom( buffer, bufferSize, true, false, savePath );
+	rom = new Rom( image, true, false, savePath );
 	break;
     case C_ROM_RAM_BATTERY:
-	rom = new Rom( buffer, bufferSize, true, true, savePath );
+	rom = new Rom( image, true, true, savePath );
 	break;
     case C_MBC1:
-	rom = new MBC1( buffer, bufferSize, false, false, savePath );
+	rom = new MBC1( image, false, false, savePath );
 	break;
     case C_MBC1_RAM:
-	rom = new MBC1( buffer, bufferSize, true, false, savePath );
+	rom = new MBC1( image, true, false, savePath );
 	break;
     case C_MBC1_RAM_BATTERY:
-	rom = new MBC1( buffer, bufferSize, true, true, savePath );
+	rom = new MBC1( image, true, true, savePath );
 	break;
     case C_MBC3:
-	rom = new MBC3( buffer, bufferSize, false, false, false, savePath );
+	rom = new MBC3( image, false, false, false, savePath );
 	break;
     case C_MBC3_RAM:
-	rom = new MBC3( buffer, bufferSize, true, false, false, savePath );
+	rom = new MBC3( image, true, false, false, savePath );
 	break;
     case C_MBC3_RAM_BATTERY:
-	rom = new MBC3( buffer, bufferSize, true, true, false, savePath );
+	rom = new MBC3( image, true, true, false, savePath );
 	break;
     case C_MBC3_TIM_BATTERY:
-	rom = new MBC3( buffer, bufferSize, false, true, true, savePath );
+	rom = new MBC3( image, false, true, true, savePath );
 	break;
     case C_MBC3_TIM_RAM_BATTERY:
-	rom = new MBC3( buffer, bufferSize, true, true, true, savePath );
+	rom = new MBC3( image, true, true, true, savePath );
+	break;
+    case C_MBC2:
+	rom = new MBC2( image, false, savePath );
+	break;
+    case C_MBC2_BATTERY:
+	rom = new MBC2( image, true, savePath );
+	break;
+    case C_MBC5:
+	rom = new MBC5( image, false, false, false, savePath );
+	break;
+    case C_MBC5_RAM:
+	rom = new MBC5( image, true, false, false, savePath );
+	break;
+    case C_MBC5_RAM_BATTERY:
+	rom = new MBC5( image, true, true, false, savePath );
+	break;
+    case C_MBC5_RUMBLE:
+	rom = new MBC5( image, false, false, true, savePath );
+	break;
+    case C_MBC5_RUMBLE_RAM:
+	rom = new MBC5( image, true, false, true, savePath );
+	break;
+    case C_MBC5_RUMBLE_RAM_BATTERY:
+	rom = new MBC5( image, true, true, true, savePath );
 	break;
     default:
+	image->release();
 	break;
     }
     
@@ -82,25 +129,112 @@ Rom* Rom::Load( std::string path, std::string savePath )
 
 Rom::~Rom( void )
 {
-    if( mp_buffer != NULL )
+    if( mp_image != NULL )
     {
-	delete[] mp_buffer;
+	mp_image->release();
+	mp_image = NULL;
 	mp_buffer = NULL;
     }
 
+    if( mp_saveMap != NULL )
+    {
+	this->flush( true );
+	munmap( mp_saveMap, m_ramSize + m_saveExtraSize );
+	mp_saveMap = NULL;
+	mp_ramArray = NULL;
+	mp_saveExtra = NULL;
+    }
+
     if( mp_ramArray != NULL )
     {
 	delete[] mp_ramArray;
 	mp_ramArray = NULL;
     }
 
+    if( mp_saveExtra != NULL )
+    {
+	delete[] mp_saveExtra;
+	mp_saveExtra = NULL;
+    }
 }
 
 void Rom::access( uint16_t addr, uint8_t& data, bool write )
 {
     if( write ) { return; }
 
-    data = mp_buffer[addr];
+    // nothing is mapped past the end of the file, e.g. cartridge RAM
+    if( addr >= m_bufferSize ) { data = 0xFF; }
+    else { data = mp_buffer[addr]; }
+}
+
+void Rom::setBlockCache( BlockCache* cache )
+{
+    mp_blockCache = cache;
+}
+
+uint16_t Rom::getBank( void )
+{
+    return m_bank;
+}
+
+void Rom::setBus( Bus* bus )
+{
+    mp_bus = bus;
+}
+
+const uint8_t* Rom::getPage( uint8_t page )
+{
+    if( page < 0x40 )
+    {
+	uint32_t offset = (uint32_t)page << 8;
+	if( offset + 0x100 > m_bufferSize ) { return NULL; }
+	return (const uint8_t*)mp_buffer + offset;
+    }
+
+    if( mp_romBank == NULL ) { return NULL; }
+    return (const uint8_t*)mp_romBank + ( (page & 0x3F) << 8 );
+}
+
+uint8_t* Rom::getRamPage( uint8_t page )
+{
+    uint32_t offset = (uint32_t)( page - 0xA0 ) << 8;
+
+    // smaller RAM does not fill the whole bank
+    if( (mp_ramBank == NULL) || (offset + 0x100 > m_ramSize) ) { return NULL; }
+    return mp_ramBank + offset;
+}
+
+const uint8_t* Rom::getRamReadPage( uint8_t page )
+{
+    if( m_ramRegisters ) { return NULL; }
+
+    uint8_t* ram = this->getRamPage( page );
+    return ( ram != NULL ) ? ram : m_openBus;
+}
+
+void Rom::switchBank( uint16_t bank )
+{
+    m_bank = bank;
+
+    // banks past the end of the ROM wrap around, as on the cartridge
+    uint32_t banks = m_bufferSize / c_pageSize;
+    if( banks < 2 ) { mp_romBank = NULL; }
+    else { mp_romBank = mp_buffer + ( (bank % banks) * c_pageSize ); }
+
+    if( mp_bus != NULL ) { mp_bus->mapRomBank(); }
+    if( mp_blockCache != NULL ) { mp_blockCache->switchBank( bank ); }
+}
+
+void Rom::switchRamBank( int bank )
+{
+    uint32_t offset = bank * c_ramBankSize;
+
+    m_ramRegisters = ( bank == c_ramRegisters );
+
+    if( (bank < 0) || (mp_ramArray == NULL) || (offset >= m_ramSize) ) { mp_ramBank = NULL; }
+    else { mp_ramBank = mp_ramArray + offset; }
+
+    if( mp_bus != NULL ) { mp_bus->mapRamBank(); }
 }
 
 void Rom::setRAMSize( void )
@@ -140,10 +274,18 @@ void Rom::save( void )
     
     if( !m_battery ) { return; }
 
+    if( mp_saveMap != NULL )
+    {
+	this->flush( true );
+	cout << "Wrote save data to " << m_savePath << endl;
+	return;
+    }
+
     ofstream file( m_savePath, ios::binary );
     if( file.is_open() )
     {
-	file.write( (char*)mp_ramArray, m_ramSize );
+	if( mp_ramArray != NULL ) { file.write( (char*)mp_ramArray, m_ramSize ); }
+	if( mp_saveExtra != NULL ) { file.write( (char*)mp_saveExtra, m_saveExtraSize ); }
 	file.close();
 	cout << "Wrote save data to " << m_savePath << endl;
     }
@@ -153,35 +295,78 @@ void Rom::save( void )
     }
 }
 
+void Rom::flush( bool wait )
+{
+    // only the pages written since the last flush are written out
+    if( mp_saveMap != NULL )
+    {
+	msync( mp_saveMap, m_ramSize + m_saveExtraSize, wait ? MS_SYNC : MS_ASYNC );
+    }
+}
+
 void Rom::loadSave( void )
 {
     using namespace std;
     
-    if( !m_battery) { return; }
+    unsigned int size = m_ramSize + m_saveExtraSize;
+    if( !m_battery || (size == 0) ) { return; }
 
-    ifstream file( m_savePath, ios::binary | ios::ate );
-    if( file.is_open() )
+    // until the save file is mapped, the extra state is on the heap
+    if( m_saveExtraSize > 0 )
     {
-	unsigned int bufferSize = file.tellg();
-        if( bufferSize != m_ramSize )
-	{
-	    cout << "Invalid save data." << endl;
-	    return;
-	}
-
-	char* buffer;
-	buffer = new char[bufferSize];
-	file.seekg( 0, ios::beg );
-	file.read( buffer, bufferSize );
-	file.close();
-	
-	delete[] mp_ramArray;
-	mp_ramArray = (uint8_t*)buffer;
+	mp_saveExtra = new uint8_t[ m_saveExtraSize ];
+	memset( mp_saveExtra, 0x00, m_saveExtraSize );
+    }
 
-	cout << "Save data loaded from " << m_savePath << endl;
+    int fd = open( m_savePath.c_str(), O_RDWR | O_CREAT, 0644 );
+    if( fd < 0 )
+    {
+	cout << "No save file found." << endl;
+	return;
     }
-    else
+
+    struct stat info;
+    if( fstat( fd, &info ) != 0 )
     {
+	close( fd );
 	cout << "No save file found." << endl;
+	return;
     }
+
+    // a new save file starts out cleared, and a save file with only RAM
+    // gets cleared extra state
+    unsigned int found = (unsigned int)info.st_size;
+    bool created = ( found == 0 );
+    if( (found != size) && (found != 0) && (found != m_ramSize) )
+    {
+	close( fd );
+	cout << "Invalid save data." << endl;
+	return;
+    }
+    else if( (found != size) && (ftruncate( fd, size ) != 0) )
+    {
+	close( fd );
+	cout << "Unable to create save file." << endl;
+	return;
+    }
+
+    // writes to RAM go straight to the file's pages
+    void* map = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    close( fd );
+
+    if( map == MAP_FAILED )
+    {
+	cout << "Unable to map save data." << endl;
+	return;
+    }
+
+    delete[] mp_ramArray;
+    delete[] mp_saveExtra;
+
+    mp_saveMap = (uint8_t*)map;
+    mp_ramArray = ( m_ramSize > 0 ) ? mp_saveMap : NULL;
+    mp_saveExtra = ( m_saveExtraSize > 0 ) ? mp_saveMap + m_ramSize : NULL;
+
+    if( created ) { cout << "Created save file " << m_savePath << endl; }
+    else { cout << "Save data loaded from " << m_savePath << endl; }
 }
@@ -3,6 +3,9 @@
 #include "../bus.h"
 #include "../devices.h"
 
+class BlockCache;
+class RomImage;
+
 #include <string>
 
 /**
@@ -35,21 +38,70 @@ public:
      */
     virtual void save( void );
 
+    /**
+     * Writes changes to battery-backed RAM through to the save file, so
+     * they survive the process ending without save() being called.
+     * @param wait whether to block until the data is on disk, or only
+     *        start writing it (DEFAULT: false)
+     */
+    void flush( bool wait=false );
+
+    /**
+     * Sets the CPU's block cache, which is notified on ROM bank switches.
+     * @param cache the block cache (or NULL)
+     */
+    void setBlockCache( BlockCache* cache );
+
+    /**
+     * Gets the ROM bank mapped to 0x4000-0x7FFF.
+     * @return the bank number
+     */
+    uint16_t getBank( void );
+
+    /**
+     * Sets the bus, which is notified on ROM bank switches.
+     * @param bus the bus (or NULL)
+     */
+    void setBus( Bus* bus );
+
+    /**
+     * Gets the ROM backing a page of 0x0000-0x7FFF in the current bank, so
+     * it can be read without calling access().
+     * @param page the page (the address's high byte)
+     * @return the page's first byte, or NULL if the bank is out of range
+     */
+    const uint8_t* getPage( uint8_t page );
+
+    /**
+     * Gets the RAM backing a page of 0xA000-0xBFFF in the current bank, so
+     * it can be accessed without calling access().
+     * @param page the page (the address's high byte)
+     * @return the page's first byte, or NULL if RAM is not mapped there
+     */
+    uint8_t* getRamPage( uint8_t page );
+
+    /**
+     * Gets the memory that reads of a page of 0xA000-0xBFFF see. This is
+     * the RAM page, or a page of 0xFF while RAM is disabled.
+     * @param page the page (the address's high byte)
+     * @return the page's first byte, or NULL if reads go through access()
+     */
+    const uint8_t* getRamReadPage( uint8_t page );
+
 protected:
 
     /**
      * Constructor (called by Load).
-     * @param buffer the file data
-     * @param bufferSize the file buffer's size
+     * @param image the ROM file's image
      * @param ram whether or not this cartridge has RAM
      * @param battery whether or not this cartridge has a battery
      * @param savePath the save file's path
      */
-    Rom( char* buffer, uint32_t bufferSize, bool ram, bool battery, std::string savePath );
+    Rom( RomImage* image, bool ram, bool battery, std::string savePath );
 
     /**
-     * If this cartridge is battery-buffered, try loading 
-     * the save file.
+     * If this cartridge is battery-buffered, map the save file as its
+     * RAM and extra state, creating the file if there is none.
      */
     virtual void loadSave( void );
     
@@ -58,6 +110,24 @@ protected:
      * Sets the RAM size based on the cartridge header.
      */
     void setRAMSize( void );
+
+    /**
+     * Records and notifies the bus and block cache that a new ROM bank is
+     * mapped to 0x4000-0x7FFF.
+     * @param bank the bank number
+     */
+    void switchBank( uint16_t bank );
+
+    // switchRamBank() values that map no RAM: either reads return 0xFF,
+    // or accesses go to the cartridge's registers through access()
+    static const int c_ramDisabled = -1;
+    static const int c_ramRegisters = -2;
+
+    /**
+     * Maps a RAM bank to 0xA000-0xBFFF and notifies the bus.
+     * @param bank the bank number, c_ramDisabled or c_ramRegisters
+     */
+    void switchRamBank( int bank );
     
     // the ROM's save file
     std::string m_savePath;
@@ -71,9 +141,39 @@ protected:
     // external RAM
     uint8_t* mp_ramArray;
     unsigned int m_ramSize;
+
+    // battery-backed state saved after RAM, e.g. the MBC3 clock. Set the
+    // size before loadSave().
+    uint8_t* mp_saveExtra;
+    unsigned int m_saveExtraSize;
+
+    // the save file mapped as RAM followed by the extra state, or NULL if
+    // they are on the heap
+    uint8_t* mp_saveMap;
     
-    // the cartridge data
-    char* mp_buffer; uint32_t m_bufferSize;
+    // the cartridge data, shared with other cartridges of the same file
+    RomImage* mp_image;
+    const char* mp_buffer; uint32_t m_bufferSize;
+
+    // the CPU's block cache
+    BlockCache* mp_blockCache;
+
+    // the ROM bank mapped to 0x4000-0x7FFF
+    uint16_t m_bank;
+
+    // the data of the ROM bank mapped to 0x4000-0x7FFF and the RAM bank
+    // mapped to 0xA000-0xBFFF, or NULL if none
+    const char* mp_romBank;
+    uint8_t* mp_ramBank;
+
+    // whether the cartridge's registers are mapped instead of RAM
+    bool m_ramRegisters;
+
+    // what disabled RAM reads as
+    uint8_t m_openBus[ 0x100 ];
+
+    // the bus
+    Bus* mp_bus;
 
     // MBC type
     typedef enum
@@ -88,8 +188,17 @@ protected:
 	C_MBC3_RAM             = 0x12,
 	C_MBC3_RAM_BATTERY     = 0x13,
 	C_MBC3_TIM_BATTERY     = 0x0F,
-	C_MBC3_TIM_RAM_BATTERY = 0x10
+	C_MBC3_TIM_RAM_BATTERY = 0x10,
+	C_MBC2                 = 0x05,
+	C_MBC2_BATTERY         = 0x06,
+	C_MBC5                 = 0x19,
+	C_MBC5_RAM             = 0x1A,
+	C_MBC5_RAM_BATTERY     = 0x1B,
+	C_MBC5_RUMBLE          = 0x1C,
+	C_MBC5_RUMBLE_RAM      = 0x1D,
+	C_MBC5_RUMBLE_RAM_BATTERY = 0x1E
     } MBCType;
     
     static const uint16_t c_pageSize = 0x4000;
+    static const uint16_t c_ramBankSize = 0x2000;
 };
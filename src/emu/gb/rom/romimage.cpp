@@ -0,0 +1,113 @@
+#include "romimage.h"
+
+#include <map>
+#include <mutex>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// every loaded image, keyed by path and contents
+static std::map<std::pair<std::string, uint64_t>, RomImage*> images;
+static std::mutex imagesMutex;
+
+RomImage::RomImage( const char* data, uint32_t size, std::string path, uint64_t hash )
+    : mp_data( data ),
+      m_size( size ),
+      m_path( path ),
+      m_hash( hash ),
+      m_references( 1 )
+{
+}
+
+RomImage::~RomImage( void )
+{
+    if( mp_data != NULL )
+    {
+	munmap( (void*)mp_data, m_size );
+	mp_data = NULL;
+    }
+}
+
+RomImage* RomImage::Acquire( std::string path )
+{
+    int fd = open( path.c_str(), O_RDONLY );
+    if( fd < 0 ) { return NULL; }
+
+    struct stat info;
+    if( (fstat( fd, &info ) != 0) || (info.st_size == 0) )
+    {
+	close( fd );
+	return NULL;
+    }
+
+    // the mapping stays valid after the file is closed
+    uint32_t size = (uint32_t)info.st_size;
+    void* data = mmap( NULL, size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    close( fd );
+
+    if( data == MAP_FAILED ) { return NULL; }
+
+    // banks are read in as they are used, so don't read ahead
+    madvise( data, size, MADV_RANDOM );
+
+    uint64_t hash = Hash( (const char*)data, size, (uint64_t)info.st_mtime );
+
+    std::lock_guard<std::mutex> lock( imagesMutex );
+
+    auto it = images.find( std::make_pair( path, hash ) );
+    if( it != images.end() )
+    {
+	munmap( data, size );
+	it->second->m_references++;
+	return it->second;
+    }
+
+    RomImage* image = new RomImage( (const char*)data, size, path, hash );
+    images[ std::make_pair( path, hash ) ] = image;
+    return image;
+}
+
+void RomImage::release( void )
+{
+    std::lock_guard<std::mutex> lock( imagesMutex );
+
+    m_references--;
+    if( m_references > 0 ) { return; }
+
+    images.erase( std::make_pair( m_path, m_hash ) );
+    delete this;
+}
+
+const char* RomImage::getData( void )
+{
+    return mp_data;
+}
+
+uint32_t RomImage::getSize( void )
+{
+    return m_size;
+}
+
+uint64_t RomImage::Hash( const char* data, uint32_t size, uint64_t modified )
+{
+    uint64_t hash = 0xCBF29CE484222325ULL;
+
+    // 0x0100-0x014F, including the header and global checksums
+    for( uint32_t i = 0x100; (i < 0x150) && (i < size); i++ )
+    {
+	hash ^= (uint8_t)data[ i ];
+	hash *= 0x100000001B3ULL;
+    }
+
+    uint64_t values[ 2 ] = { size, modified };
+    for( unsigned int i = 0; i < 2; i++ )
+    {
+	hash ^= values[ i ];
+	hash *= 0x100000001B3ULL;
+    }
+
+    return hash;
+}
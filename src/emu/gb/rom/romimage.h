@@ -0,0 +1,79 @@
+#pragma once
+
+#include <string>
+
+#include <stdint.h>
+
+/**
+ * @author Rick Hallman
+ * A ROM file mapped read-only into memory.
+ *
+ * Images are shared by every cartridge in the process: acquiring a file
+ * whose path and contents match an image already loaded returns that image
+ * instead of mapping the file again. Each image is unmapped when its last
+ * reference is released.
+ *
+ * Pages of the file are only read in when a bank is first accessed, so
+ * contents are identified by the cartridge header (which holds the global
+ * checksum), the file's size and its modification time rather than by
+ * reading the whole file.
+ */
+class RomImage
+{
+public:
+
+    /**
+     * Gets the image of a ROM file, mapping it if it is not loaded.
+     * @param path the path to the file
+     * @return the image, or NULL if failed
+     */
+    static RomImage* Acquire( std::string path );
+
+    /**
+     * Releases a reference to this image, unmapping it if it was the
+     * last one.
+     */
+    void release( void );
+
+    /**
+     * Accessor method for the file's contents.
+     */
+    const char* getData( void );
+
+    /**
+     * Accessor method for the file's size.
+     */
+    uint32_t getSize( void );
+
+private:
+
+    /**
+     * Constructor (called by Acquire).
+     * @param data the mapped file
+     * @param size the file's size
+     * @param path the file's path
+     * @param hash the fingerprint of the file's contents
+     */
+    RomImage( const char* data, uint32_t size, std::string path, uint64_t hash );
+    ~RomImage( void );
+
+    /**
+     * Fingerprints a file's contents by hashing its cartridge header,
+     * size and modification time (64-bit FNV-1a).
+     * @param data the contents
+     * @param size the size of the contents
+     * @param modified the file's modification time
+     * @return the fingerprint
+     */
+    static uint64_t Hash( const char* data, uint32_t size, uint64_t modified );
+
+    const char* mp_data;
+    uint32_t m_size;
+
+    // the image's key in the cache
+    std::string m_path;
+    uint64_t m_hash;
+
+    // the number of cartridges using this image
+    unsigned int m_references;
+};
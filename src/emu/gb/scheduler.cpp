@@ -0,0 +1,132 @@
+#include "scheduler.h"
+
+Scheduler::Scheduler( void )
+    : m_cycles( 0 ),
+      m_start( 0 ),
+      m_prevStart( 0 )
+{
+    // every event stays in the heap; unscheduled events sort last
+    for( unsigned int i = 0; i < C_EVENT_COUNT; i++ )
+    {
+	m_deadlines[ i ] = c_never;
+	m_heap[ i ] = i;
+	m_positions[ i ] = i;
+    }
+}
+
+Scheduler::~Scheduler( void )
+{
+}
+
+uint64_t Scheduler::getCycles( void )
+{
+    return m_cycles;
+}
+
+uint64_t Scheduler::getInstructionStart( void )
+{
+    return m_start;
+}
+
+uint64_t Scheduler::getPreviousInstructionStart( void )
+{
+    return m_prevStart;
+}
+
+void Scheduler::advance( uint32_t ticks )
+{
+    m_prevStart = m_start;
+    m_start = m_cycles;
+    m_cycles += ticks;
+}
+
+void Scheduler::skip( uint32_t ticks )
+{
+    m_prevStart += ticks;
+    m_start += ticks;
+    m_cycles += ticks;
+}
+
+uint64_t Scheduler::getNextDeadline( void )
+{
+    return m_deadlines[ m_heap[0] ];
+}
+
+bool Scheduler::isDue( void )
+{
+    return m_deadlines[ m_heap[0] ] <= m_cycles;
+}
+
+bool Scheduler::popDueEvent( Event& event )
+{
+    if( this->isDue() == false ) { return false; }
+
+    event = (Event)m_heap[0];
+    m_deadlines[ event ] = c_never;
+    this->siftDown( 0 );
+
+    return true;
+}
+
+void Scheduler::schedule( Event event, uint64_t when )
+{
+    uint64_t prev = m_deadlines[ event ];
+    m_deadlines[ event ] = when;
+
+    if( when < prev ) { this->siftUp( m_positions[ event ] ); }
+    else { this->siftDown( m_positions[ event ] ); }
+}
+
+void Scheduler::cancel( Event event )
+{
+    this->schedule( event, c_never );
+}
+
+bool Scheduler::before( unsigned int a, unsigned int b )
+{
+    uint64_t first = m_deadlines[ m_heap[ a ] ];
+    uint64_t second = m_deadlines[ m_heap[ b ] ];
+
+    // ties run in event order
+    if( first == second ) { return m_heap[ a ] < m_heap[ b ]; }
+    return first < second;
+}
+
+void Scheduler::swap( unsigned int a, unsigned int b )
+{
+    uint8_t event = m_heap[ a ];
+    m_heap[ a ] = m_heap[ b ];
+    m_heap[ b ] = event;
+
+    m_positions[ m_heap[ a ] ] = a;
+    m_positions[ m_heap[ b ] ] = b;
+}
+
+void Scheduler::siftUp( unsigned int index )
+{
+    while( index > 0 )
+    {
+	unsigned int parent = ( index - 1 ) / 2;
+	if( this->before( index, parent ) == false ) { break; }
+
+	this->swap( index, parent );
+	index = parent;
+    }
+}
+
+void Scheduler::siftDown( unsigned int index )
+{
+    while( true )
+    {
+	unsigned int first = index;
+	unsigned int left = ( 2 * index ) + 1;
+	unsigned int right = left + 1;
+
+	if( (left < C_EVENT_COUNT) && this->before( left, first ) ) { first = left; }
+	if( (right < C_EVENT_COUNT) && this->before( right, first ) ) { first = right; }
+	if( first == index ) { break; }
+
+	this->swap( index, first );
+	index = first;
+    }
+}
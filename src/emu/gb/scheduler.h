@@ -0,0 +1,140 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * @author Rick Hallman
+ * Keeps the master cycle count and the deadline of every hardware event.
+ *
+ * Each piece of hardware schedules the cycle at which it next needs to be
+ * updated. Events are kept in a binary heap ordered by deadline, so after
+ * each instruction only the earliest deadline is compared against the
+ * cycle count. Hardware that has nothing to do is never polled.
+ */
+class Scheduler
+{
+public:
+
+    typedef enum
+    {
+	// events due at the same cycle run in this order
+	C_EVENT_LCD_WRITE,
+	C_EVENT_LCD_STATUS,
+	C_EVENT_LCD_LINE,
+	C_EVENT_TIMER,
+	C_EVENT_DMA,
+	C_EVENT_JOYPAD,
+	C_EVENT_SAVE,
+	C_EVENT_COUNT
+    } Event;
+
+    // the deadline of an event that is not scheduled
+    static const uint64_t c_never = 0xFFFFFFFFFFFFFFFFULL;
+
+    Scheduler( void );
+    ~Scheduler( void );
+
+    /**
+     * Gets the number of cycles run so far.
+     * @return the cycle count
+     */
+    uint64_t getCycles( void );
+
+    /**
+     * Gets the cycle at which the last instruction started.
+     * @return the cycle
+     */
+    uint64_t getInstructionStart( void );
+
+    /**
+     * Gets the cycle at which the instruction before the last one started.
+     * @return the cycle
+     */
+    uint64_t getPreviousInstructionStart( void );
+
+    /**
+     * Advances the cycle count past an instruction.
+     * @param ticks the number of ticks the instruction took
+     */
+    void advance( uint32_t ticks );
+
+    /**
+     * Moves every timestamp forward without running an instruction. Only
+     * valid for fewer ticks than remain until the next deadline.
+     * @param ticks the number of ticks to skip
+     */
+    void skip( uint32_t ticks );
+
+    /**
+     * Gets the earliest deadline of any event.
+     * @return the deadline, or c_never if nothing is scheduled
+     */
+    uint64_t getNextDeadline( void );
+
+    /**
+     * Whether or not any event is due.
+     * @return true if yes, false otherwise
+     */
+    bool isDue( void );
+
+    /**
+     * Removes the earliest event if it is due.
+     * @param event set to the event that is due
+     * @return true if an event was due, false otherwise
+     */
+    bool popDueEvent( Event& event );
+
+    /**
+     * Schedules an event, replacing its previous deadline.
+     * @param event the event
+     * @param when the cycle at which the event is due
+     */
+    void schedule( Event event, uint64_t when );
+
+    /**
+     * Removes an event's deadline.
+     * @param event the event
+     */
+    void cancel( Event event );
+
+private:
+
+    /**
+     * Whether or not one heap entry must run before another.
+     * @param a the first entry's index in the heap
+     * @param b the second entry's index in the heap
+     * @return true if yes, false otherwise
+     */
+    bool before( unsigned int a, unsigned int b );
+
+    /**
+     * Swaps two heap entries.
+     * @param a the first entry's index in the heap
+     * @param b the second entry's index in the heap
+     */
+    void swap( unsigned int a, unsigned int b );
+
+    /**
+     * Moves an entry towards the root until the heap is ordered.
+     * @param index the entry's index in the heap
+     */
+    void siftUp( unsigned int index );
+
+    /**
+     * Moves an entry towards the leaves until the heap is ordered.
+     * @param index the entry's index in the heap
+     */
+    void siftDown( unsigned int index );
+
+    // the cycle count and the start of the last two instructions
+    uint64_t m_cycles;
+    uint64_t m_start;
+    uint64_t m_prevStart;
+
+    // the deadline of each event
+    uint64_t m_deadlines[ C_EVENT_COUNT ];
+
+    // events ordered by deadline, and each event's index in the heap
+    uint8_t m_heap[ C_EVENT_COUNT ];
+    uint8_t m_positions[ C_EVENT_COUNT ];
+};
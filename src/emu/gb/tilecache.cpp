@@ -0,0 +1,46 @@
+#include "tilecache.h"
+#include "bus.h"
+
+TileCache::TileCache( Bus* bus )
+    : mp_bus( bus )
+{
+    for( unsigned int tile = 0; tile < c_tiles; tile++ ) { m_stale[ tile ] = true; }
+}
+
+TileCache::~TileCache( void )
+{
+}
+
+const uint8_t* TileCache::getRow( uint16_t tile, uint8_t line )
+{
+    if( m_stale[ tile ] ) { this->decode( tile ); }
+    return m_tiles[ tile ][ line ];
+}
+
+void TileCache::invalidate( uint16_t addr )
+{
+    // each tile is 16 bytes
+    m_stale[ (addr - c_start) >> 4 ] = true;
+}
+
+void TileCache::decode( uint16_t tile )
+{
+    uint8_t data[ 16 ];
+    mp_bus->readSpan( c_start + (tile * 16), data, 16 );
+
+    for( unsigned int line = 0; line < 8; line++ )
+    {
+	// each row is a byte of low bits followed by a byte of high bits
+	uint8_t low = data[ line * 2 ];
+	uint8_t high = data[ (line * 2) + 1 ];
+
+	for( unsigned int pixel = 0; pixel < 8; pixel++ )
+	{
+	    unsigned int bit = 7 - pixel;
+	    m_tiles[ tile ][ line ][ pixel ] =
+		( BIT( high, bit ) ? 2 : 0 ) + ( BIT( low, bit ) ? 1 : 0 );
+	}
+    }
+
+    m_stale[ tile ] = false;
+}
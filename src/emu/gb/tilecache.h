@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdint.h>
+
+class Bus;
+
+/**
+ * @author Rick Hallman
+ * Stores the tiles in VRAM (0x8000-0x97FF) decoded into rows of 2-bit
+ * color indices, leftmost pixel first.
+ *
+ * Writes to tile data only mark the written tile as stale, and a stale
+ * tile is decoded again the next time one of its rows is drawn, so tiles
+ * that are rewritten several times per frame are decoded once.
+ */
+class TileCache
+{
+public:
+
+    static const uint16_t c_start = 0x8000;
+    static const uint16_t c_end = 0x97FF;
+
+    // the number of tiles in VRAM
+    static const unsigned int c_tiles = 384;
+
+    /**
+     * Constructor.
+     * @param bus the bus VRAM is read from
+     */
+    TileCache( Bus* bus );
+    ~TileCache( void );
+
+    /**
+     * Gets a row of a tile, decoding the tile if it was written since
+     * it was last decoded.
+     * @param tile the tile's number (0-383), counted from 0x8000
+     * @param line the row (0-7)
+     * @return the row's 8 color indices
+     */
+    const uint8_t* getRow( uint16_t tile, uint8_t line );
+
+    /**
+     * Called when tile data is written.
+     * @param addr the address written to (0x8000-0x97FF)
+     */
+    void invalidate( uint16_t addr );
+
+private:
+
+    /**
+     * Decodes a tile from VRAM.
+     * @param tile the tile's number
+     */
+    void decode( uint16_t tile );
+
+    Bus* mp_bus;
+
+    // each tile's decoded rows
+    uint8_t m_tiles[ c_tiles ][ 8 ][ 8 ];
+
+    // whether a tile was written since it was decoded
+    bool m_stale[ c_tiles ];
+};
@@ -0,0 +1,153 @@
+#include "timer.h"
+#include "bus.h"
+#include "scheduler.h"
+#include "z80.h"
+
+// game boy runs at 4194304 Hz: 4096, 262144, 65536 and 16384 Hz
+const uint32_t Timer::c_periods[ 4 ] = { 1024, 16, 64, 256 };
+
+Timer::Timer( Bus* bus )
+    : MemoryDevice( c_start, c_end ),
+      mp_bus( bus ),
+      mp_scheduler( NULL ),
+      m_reset( 0 ),
+      m_sync( 0 ),
+      m_tima( 0x00 ),
+      m_tma( 0x00 ),
+      m_tac( 0x00 )
+{
+}
+
+Timer::~Timer( void )
+{
+}
+
+void Timer::access( uint16_t addr, uint8_t& data, bool write )
+{
+    if( write == READ )
+    {
+	switch( addr )
+	{
+	case 0xFF04: // DIV
+	    data = (uint8_t)( (this->getCycles() - m_reset) >> 8 ); break;
+	case 0xFF05: // TIMA
+	    this->sync();
+	    data = m_tima; break;
+	case 0xFF06: // TMA
+	    data = m_tma; break;
+	case 0xFF07: // TAC
+	default:
+	    data = m_tac; break;
+	}
+
+	return;
+    }
+
+    this->sync();
+
+    // resetting the counter, selecting a different bit or stopping
+    // the timer can make the selected bit fall, which increments TIMA
+    bool signal = this->getSignal( m_tac );
+
+    switch( addr )
+    {
+    case 0xFF04: // DIV
+	m_reset = m_sync; break;
+    case 0xFF05: // TIMA
+	m_tima = data; break;
+    case 0xFF06: // TMA
+	m_tma = data; break;
+    case 0xFF07: // TAC
+    default:
+	m_tac = data; break;
+    }
+
+    if( signal && (this->getSignal( m_tac ) == false) ) { this->increment( 1 ); }
+
+    this->scheduleOverflow();
+}
+
+bool Timer::isVolatile( uint16_t addr )
+{
+    // DIV and TIMA change without being written
+    return addr <= 0xFF05;
+}
+
+void Timer::setScheduler( Scheduler* scheduler )
+{
+    mp_scheduler = scheduler;
+    this->scheduleOverflow();
+}
+
+void Timer::handleOverflow( void )
+{
+    this->sync();
+    this->scheduleOverflow();
+}
+
+uint64_t Timer::getCycles( void )
+{
+    if( mp_scheduler == NULL ) { return 0; }
+    return mp_scheduler->getCycles();
+}
+
+void Timer::sync( void )
+{
+    uint64_t now = this->getCycles();
+
+    if( BIT( m_tac, 2 ) )
+    {
+	// count the falling edges since the last update
+	uint32_t t = c_periods[ m_tac & 0x03 ];
+	this->increment( ((now - m_reset) / t) - ((m_sync - m_reset) / t) );
+    }
+
+    m_sync = now;
+}
+
+void Timer::increment( uint64_t count )
+{
+    while( count > 0 )
+    {
+	uint32_t room = 0x100 - m_tima;
+	if( count < room )
+	{
+	    m_tima += count;
+	    return;
+	}
+
+	// trigger timer interrupt if overflow
+	count -= room;
+	m_tima = m_tma;
+
+	uint8_t ifReg;
+	mp_bus->defaultAccess( 0xFF0F, ifReg, READ );
+	ifReg = ifReg | Z80::c_timer;
+	mp_bus->defaultAccess( 0xFF0F, ifReg, WRITE );
+    }
+}
+
+bool Timer::getSignal( uint8_t tac )
+{
+    if( BIT( tac, 2 ) == false ) { return false; }
+
+    // the selected bit is the one below the period
+    uint32_t t = c_periods[ tac & 0x03 ];
+    return ( (m_sync - m_reset) & (t / 2) ) != 0;
+}
+
+void Timer::scheduleOverflow( void )
+{
+    if( mp_scheduler == NULL ) { return; }
+
+    if( BIT( m_tac, 2 ) == false )
+    {
+	mp_scheduler->cancel( Scheduler::C_EVENT_TIMER );
+	return;
+    }
+
+    // TIMA overflows on the falling edge that takes it past 0xFF
+    uint32_t t = c_periods[ m_tac & 0x03 ];
+    uint64_t edges = ( (m_sync - m_reset) / t ) + ( 0x100 - m_tima );
+    mp_scheduler->schedule( Scheduler::C_EVENT_TIMER, m_reset + (edges * t) );
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include "devices.h"
+
+#include <stdint.h>
+
+class Bus;
+class Scheduler;
+
+/**
+ * @author Rick Hallman
+ * This class represents the divider and timer registers (DIV, TIMA, TMA
+ * and TAC) as a memory device.
+ *
+ * DIV is the top byte of a 16-bit counter that runs with the master cycle
+ * count, and TIMA increments on the falling edge of the counter bit
+ * selected by TAC. Both are calculated from the cycle count only when
+ * they are accessed. The only scheduled event is TIMA's next overflow,
+ * which requests the timer interrupt.
+ */
+class Timer : public MemoryDevice
+{
+public:
+
+    static const uint16_t c_start = 0xFF04;
+    static const uint16_t c_end = 0xFF07;
+
+    /**
+     * Constructor.
+     * @param bus the device's bus
+     */
+    Timer( Bus* bus );
+    virtual ~Timer( void );
+
+    virtual void access( uint16_t addr, uint8_t& data, bool write );
+
+    virtual bool isVolatile( uint16_t addr );
+
+    /**
+     * Sets the scheduler that provides the cycle count and is told
+     * when TIMA next overflows.
+     * @param scheduler the hardware event scheduler
+     */
+    void setScheduler( Scheduler* scheduler );
+
+    /**
+     * Called when TIMA is due to overflow.
+     */
+    void handleOverflow( void );
+
+private:
+
+    /**
+     * Gets the current cycle count.
+     * @return the cycle count
+     */
+    uint64_t getCycles( void );
+
+    /**
+     * Brings TIMA up to date with the current cycle count.
+     */
+    void sync( void );
+
+    /**
+     * Increments TIMA, reloading it from TMA and requesting the timer
+     * interrupt if it overflows.
+     * @param count the number of increments
+     */
+    void increment( uint64_t count );
+
+    /**
+     * Whether or not the counter bit selected by TAC is set while the timer
+     * is running. TIMA increments when this falls.
+     * @param tac the timer control value
+     * @return true if yes, false otherwise
+     */
+    bool getSignal( uint8_t tac );
+
+    /**
+     * Schedules TIMA's next overflow.
+     */
+    void scheduleOverflow( void );
+
+    // ticks between TIMA increments, indexed by TAC's clock select
+    static const uint32_t c_periods[ 4 ];
+
+    Bus* mp_bus;
+    Scheduler* mp_scheduler;
+
+    // the cycle at which the counter was last reset
+    uint64_t m_reset;
+
+    // the cycle TIMA was last brought up to date at
+    uint64_t m_sync;
+
+    uint8_t m_tima, m_tma, m_tac;
+};
@@ -1,23 +1,64 @@
 #include "z80.h"
 #include "bus.h"
+#include "alutables.h"
 
 #include <iostream>
 
+// Expands m once for every opcode from 0x00 to 0xFF
+#define Z80_OPCODE_ROW( m, h )						\
+    m( 0x##h##0 ) m( 0x##h##1 ) m( 0x##h##2 ) m( 0x##h##3 )		\
+    m( 0x##h##4 ) m( 0x##h##5 ) m( 0x##h##6 ) m( 0x##h##7 )		\
+    m( 0x##h##8 ) m( 0x##h##9 ) m( 0x##h##A ) m( 0x##h##B )		\
+    m( 0x##h##C ) m( 0x##h##D ) m( 0x##h##E ) m( 0x##h##F )
+#define Z80_OPCODES( m )						\
+    Z80_OPCODE_ROW( m, 0 ) Z80_OPCODE_ROW( m, 1 ) Z80_OPCODE_ROW( m, 2 )	\
+    Z80_OPCODE_ROW( m, 3 ) Z80_OPCODE_ROW( m, 4 ) Z80_OPCODE_ROW( m, 5 )	\
+    Z80_OPCODE_ROW( m, 6 ) Z80_OPCODE_ROW( m, 7 ) Z80_OPCODE_ROW( m, 8 )	\
+    Z80_OPCODE_ROW( m, 9 ) Z80_OPCODE_ROW( m, A ) Z80_OPCODE_ROW( m, B )	\
+    Z80_OPCODE_ROW( m, C ) Z80_OPCODE_ROW( m, D ) Z80_OPCODE_ROW( m, E )	\
+    Z80_OPCODE_ROW( m, F )
+
+// flag tables for the 8-bit ALU
+static constexpr AluTables c_alu = makeAluTables();
+
+// dispatch table entries
+#define Z80_OPCODE_HANDLER( n ) &Z80::executeOpcode<n>,
+#define Z80_CB_OPCODE_HANDLER( n ) &Z80::executeCBOpcode<n>,
+
+// computed goto labels and targets (THREADED_DISPATCH)
+#define Z80_OPCODE_LABEL( n ) &&op_##n,
+#define Z80_OPCODE_TARGET( n )				\
+    op_##n: ticks = this->executeOpcode<n>(); goto dispatched;
+
 Z80::Z80( Bus* bus ) :
     mp_bus( bus ),
+    mp_blockCache( new BlockCache() ),
+    mp_block( NULL ),
+    m_blockGeneration( 0 ),
+    m_blockIndex( 0 ),
+    m_instructionTicks( 0 ),
+    m_operandIndex( 0 ),
     m_halting( false ),
-    m_pc( 0x100 ),
-    m_sp( 0xFFFE ),
-    m_a( 0x01 ),
-    m_b( 0x00 ),
-    m_c( 0x13 ),
-    m_d( 0x00 ),
-    m_e( 0xD8 ),
-    m_h( 0x01 ),
-    m_l( 0x4D ),
-    m_flags( 0xB0 ),
-    m_ime( true )
-{
+    m_ime( true ),
+    m_loopRegs(),
+    m_loopIme( false ),
+    m_loopWrites( 0 ),
+    m_loopTicks( 0 ),
+    m_idleLoopTicks( 0 ),
+    m_flagOp( C_FLAGS_EVALUATED ),
+    m_flagResult( 0x00 ),
+    m_flagPrev( 0x00 ),
+    m_flagDelta( 0x00 ),
+    m_flagCarry( false )
+{
+    // Initialize registers to post-startup values
+    m_regs.af = 0x01B0;
+    m_regs.bc = 0x0013;
+    m_regs.de = 0x00D8;
+    m_regs.hl = 0x014D;
+    m_regs.sp = 0xFFFE;
+    m_regs.pc = 0x0100;
+
     // Initialize memory to post-startup values    
     mp_bus->write( 0xFF05, 0x00 );
     mp_bus->write( 0xFF06, 0x00 );
@@ -50,88 +91,106 @@ Z80::Z80( Bus* bus ) :
     mp_bus->write( 0xFF4A, 0x00 );
     mp_bus->write( 0xFF4B, 0x00 );
     mp_bus->write( 0xFFFF, 0x00 );
+
+    mp_bus->setBlockCache( mp_blockCache );
+
+#ifdef DYNAREC_ENABLED
+    mp_dynarec = new Dynarec( this );
+#endif
 }
 
 Z80::~Z80( void )
 {
+#ifdef DYNAREC_ENABLED
+    delete mp_dynarec; mp_dynarec = NULL;
+#endif
+
+    mp_bus->setBlockCache( NULL );
+    delete mp_blockCache; mp_blockCache = NULL;
 }
 
 uint16_t Z80::getPC( void )
 {
-    return m_pc;
+    return m_regs.pc;
+}
+
+const Registers& Z80::getRegisters( void )
+{
+    // flags are only calculated when read
+    this->evaluateFlags();
+    return m_regs;
+}
+
+bool Z80::isHalting( void )
+{
+    return m_halting;
+}
+
+uint32_t Z80::getIdleLoopTicks( void )
+{
+    // hardware may have changed memory since the loop went around
+    if( mp_bus->getWriteCount() != m_loopWrites ) { return 0; }
+    
+    return m_idleLoopTicks;
 }
 
 void Z80::printStatus( void )
 {
     using namespace std;
 
-    cout << "AF: " << hex << (int)(this->get2ByteRegValue( m_a, m_flags )) << endl
-	 << "BC: " << hex << (int)(this->get2ByteRegValue( m_b, m_c )) << endl
-	 << "DE: " << hex << (int)(this->get2ByteRegValue( m_d, m_e )) << endl
-	 << "HL: " << hex << (int)(this->get2ByteRegValue( m_h, m_l )) << endl
-	 << "SP: " << hex << (int)(m_sp) << endl
-	 << "PC: " << hex << (int)(m_pc) << endl
+    cout << "AF: " << hex << (int)(( m_regs.a << 8 ) | this->getFlags()) << endl
+	 << "BC: " << hex << (int)(m_regs.bc) << endl
+	 << "DE: " << hex << (int)(m_regs.de) << endl
+	 << "HL: " << hex << (int)(m_regs.hl) << endl
+	 << "SP: " << hex << (int)(m_regs.sp) << endl
+	 << "PC: " << hex << (int)(m_regs.pc) << endl
 	 << endl;
 }
 
-uint8_t Z80::executeNextInstruction( void )
+template <uint8_t opcode>
+uint8_t Z80::executeOpcode( void )
 {
-    using std::cout;
-    using std::hex;
-    using std::endl;
-
     uint8_t ticks = 4;
-    uint8_t opcode = 0x00;
-
-    // only fetch next instruction if not halting
-    if( m_halting == false ) { opcode = this->fetchNextInstruction(); }
-    else
-    {
-	// check for interrupts
-	this->checkInterrupts();
-	return 4;
-    }
 
-    if( opcode == 0xCB )
+    if constexpr( opcode == 0xCB )
     {
 	// CB-prefixed opcodes
-	loadImm8( opcode );
-	ticks = this->executeCBInstruction( opcode );
+	ticks = (this->*c_cbOpcodeTable[ m_operands[ 0 ] ])();
     }
-    else if( (opcode >= 0x40) && (opcode <= 0x7F) &&
-	(opcode != 0x76 ) )
+    else if constexpr( (opcode >= 0x40) && (opcode <= 0x7F) &&
+		       (opcode != 0x76 ) )
     {
 	ticks = this->executeGroup4x( opcode );
     }
-    else if( ((opcode >= 0x80) && (opcode <= 0x8F)) ||
-	(opcode == 0xC6) ||
-	(opcode == 0xCE) )
+    else if constexpr( ((opcode >= 0x80) && (opcode <= 0x8F)) ||
+		       (opcode == 0xC6) ||
+		       (opcode == 0xCE) )
     {
 	ticks = this->executeGroup8x( opcode );
     }
-    else if( ((opcode >= 0x90) && (opcode <= 0x9F)) ||
-	(opcode == 0xD6) ||
-	(opcode == 0xDE) )
+    else if constexpr( ((opcode >= 0x90) && (opcode <= 0x9F)) ||
+		       (opcode == 0xD6) ||
+		       (opcode == 0xDE) )
     {
 	ticks = this->executeGroup9x( opcode );
     }
-    else if( ((opcode >= 0xA0) && (opcode <= 0xA7)) ||
-	(opcode == 0xE6) )
+    else if constexpr( ((opcode >= 0xA0) && (opcode <= 0xA7)) ||
+		       (opcode == 0xE6) )
     {
 	ticks = this->executeGroupAx0( opcode );
     }
-    else if( ((opcode >= 0xA8) && (opcode <= 0xAF)) ||
-	(opcode == 0xEE) )
+    else if constexpr( ((opcode >= 0xA8) && (opcode <= 0xAF)) ||
+		       (opcode == 0xEE) )
     {
 	ticks = this->executeGroupAx8( opcode );
     }
-    else if( ((opcode >= 0xB0) && (opcode <= 0xB7)) ||
-	(opcode == 0xF6) )
+    else if constexpr( ((opcode >= 0xB0) && (opcode <= 0xB7)) ||
+		       (opcode == 0xF6) )
     {
 	ticks = this->executeGroupBx0( opcode );
     }
-    else if( ((opcode >= 0xB8) && (opcode <= 0xBF)) ||
-	(opcode == 0xFE) )
+    else if constexpr( ((opcode >= 0xB8) && (opcode <= 0xBF)) ||
+		       (opcode == 0xFE) )
     {
 	ticks = this->executeGroupBx8( opcode );
     }
@@ -140,22 +199,22 @@ uint8_t Z80::executeNextInstruction( void )
 	switch( opcode )
 	{
 	case 0x01: // LD BC,d16
-	    ticks = this->loadImm16( m_b, m_c );
+	    ticks = this->loadImm16( m_regs.bc );
 	    break;
 	case 0x02: // LD (BC),A
-	    ticks = this->loadFromA( m_b, m_c );
+	    ticks = this->loadFromA( m_regs.bc );
 	    break;
 	case 0x03: // INC BC
-	    ticks = this->incReg( m_b, m_c );
+	    ticks = this->incReg( m_regs.bc );
 	    break;
 	case 0x04: // INC B
-	    ticks = this->incReg( m_b );
+	    ticks = this->incReg( m_regs.b );
 	    break;
 	case 0x05: // DEC B
-	    ticks = this->decReg( m_b );
+	    ticks = this->decReg( m_regs.b );
 	    break;
 	case 0x06: // LD B,d8
-	    ticks = this->loadImm8( m_b );
+	    ticks = this->loadImm8( m_regs.b );
 	    break;
 	case 0x07: // RLCA
 	    ticks = this->rlca();
@@ -164,22 +223,22 @@ uint8_t Z80::executeNextInstruction( void )
 	    ticks = this->loadSPToA16();
 	    break;
 	case 0x09: // ADD HL,BC
-	    ticks = this->addToHL( m_b, m_c );
+	    ticks = this->addToHL( m_regs.bc );
 	    break;
 	case 0x0A: // LD A,(BC)
-	    ticks = this->loadToA( m_b, m_c );
+	    ticks = this->loadToA( m_regs.bc );
 	    break;
 	case 0x0B: // DEC BC
-	    ticks = this->decReg( m_b, m_c );
+	    ticks = this->decReg( m_regs.bc );
 	    break;
 	case 0x0C: // INC C
-	    ticks = this->incReg( m_c ); 
+	    ticks = this->incReg( m_regs.c ); 
 	    break;
 	case 0x0D: // DEC C
-	    ticks = this->decReg( m_c );
+	    ticks = this->decReg( m_regs.c );
 	    break;
 	case 0x0E: // LD C,d8
-	    ticks = this->loadImm8( m_c );
+	    ticks = this->loadImm8( m_regs.c );
 	    break;
 	case 0x0F: // RRCA
 	    ticks = this->rrca();
@@ -188,22 +247,22 @@ uint8_t Z80::executeNextInstruction( void )
 	    // TODO: unimplemented
 	    break;
 	case 0x11: // LD DE,d16
-	    ticks = this->loadImm16( m_d, m_e );
+	    ticks = this->loadImm16( m_regs.de );
 	    break;
 	case 0x12: // LD (DE),A
-	    ticks = this->loadFromA( m_d, m_e );
+	    ticks = this->loadFromA( m_regs.de );
 	    break;
 	case 0x13: // INC DE
-	    ticks = this->incReg( m_d, m_e );
+	    ticks = this->incReg( m_regs.de );
 	    break;
 	case 0x14: // INC D
-	    ticks = this->incReg( m_d );
+	    ticks = this->incReg( m_regs.d );
 	    break;
 	case 0x15: // DEC D
-	    ticks = this->decReg( m_d );
+	    ticks = this->decReg( m_regs.d );
 	    break;
 	case 0x16: // LD D,d8
-	    ticks = this->loadImm8( m_d );
+	    ticks = this->loadImm8( m_regs.d );
 	    break;
 	case 0x17: // RLA
 	    ticks = this->rla();
@@ -212,22 +271,22 @@ uint8_t Z80::executeNextInstruction( void )
 	    ticks = this->jrr8();
 	    break;
 	case 0x19: // ADD HL,DE
-	    ticks = this->addToHL( m_d, m_e );
+	    ticks = this->addToHL( m_regs.de );
 	    break;
 	case 0x1A: // LD A,(DE)
-	    ticks = this->loadToA( m_d, m_e );
+	    ticks = this->loadToA( m_regs.de );
 	    break;
 	case 0x1B: // DEC DE
-	    ticks = this->decReg( m_d, m_e );
+	    ticks = this->decReg( m_regs.de );
 	    break;
 	case 0x1C: // INC E
-	    ticks = this->incReg( m_e );
+	    ticks = this->incReg( m_regs.e );
 	    break;
 	case 0x1D: // DEC E
-	    ticks = this->decReg( m_e );
+	    ticks = this->decReg( m_regs.e );
 	    break;
 	case 0x1E: // LD E,d8
-	    ticks = this->loadImm8( m_e );
+	    ticks = this->loadImm8( m_regs.e );
 	    break;
 	case 0x1F: // RRA
 	    ticks = this->rra();
@@ -236,22 +295,22 @@ uint8_t Z80::executeNextInstruction( void )
 	    ticks = this->jrr8( !(this->getFlag(c_zero)) );
 	    break;
 	case 0x21: // LD HL,d16
-	    ticks = this->loadImm16( m_h, m_l );
+	    ticks = this->loadImm16( m_regs.hl );
 	    break;
 	case 0x22: // LD (HL+),A
-	    ticks = this->loadFromA( m_h, m_l, 1 );
+	    ticks = this->loadFromA( m_regs.hl, 1 );
 	    break;
 	case 0x23: // INC HL
-	    ticks = this->incReg( m_h, m_l );
+	    ticks = this->incReg( m_regs.hl );
 	    break;
 	case 0x24: // INC H
-	    ticks = this->incReg( m_h );
+	    ticks = this->incReg( m_regs.h );
 	    break;
 	case 0x25: // DEC H
-	    ticks = this->decReg( m_h );
+	    ticks = this->decReg( m_regs.h );
 	    break;
 	case 0x26: /// LD H,d8
-	    ticks = this->loadImm8( m_h );
+	    ticks = this->loadImm8( m_regs.h );
 	    break;
 	case 0x27: // DAA
 	    ticks = this->daa();
@@ -260,25 +319,25 @@ uint8_t Z80::executeNextInstruction( void )
 	    ticks = this->jrr8( this->getFlag( c_zero ) );
 	    break;
 	case 0x29: // ADD HL,HL
-	    ticks = this->addToHL( m_h, m_l );
+	    ticks = this->addToHL( m_regs.hl );
 	    break;
 	case 0x2A: // LD A,(HL+)
-	    ticks = this->loadToA( m_h, m_l, 1 );
+	    ticks = this->loadToA( m_regs.hl, 1 );
 	    break;
 	case 0x2B: // DEC HL
-	    ticks = this->decReg( m_h, m_l );
+	    ticks = this->decReg( m_regs.hl );
 	    break;
 	case 0x2C: // INC L
-	    ticks = this->incReg( m_l );
+	    ticks = this->incReg( m_regs.l );
 	    break;
 	case 0x2D: // DEC L
-	    ticks = this->decReg( m_l );
+	    ticks = this->decReg( m_regs.l );
 	    break;
 	case 0x2E: // LD L,d8
-	    ticks = this->loadImm8( m_l );
+	    ticks = this->loadImm8( m_regs.l );
 	    break;
 	case 0x2F: // CPL
-	    m_a = ~m_a;
+	    m_regs.a = ~m_regs.a;
 	    this->setFlag( c_sub );
 	    this->setFlag( c_halfCarry );
 	    ticks = 4;
@@ -287,13 +346,13 @@ uint8_t Z80::executeNextInstruction( void )
 	    ticks = this->jrr8( !(this->getFlag(c_carry)) );
 	    break;
 	case 0x31: // LD SP,d16
-	    ticks = this->loadImm16( m_sp );
+	    ticks = this->loadImm16( m_regs.sp );
 	    break;
 	case 0x32: // LD (HL-),A
-	    ticks = this->loadFromA( m_h, m_l, 0xFFFF );
+	    ticks = this->loadFromA( m_regs.hl, 0xFFFF );
 	    break;
 	case 0x33: // INC SP
-	    ticks = this->incReg( m_sp );
+	    ticks = this->incReg( m_regs.sp );
 	    break;
 	case 0x34: // INC (HL)
 	    ticks = this->incHL();
@@ -314,22 +373,22 @@ uint8_t Z80::executeNextInstruction( void )
 	    ticks = this->jrr8( this->getFlag( c_carry ));
 	    break;
 	case 0x39: // ADD HL,SP
-	    ticks = this->addToHL( m_sp );
+	    ticks = this->addToHL( m_regs.sp );
 	    break;
 	case 0x3A: // LD A,(HL-)
-	    ticks = this->loadToA( m_h, m_l, 0xFFFF );
+	    ticks = this->loadToA( m_regs.hl, 0xFFFF );
 	    break;
 	case 0x3B: // DEC SP
-	    ticks = this->decReg( m_sp );
+	    ticks = this->decReg( m_regs.sp );
 	    break;
 	case 0x3C: // INC A
-	    ticks = this->incReg( m_a );
+	    ticks = this->incReg( m_regs.a );
 	    break;
 	case 0x3D: // DEC A
-	    ticks = this->decReg( m_a );
+	    ticks = this->decReg( m_regs.a );
 	    break;
 	case 0x3E: // LD A,d8
-	    ticks = this->loadImm8( m_a );
+	    ticks = this->loadImm8( m_regs.a );
 	    break;
 	case 0x3F: // CCF
 	    this->setFlag( c_carry, !(this->getFlag(c_carry)) );
@@ -344,7 +403,7 @@ uint8_t Z80::executeNextInstruction( void )
 	    ticks = this->retFlag( c_zero, false );
 	    break;
 	case 0xC1: // POP BC
-	    ticks = this->popWord( m_b, m_c );
+	    ticks = this->popWord( m_regs.bc );
 	    break;
 	case 0xC2: // JP NZ,a16
 	    ticks = this->jpa16( !(this->getFlag(c_zero)) );
@@ -356,7 +415,7 @@ uint8_t Z80::executeNextInstruction( void )
 	    ticks = this->callA16( !(this->getFlag(c_zero)) );
 	    break;
 	case 0xC5: // PUSH BC
-	    ticks = this->pushWord( m_b, m_c );
+	    ticks = this->pushWord( m_regs.bc );
 	    break;
 	case 0xC7: // RST 00H
 	    ticks = this->rst( 0x00 );
@@ -383,7 +442,7 @@ uint8_t Z80::executeNextInstruction( void )
 	    ticks = this->retFlag( c_carry, false );
 	    break;
 	case 0xD1: // POP DE
-	    ticks = this->popWord( m_d, m_e );
+	    ticks = this->popWord( m_regs.de );
 	    break;
 	case 0xD2: // JP NC,a16
 	    ticks = this->jpa16( !(this->getFlag(c_carry)) );
@@ -392,7 +451,7 @@ uint8_t Z80::executeNextInstruction( void )
 	    ticks = this->callA16( !(this->getFlag(c_carry)) );
 	    break;
 	case 0xD5: // PUSH DE
-	    ticks = this->pushWord( m_d, m_e );
+	    ticks = this->pushWord( m_regs.de );
 	    break;
 	case 0xD7: // RST 10H
 	    ticks = this->rst( 0x10 );
@@ -413,17 +472,17 @@ uint8_t Z80::executeNextInstruction( void )
 	    ticks = this->rst( 0x18 );
 	    break;
 	case 0xE0: // LDH (a8),A
-	    this->loadFromA( 0xFF, this->loadImm8() );
+	    this->loadFromA( 0xFF00 | this->loadImm8() );
 	    ticks = 12;
 	    break;
 	case 0xE1: // POP HL
-	    ticks = this->popWord( m_h, m_l );
+	    ticks = this->popWord( m_regs.hl );
 	    break;
 	case 0xE2: // LD (C),A
-	    ticks = this->loadFromA( 0xFF, m_c );
+	    ticks = this->loadFromA( 0xFF00 | m_regs.c );
 	    break;
 	case 0xE5: // PUSH HL
-	    ticks = this->pushWord( m_h, m_l );
+	    ticks = this->pushWord( m_regs.hl );
 	    break;
 	case 0xE7: // RST 20H
 	    ticks = this->rst( 0x20 );
@@ -432,7 +491,7 @@ uint8_t Z80::executeNextInstruction( void )
 	    ticks = this->addImm8ToSP();
 	    break;
 	case 0xE9: // JP (HL)
-	    m_pc = this->get2ByteRegValue( m_h, m_l ) - 1;
+	    m_regs.pc = m_regs.hl - 1;
 	    ticks = 4;
 	    break;
 	case 0xEA: // LD (a16),A
@@ -442,21 +501,23 @@ uint8_t Z80::executeNextInstruction( void )
 	    ticks = this->rst( 0x28 );
 	    break;
 	case 0xF0: // LDH A,(a8)
-	    this->loadToA( 0xFF, this->loadImm8() );
+	    this->loadToA( 0xFF00 | this->loadImm8() );
 	    ticks = 12;
 	    break;
 	case 0xF1: // POP AF
-	    ticks = this->popWord( m_a, m_flags );
-	    m_flags = m_flags & 0xF0; // lower four bits are always zero
+	    ticks = this->popWord( m_regs.af );
+	    m_regs.f = m_regs.f & 0xF0; // lower four bits are always zero
+	    m_flagOp = C_FLAGS_EVALUATED;
 	    break;
 	case 0xF2: // LD A,(C)
-	    ticks = this->loadToA( 0xFF, m_c );
+	    ticks = this->loadToA( 0xFF00 | m_regs.c );
 	    break;
 	case 0xF3: // DI
 	    ticks = this->enableInterrupt( false );
 	    break;
 	case 0xF5: // PUSH AF
-	    ticks = pushWord( m_a, m_flags );
+	    this->evaluateFlags();
+	    ticks = this->pushWord( m_regs.af );
 	    break;
 	case 0xF7: // RST 30H
 	    ticks = this->rst( 0x30 );
@@ -465,7 +526,7 @@ uint8_t Z80::executeNextInstruction( void )
 	    ticks = this->loadSPImm8ToHL();
 	    break;
 	case 0xF9: // LD SP,HL
-	    m_sp = this->get2ByteRegValue( m_h, m_l );
+	    m_regs.sp = m_regs.hl;
 	    ticks = 8;
 	    break;
 	case 0xFA: // LD A,(a16)
@@ -483,15 +544,204 @@ uint8_t Z80::executeNextInstruction( void )
 	}
     }
 
+    return ticks;
+}
+
+template <uint8_t opcode>
+uint8_t Z80::executeCBOpcode( void )
+{
+    // bits 0-2 select the operand, bits 3-5 the operation or bit index
+    constexpr uint8_t operand = opcode & 0x07;
+    constexpr uint8_t index = (opcode >> 3) & 0x07;
+    constexpr uint8_t mask = 0x01 << index;
+
+    // step over the CB opcode byte
+    m_regs.pc++;
+
+    uint8_t val = this->readCBOperand<operand>();
+
+    if constexpr( opcode < 0x40 )
+    {
+	if constexpr( index == 0x00 ) { val = this->rlc( val ); }
+	else if constexpr( index == 0x01 ) { val = this->rrc( val ); }
+	else if constexpr( index == 0x02 ) { val = this->rl( val ); }
+	else if constexpr( index == 0x03 ) { val = this->rr( val ); }
+	else if constexpr( index == 0x04 ) { val = this->sla( val ); }
+	else if constexpr( index == 0x05 ) { val = this->sra( val ); }
+	else if constexpr( index == 0x06 ) { val = this->swap( val ); }
+	else { val = this->srl( val ); }
+
+	this->writeCBOperand<operand>( val );
+    }
+    else if constexpr( opcode < 0x80 )
+    {
+	// BIT (carry is unaffected)
+	this->deferFlags( C_FLAGS_BIT, val & mask, 0, 0,
+			  this->getFlag( c_carry ) );
+    }
+    else if constexpr( opcode < 0xC0 )
+    {
+	// RES
+	this->writeCBOperand<operand>( val & (~mask) );
+    }
+    else
+    {
+	// SET
+	this->writeCBOperand<operand>( val | mask );
+    }
+
+    return ( operand == 0x06 ) ? 16 : 8;
+}
+
+template <uint8_t operand>
+uint8_t& Z80::getCBOperand( void )
+{
+    if constexpr( operand == 0x00 ) { return m_regs.b; }
+    else if constexpr( operand == 0x01 ) { return m_regs.c; }
+    else if constexpr( operand == 0x02 ) { return m_regs.d; }
+    else if constexpr( operand == 0x03 ) { return m_regs.e; }
+    else if constexpr( operand == 0x04 ) { return m_regs.h; }
+    else if constexpr( operand == 0x05 ) { return m_regs.l; }
+    else { return m_regs.a; }
+}
+
+template <uint8_t operand>
+uint8_t Z80::readCBOperand( void )
+{
+    if constexpr( operand != 0x06 ) { return this->getCBOperand<operand>(); }
+    else
+    {
+	uint8_t val;
+	uint16_t addr = m_regs.hl;
+	mp_bus->access( addr, val, READ );
+
+	return val;
+    }
+}
+
+template <uint8_t operand>
+void Z80::writeCBOperand( uint8_t val )
+{
+    if constexpr( operand != 0x06 ) { this->getCBOperand<operand>() = val; }
+    else
+    {
+	uint16_t addr = m_regs.hl;
+	mp_bus->access( addr, val, WRITE );
+    }
+}
+
+const Z80::Instruction Z80::c_opcodeTable[ 256 ] =
+{
+    Z80_OPCODES( Z80_OPCODE_HANDLER )
+};
+
+const Z80::Instruction Z80::c_cbOpcodeTable[ 256 ] =
+{
+    Z80_OPCODES( Z80_CB_OPCODE_HANDLER )
+};
+
+const uint8_t Z80::c_opcodeLengths[ 256 ] =
+{
+ // x0 x1 x2 x3 x4 x5 x6 x7 x8 x9 xA xB xC xD xE xF
+    1, 3, 1, 1, 1, 1, 2, 1, 3, 1, 1, 1, 1, 1, 2, 1, // 0x
+    1, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1, // 1x
+    2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1, // 2x
+    2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1, // 3x
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 4x
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 5x
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 6x
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 7x
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 8x
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 9x
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // Ax
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // Bx
+    1, 1, 3, 3, 3, 1, 2, 1, 1, 1, 3, 2, 3, 3, 2, 1, // Cx
+    1, 1, 3, 1, 3, 1, 2, 1, 1, 1, 3, 1, 3, 1, 2, 1, // Dx
+    2, 1, 1, 1, 1, 1, 2, 1, 2, 1, 3, 1, 1, 1, 2, 1, // Ex
+    2, 1, 1, 1, 1, 1, 2, 1, 2, 1, 3, 1, 1, 1, 2, 1  // Fx
+};
+
+const uint8_t Z80::c_opcodeTicks[ 256 ] =
+{
+ // x0  x1  x2  x3  x4  x5  x6  x7  x8  x9  xA  xB  xC  xD  xE  xF
+     4, 12,  8,  8,  4,  4,  8,  4, 20,  8,  8,  8,  4,  4,  8,  4, // 0x
+     4, 12,  8,  8,  4,  4,  8,  4, 12,  8,  8,  8,  4,  4,  8,  4, // 1x
+    12, 12,  8,  8,  4,  4,  8,  4, 12,  8,  8,  8,  4,  4,  8,  4, // 2x
+    12, 12,  8,  8, 12, 12, 12,  4, 12,  8,  8,  8,  4,  4,  8,  4, // 3x
+     4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4, // 4x
+     4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4, // 5x
+     4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4, // 6x
+     8,  8,  8,  8,  8,  8,  4,  8,  4,  4,  4,  4,  4,  4,  8,  4, // 7x
+     4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4, // 8x
+     4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4, // 9x
+     4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4, // Ax
+     4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4, // Bx
+    20, 12, 16, 16, 24, 16,  8, 16, 20, 16, 16, 16, 24, 24,  8, 16, // Cx
+    20, 12, 16,  4, 24, 16,  8, 16, 20, 16, 16,  4, 24,  4,  8, 16, // Dx
+    12, 12,  8,  4,  4, 16,  8, 16, 16,  4, 16,  4,  4,  4,  8, 16, // Ex
+    12, 12,  8,  4,  4, 16,  8, 16, 12,  8, 16,  4,  4,  4,  8, 16  // Fx
+};
+
+uint32_t Z80::executeNextInstruction( uint32_t budget )
+{
+    uint8_t ticks = 4;
+
+    // only fetch next instruction if not halting
+    if( m_halting )
+    {
+	// check for interrupts
+	this->checkInterrupts();
+	m_instructionTicks = 4;
+	return 4;
+    }
+
+    const CachedInstruction* instruction = this->fetchNextInstruction();
+
+#ifdef DYNAREC_ENABLED
+    if( (mp_block != NULL) && (instruction == &(mp_block->instructions[ 0 ])) )
+    {
+	// entering a block: run it natively if it has been compiled
+	uint32_t nativeTicks = this->executeNative( mp_block, budget );
+	if( nativeTicks != 0 ) { return nativeTicks; }
+    }
+#endif
+
+    // the instruction can invalidate its own block by writing to it
+    uint16_t addr = instruction->addr;
+
+    m_operands[ 0 ] = instruction->operands[ 0 ];
+    m_operands[ 1 ] = instruction->operands[ 1 ];
+    m_operandIndex = 0;
+
+#ifdef THREADED_DISPATCH
+    // computed goto: each label calls its handler directly, so the
+    // handler can be inlined at the jump target
+    static void* const labels[ 256 ] = { Z80_OPCODES( Z80_OPCODE_LABEL ) };
+    goto *labels[ instruction->opcode ];
+    Z80_OPCODES( Z80_OPCODE_TARGET )
+dispatched:
+#else
+    // jump table (CB-prefixed instructions store their CB page handler)
+    ticks = (this->*instruction->handler)();
+#endif
+
     // after executing, increment program counter
-    m_pc++;
+    m_regs.pc++;
     
     // check for interrupts
     this->checkInterrupts();
-    
+
+    this->checkIdleLoop( addr, ticks );
+
+    m_instructionTicks = ticks;
     return ticks;
 }
 
+uint8_t Z80::getInstructionTicks( void )
+{
+    return m_instructionTicks;
+}
+
 void Z80::triggerInterrupt( uint8_t mask )
 {
     uint8_t ifreg;
@@ -540,42 +790,42 @@ void Z80::checkInterrupts( void )
     }
     
     this->enableInterrupt( false );
-    this->pushWord( m_pc );
+    this->pushWord( m_regs.pc );
     
     if( ( ieReg & c_vBlank ) &&
 	( ifReg & c_vBlank ) )
     {
 	// VBLANK
 	ifReg = ifReg & (~c_vBlank);
-	m_pc = 0x40;
+	m_regs.pc = 0x40;
     }
     else if( ( ieReg & c_LCDStat ) &&
 	     ( ifReg & c_LCDStat ) )
     {
 	// LCD STAT
 	ifReg = ifReg & (~c_LCDStat);
-	m_pc = 0x48;
+	m_regs.pc = 0x48;
     }
     else if( ( ieReg & c_timer ) &&
 	     ( ifReg & c_timer ) )
     {
 	// TIMER
 	ifReg = ifReg & (~c_timer);
-	m_pc = 0x50;
+	m_regs.pc = 0x50;
     }
     else if( ( ieReg & c_serial ) &&
 	     ( ifReg & c_serial ) )
     {
 	// SERIAL
 	ifReg = ifReg & (~c_serial);
-	m_pc = 0x58;
+	m_regs.pc = 0x58;
     }
     else if( ( ieReg & c_joypad ) &&
 	     ( ifReg & c_joypad ) )
     {
 	// JOYPAD
 	ifReg = ifReg & (~c_joypad);
-	m_pc = 0x60;
+	m_regs.pc = 0x60;
     }
     
     mp_bus->access( 0xFF0F, ifReg, WRITE );    
@@ -594,39 +844,39 @@ uint8_t Z80::executeGroup4x( uint8_t opcode )
     {
     case 0x00:
     case 0x08:
-	value = m_b;
+	value = m_regs.b;
 	break;
     case 0x01:
     case 0x09:
-	value = m_c;
+	value = m_regs.c;
 	break;
     case 0x02:
     case 0x0A:
-	value = m_d;
+	value = m_regs.d;
 	break;
     case 0x03:
     case 0x0B:
-	value = m_e;
+	value = m_regs.e;
 	break;
     case 0x04:
     case 0x0C:
-	value = m_h;
+	value = m_regs.h;
 	break;
     case 0x05:
     case 0x0D:
-	value = m_l;
+	value = m_regs.l;
 	break;
     case 0x06:
     case 0x0E:
         {
-	    uint16_t hl = get2ByteRegValue( m_h, m_l );
+	    uint16_t hl = m_regs.hl;
 	    mp_bus->access( hl, value, READ );
 	    ticks = 8;
 	}
 	break;
     case 0x07:
     case 0x0F:
-	value = m_a;
+	value = m_regs.a;
 	break;
     }
 
@@ -634,25 +884,25 @@ uint8_t Z80::executeGroup4x( uint8_t opcode )
     switch( high )
     {
     case 0x04:
-	if( low < 8 ) { m_b = value; }
-	else { m_c = value; }
+	if( low < 8 ) { m_regs.b = value; }
+	else { m_regs.c = value; }
 	break;
     case 0x05:
-	if( low < 8 ) { m_d = value; }
-	else { m_e = value; }
+	if( low < 8 ) { m_regs.d = value; }
+	else { m_regs.e = value; }
 	break;
     case 0x06:
-	if( low < 8 ) { m_h = value; }
-	else { m_l = value; }
+	if( low < 8 ) { m_regs.h = value; }
+	else { m_regs.l = value; }
 	break;
     case 0x07:
 	if( low < 8 )
 	{
-	    uint16_t hl = get2ByteRegValue( m_h, m_l );
+	    uint16_t hl = m_regs.hl;
 	    mp_bus->access( hl, value, WRITE );
 	    ticks = 8;
 	}
-	else { m_a = value; }
+	else { m_regs.a = value; }
     default:
 	break;
     }
@@ -684,51 +934,48 @@ uint8_t Z80::executeGroup8x( uint8_t opcode )
 	{
 	case 0x00:
 	case 0x08:
-	    value = m_b;
+	    value = m_regs.b;
 	    break;
 	case 0x01:
 	case 0x09:
-	    value = m_c;
+	    value = m_regs.c;
 	    break;
 	case 0x02:
 	case 0x0A:
-	    value = m_d;
+	    value = m_regs.d;
 	    break;
 	case 0x03:
 	case 0x0B:
-	    value = m_e;
+	    value = m_regs.e;
 	    break;
 	case 0x04:
 	case 0x0C:
-	    value = m_h;
+	    value = m_regs.h;
 	    break;
 	case 0x05:
 	case 0x0D:
-	    value = m_l;
+	    value = m_regs.l;
 	    break;
 	case 0x06:
 	case 0x0E:
         {
-	    uint16_t hl = get2ByteRegValue( m_h, m_l );
+	    uint16_t hl = m_regs.hl;
 	    mp_bus->access( hl, value, READ );
 	    ticks = 8;
         }
 	break;
 	case 0x07:
 	case 0x0F:
-	    value = m_a;
+	    value = m_regs.a;
 	    break;
 	}
     }
     
-    uint8_t prev = m_a;
-    m_a = m_a + value + carry;
+    uint8_t prev = m_regs.a;
+    m_regs.a = m_regs.a + value + carry;
 
     // Set flags
-    this->setFlag( c_zero, (m_a == 0) );
-    this->setFlag( c_sub, false );
-    this->setCarry( prev, value, false, carry );
-    this->setHalfCarry( prev, value, false, carry );
+    this->deferFlags( C_FLAGS_ADD, m_regs.a, prev, value, carry );
     
     return ticks;
 }
@@ -757,51 +1004,48 @@ uint8_t Z80::executeGroup9x( uint8_t opcode )
 	{
 	case 0x00:
 	case 0x08:
-	    value = m_b;
+	    value = m_regs.b;
 	    break;
 	case 0x01:
 	case 0x09:
-	    value = m_c;
+	    value = m_regs.c;
 	    break;
 	case 0x02:
 	case 0x0A:
-	    value = m_d;
+	    value = m_regs.d;
 	    break;
 	case 0x03:
 	case 0x0B:
-	    value = m_e;
+	    value = m_regs.e;
 	    break;
 	case 0x04:
 	case 0x0C:
-	    value = m_h;
+	    value = m_regs.h;
 	    break;
 	case 0x05:
 	case 0x0D:
-	    value = m_l;
+	    value = m_regs.l;
 	    break;
 	case 0x06:
 	case 0x0E:
         {
-	    uint16_t hl = get2ByteRegValue( m_h, m_l );
+	    uint16_t hl = m_regs.hl;
 	    mp_bus->access( hl, value, READ );
 	    ticks = 8;
         }
 	break;
 	case 0x07:
 	case 0x0F:
-	    value = m_a;
+	    value = m_regs.a;
 	    break;
 	}
     }
     
-    uint8_t prev = m_a;
-    m_a = m_a - value - carry;
+    uint8_t prev = m_regs.a;
+    m_regs.a = m_regs.a - value - carry;
     
     // Set flags
-    this->setFlag( c_zero, (m_a == 0) );
-    this->setFlag( c_sub );
-    this->setHalfCarry( prev, value, true, carry );
-    this->setCarry( prev, value, true, carry );
+    this->deferFlags( C_FLAGS_SUB, m_regs.a, prev, value, carry );
 
     return ticks;
 }
@@ -822,44 +1066,41 @@ uint8_t Z80::executeGroupAx0( uint8_t opcode )
 	switch( low )
 	{
 	case 0x00:
-	    value = m_b;
+	    value = m_regs.b;
 	    break;
 	case 0x01:
-	    value = m_c;
+	    value = m_regs.c;
 	    break;
 	case 0x02:
-	    value = m_d;
+	    value = m_regs.d;
 	    break;
 	case 0x03:
-	    value = m_e;
+	    value = m_regs.e;
 	    break;
 	case 0x04:
-	    value = m_h;
+	    value = m_regs.h;
 	    break;
 	case 0x05:
-	    value = m_l;
+	    value = m_regs.l;
 	    break;
 	case 0x06:
         {
-	    uint16_t hl = get2ByteRegValue( m_h, m_l );
+	    uint16_t hl = m_regs.hl;
 	    mp_bus->access( hl, value, READ );
 	    ticks = 8;
         }
 	break;
 	case 0x07:
 	default:
-	    value = m_a;
+	    value = m_regs.a;
 	    break;
 	}
     }
     
-    m_a = m_a & value;
+    m_regs.a = m_regs.a & value;
 
     // Set flags
-    this->setFlag( c_zero, (m_a == 0) );
-    this->setFlag( c_sub, false );
-    this->setFlag( c_halfCarry, true );
-    this->setFlag( c_carry, false );
+    this->deferFlags( C_FLAGS_AND, m_regs.a );
 
     return ticks;
 }
@@ -880,43 +1121,40 @@ uint8_t Z80::executeGroupAx8( uint8_t opcode )
 	switch( low )
 	{
 	case 0x08:
-	    value = m_b;
+	    value = m_regs.b;
 	    break;
 	case 0x09:
-	    value = m_c;
+	    value = m_regs.c;
 	    break;
 	case 0x0A:
-	    value = m_d;
+	    value = m_regs.d;
 	    break;
 	case 0x0B:
-	    value = m_e;
+	    value = m_regs.e;
 	    break;
 	case 0x0C:
-	    value = m_h;
+	    value = m_regs.h;
 	    break;
 	case 0x0D:
-	    value = m_l;
+	    value = m_regs.l;
 	    break;
 	case 0x0E:
            {
-	       uint16_t hl = get2ByteRegValue( m_h, m_l );
+	       uint16_t hl = m_regs.hl;
 	       mp_bus->access( hl, value, READ );
 	       ticks = 8;
 	   }
 	   break;
 	case 0x0F:
 	default:
-	    value = m_a;
+	    value = m_regs.a;
 	    break;
 	}
     }
     
-    m_a = m_a ^ value;
+    m_regs.a = m_regs.a ^ value;
 
-    this->setFlag( c_zero, (m_a == 0) );
-    this->setFlag( c_sub, false );
-    this->setFlag( c_halfCarry, false );
-    this->setFlag( c_carry, false );
+    this->deferFlags( C_FLAGS_LOGIC, m_regs.a );
 
     return ticks;
 }
@@ -937,58 +1175,47 @@ uint8_t Z80::executeGroupBx0( uint8_t opcode )
 	switch( low )
 	{
 	case 0x00:
-	    value = m_b;
+	    value = m_regs.b;
 	    break;
 	case 0x01:
-	    value = m_c;
+	    value = m_regs.c;
 	    break;
 	case 0x02:
-	    value = m_d;
+	    value = m_regs.d;
 	    break;
 	case 0x03:
-	    value = m_e;
+	    value = m_regs.e;
 	    break;
 	case 0x04:
-	    value = m_h;
+	    value = m_regs.h;
 	    break;
 	case 0x05:
-	    value = m_l;
+	    value = m_regs.l;
 	    break;
 	case 0x06:
             {
-		uint16_t hl = get2ByteRegValue( m_h, m_l );
+		uint16_t hl = m_regs.hl;
 		mp_bus->access( hl, value, READ );
 		ticks = 8;
             }
 	    break;
 	case 0x07:
-	    value = m_a;
+	    value = m_regs.a;
 	    break;
 	}
     }
     
-    m_a = m_a | value;
+    m_regs.a = m_regs.a | value;
 
     // Set flags
-    this->setFlag( c_zero, (m_a == 0) );
-    this->setFlag( c_sub, false );
-    this->setFlag( c_halfCarry, false );
-    this->setFlag( c_carry, false );
+    this->deferFlags( C_FLAGS_LOGIC, m_regs.a );
 
     return ticks;
 }
 
 uint8_t Z80::addToHL( uint16_t val )
-{
-    uint8_t high, low;
-    this->split2ByteRegValue( high, low, val );
-    return this->addToHL( high, low );
-}
-
-uint8_t Z80::addToHL( uint8_t high, uint8_t low )
 { 
-    uint16_t hl = this->get2ByteRegValue( m_h, m_l );
-    uint16_t val = this->get2ByteRegValue( high, low );
+    uint16_t hl = m_regs.hl;
         
     uint16_t soln = hl + val;
     int next = (int)hl + (int)val;
@@ -998,7 +1225,7 @@ uint8_t Z80::addToHL( uint8_t high, uint8_t low )
 	( ((int)hl & 0xFFF) +
 	  ((int)val & 0xFFF) ) & 0x1000 ) != 0;
     
-    split2ByteRegValue( m_h, m_l, soln );
+    m_regs.hl = soln;
 
     // Set flags
     this->setFlag( c_sub, false );
@@ -1024,43 +1251,40 @@ uint8_t Z80::executeGroupBx8( uint8_t opcode )
 	switch( low )
 	{
 	case 0x08:
-	    value = m_b;
+	    value = m_regs.b;
 	    break;
 	case 0x09:
-	    value = m_c;
+	    value = m_regs.c;
 	    break;
 	case 0x0A:
-	    value = m_d;
+	    value = m_regs.d;
 	    break;
 	case 0x0B:
-	    value = m_e;
+	    value = m_regs.e;
 	    break;
 	case 0x0C:
-	    value = m_h;
+	    value = m_regs.h;
 	    break;
 	case 0x0D:
-	    value = m_l;
+	    value = m_regs.l;
 	    break;
 	case 0x0E:
         {
-	    uint16_t hl = get2ByteRegValue( m_h, m_l );
+	    uint16_t hl = m_regs.hl;
 	    mp_bus->access( hl, value, READ );
 	    ticks = 8;
         }
 	break;
 	case 0x0F:
-	    value = m_a;
+	    value = m_regs.a;
 	    break;
 	}
     }
 
-    uint8_t curr = m_a - value;
+    uint8_t curr = m_regs.a - value;
     
     // Set flags
-    this->setFlag( c_zero, (curr == 0) );
-    this->setFlag( c_sub );
-    this->setHalfCarry( m_a, value, true );
-    this->setCarry( m_a, value, true );
+    this->deferFlags( C_FLAGS_SUB, curr, m_regs.a, value );
     
     return ticks;
 }
@@ -1073,25 +1297,25 @@ uint8_t Z80::enableInterrupt( bool enable )
 
 uint8_t Z80::pushWord( uint16_t word )
 {
-    uint8_t high, low;
-    this->split2ByteRegValue( high, low, word );
-    this->pushWord( high, low );
-    return 16;
-}
+    uint8_t high = word >> 8;
+    uint8_t low = word & 0xFF;
 
-uint8_t Z80::pushWord( uint8_t high, uint8_t low )
-{
-    m_sp -= 2;
-    mp_bus->access( m_sp + 1, high, WRITE );
-    mp_bus->access( m_sp, low, WRITE );
+    m_regs.sp -= 2;
+    mp_bus->access( m_regs.sp + 1, high, WRITE );
+    mp_bus->access( m_regs.sp, low, WRITE );
     return 16;
 }
 
-uint8_t Z80::popWord( uint8_t& high, uint8_t& low )
+uint8_t Z80::popWord( uint16_t& word )
 {
-    mp_bus->access( m_sp + 1, high, READ );
-    mp_bus->access( m_sp, low, READ );
-    m_sp += 2;
+    // unreadable memory leaves the word unchanged
+    uint8_t high = word >> 8;
+    uint8_t low = word & 0xFF;
+    mp_bus->access( m_regs.sp + 1, high, READ );
+    mp_bus->access( m_regs.sp, low, READ );
+    m_regs.sp += 2;
+
+    word = ( high << 8 ) | low;
     
     return 12;
 }
@@ -1100,7 +1324,7 @@ uint8_t Z80::jrr8( bool flag )
 {
     if( flag == false )
     {
-	m_pc++;
+	m_regs.pc++;
 	return 8;
     }
         
@@ -1113,12 +1337,12 @@ uint8_t Z80::jrr8( bool flag )
     {
 	magnitude = ~r8;
 	magnitude++;
-	m_pc -= magnitude;
+	m_regs.pc -= magnitude;
     }
     else
     {
 	magnitude = r8 & 0x7F;
-	m_pc += magnitude;
+	m_regs.pc += magnitude;
     }
     
     return 12;
@@ -1128,19 +1352,17 @@ uint8_t Z80::callA16( bool flag )
 {
     if( flag == false )
     {
-	m_pc += 2;
+	m_regs.pc += 2;
 	return 12;
     }
     
     uint16_t addr;
-    uint8_t high, low;
 
-    this->loadImm16( high, low );
-    addr = this->get2ByteRegValue( high, low );
-    this->pushWord( m_pc + 1 );
+    this->loadImm16( addr );
+    this->pushWord( m_regs.pc + 1 );
 
-    m_pc = addr;
-    m_pc--; // go to the address before the call
+    m_regs.pc = addr;
+    m_regs.pc--; // go to the address before the call
     
     
     return 24;
@@ -1148,11 +1370,10 @@ uint8_t Z80::callA16( bool flag )
 
 uint8_t Z80::ret( void )
 {
-    uint16_t addr;
-    uint8_t high, low;
-    this->popWord( high, low );
-    addr = this->get2ByteRegValue( high, low );
-    m_pc = addr - 1;
+    // popWord keeps the old value where memory is unreadable
+    uint16_t addr = 0xFFFF;
+    this->popWord( addr );
+    m_regs.pc = addr - 1;
 
     return 16;
 }
@@ -1179,32 +1400,26 @@ uint8_t Z80::retFlag( uint8_t flag, bool flagValue )
 uint8_t Z80::rla( void )
 {
     bool oldCarry = this->getFlag( c_carry );
-    bool nextCarry = BIT( m_a, 7 );
+    bool nextCarry = BIT( m_regs.a, 7 );
 
-    m_a = m_a << 1;
-    if( oldCarry ) { m_a |= 0x01; }
+    m_regs.a = m_regs.a << 1;
+    if( oldCarry ) { m_regs.a |= 0x01; }
     
     // Set flags
-    this->setFlag( c_zero, false );
-    this->setFlag( c_sub, false );
-    this->setFlag( c_halfCarry, false );    
-    this->setFlag( c_carry, nextCarry );
+    this->deferFlags( C_FLAGS_ROTATE_A, m_regs.a, 0, 0, nextCarry );
     
     return 4;
 }
 
 uint8_t Z80::rlca( void )
 {
-    bool nextCarry = BIT( m_a, 7 );
+    bool nextCarry = BIT( m_regs.a, 7 );
 
-    m_a = m_a << 1;
-    if( nextCarry ) { m_a |= 0x01; }
+    m_regs.a = m_regs.a << 1;
+    if( nextCarry ) { m_regs.a |= 0x01; }
     
     // Set flags
-    this->setFlag( c_zero, false );
-    this->setFlag( c_sub, false );
-    this->setFlag( c_halfCarry, false );    
-    this->setFlag( c_carry, nextCarry );
+    this->deferFlags( C_FLAGS_ROTATE_A, m_regs.a, 0, 0, nextCarry );
 
     return 4;
 }
@@ -1212,32 +1427,26 @@ uint8_t Z80::rlca( void )
 uint8_t Z80::rra( void )
 {
     bool oldCarry = this->getFlag( c_carry );
-    bool nextCarry = BIT( m_a, 0 );
+    bool nextCarry = BIT( m_regs.a, 0 );
 
-    m_a = m_a >> 1;
-    if( oldCarry ) { m_a |= 0x80; }
+    m_regs.a = m_regs.a >> 1;
+    if( oldCarry ) { m_regs.a |= 0x80; }
     
     // Set flags
-    this->setFlag( c_zero, false );
-    this->setFlag( c_sub, false );
-    this->setFlag( c_halfCarry, false );    
-    this->setFlag( c_carry, nextCarry );
+    this->deferFlags( C_FLAGS_ROTATE_A, m_regs.a, 0, 0, nextCarry );
     
     return 4;
 }
 
 uint8_t Z80::rrca( void )
 {
-    bool nextCarry = BIT( m_a, 0 );
+    bool nextCarry = BIT( m_regs.a, 0 );
 
-    m_a = m_a >> 1;
-    if( nextCarry ) { m_a |= 0x80; }
+    m_regs.a = m_regs.a >> 1;
+    if( nextCarry ) { m_regs.a |= 0x80; }
     
     // Set flags
-    this->setFlag( c_zero, false );
-    this->setFlag( c_sub, false );
-    this->setFlag( c_halfCarry, false );    
-    this->setFlag( c_carry, nextCarry );
+    this->deferFlags( C_FLAGS_ROTATE_A, m_regs.a, 0, 0, nextCarry );
     
     return 4;
 }
@@ -1247,22 +1456,12 @@ uint8_t Z80::decReg( uint8_t& reg )
     uint8_t old = reg;
     reg--;
 
-    // Set flags
-    this->setFlag( c_zero, (reg == 0) );
-    this->setFlag( c_sub );
-    this->setHalfCarry( old, 1, true );    
+    // Set flags (carry is unaffected)
+    this->deferFlags( C_FLAGS_DEC, reg, old, 1, this->getFlag( c_carry ) );
 
     return 4;
 }
 
-uint8_t Z80::decReg( uint8_t& high, uint8_t& low )
-{
-    uint16_t temp = this->get2ByteRegValue( high, low ) - 1;
-    this->split2ByteRegValue( high, low, temp );
-    
-    return 8;
-}
-
 uint8_t Z80::decReg( uint16_t& reg )
 {
     reg--;
@@ -1272,13 +1471,10 @@ uint8_t Z80::decReg( uint16_t& reg )
 uint8_t Z80::loadSPToA16( void )
 {
     uint16_t addr;
-    uint8_t high, low;
-
-    this->loadImm16( high, low );
-    addr = this->get2ByteRegValue( high, low );
+    this->loadImm16( addr );
 
-    uint8_t spHigh, spLow;
-    this->split2ByteRegValue( spHigh, spLow, m_sp );
+    uint8_t spHigh = m_regs.sp >> 8;
+    uint8_t spLow = m_regs.sp & 0xFF;
 
     mp_bus->access( addr, spLow, WRITE );
     mp_bus->access( addr + 1, spHigh, WRITE );
@@ -1291,27 +1487,23 @@ uint8_t Z80::incReg( uint8_t& reg )
     uint8_t old = reg;
     reg++;
     
-    // Set flags
-    this->setFlag( c_zero, (reg == 0) );
-    this->setFlag( c_sub, false );
-    this->setHalfCarry( old, 1 );
+    // Set flags (carry is unaffected)
+    this->deferFlags( C_FLAGS_INC, reg, old, 1, this->getFlag( c_carry ) );
     
     return 4;
 }
 
 uint8_t Z80::incHL( void )
 {
-    uint16_t hl = this->get2ByteRegValue( m_h, m_l );
+    uint16_t hl = m_regs.hl;
     uint8_t prev, val;
 
     mp_bus->access( hl, prev, READ );
 
     val = prev + 1;
 
-    // Set flags
-    this->setFlag( c_zero, (val == 0) );
-    this->setFlag( c_sub, false );
-    this->setHalfCarry( prev, 1 );
+    // Set flags (carry is unaffected)
+    this->deferFlags( C_FLAGS_INC, val, prev, 1, this->getFlag( c_carry ) );
 
     mp_bus->access( hl, val, WRITE );
     
@@ -1320,34 +1512,28 @@ uint8_t Z80::incHL( void )
 
 uint8_t Z80::decHL( void )
 {
-    uint16_t hl = this->get2ByteRegValue( m_h, m_l );
+    uint16_t hl = m_regs.hl;
     uint8_t prev, val;
 
     mp_bus->access( hl, prev, READ );
 
     val = prev - 1;
 
-    // Set flags
-    this->setFlag( c_zero, (val == 0) );
-    this->setFlag( c_sub );
-    this->setHalfCarry( prev, 1, true );
+    // Set flags (carry is unaffected)
+    this->deferFlags( C_FLAGS_DEC, val, prev, 1, this->getFlag( c_carry ) );
 
     mp_bus->access( hl, val, WRITE );
 
     return 12;
 }
 
-uint8_t Z80::loadToA( uint8_t high, uint8_t low, uint16_t hlOffset )
+uint8_t Z80::loadToA( uint16_t addr, uint16_t hlOffset )
 {
-    uint16_t addr = this->get2ByteRegValue( high, low );
-    mp_bus->access( addr, m_a, READ );
+    mp_bus->access( addr, m_regs.a, READ );
     
     if( hlOffset != 0 )
     {
-	addr += hlOffset;
-        this->split2ByteRegValue( high, low, addr );
-	m_h = high;
-	m_l = low;
+	m_regs.hl = addr + hlOffset;
     }
     
     return 8;
@@ -1355,29 +1541,24 @@ uint8_t Z80::loadToA( uint8_t high, uint8_t low, uint16_t hlOffset )
 
 uint8_t Z80::loadA16ToA( void )
 {
-    uint8_t high, low;
-    this->loadImm16( high, low );
-    this->loadToA( high, low );
+    uint16_t addr;
+    this->loadImm16( addr );
+    this->loadToA( addr );
     
     return 16;
 }
 
-uint8_t Z80::loadFromA( uint8_t high, uint8_t low, uint16_t hlOffset )
+uint8_t Z80::loadFromA( uint16_t addr, uint16_t hlOffset )
 {
     using namespace std;
     
-    uint16_t addr = this->get2ByteRegValue( high, low );
-
-    mp_bus->access( addr, m_a, WRITE );
+    mp_bus->access( addr, m_regs.a, WRITE );
     uint8_t val;
     mp_bus->access( addr, val, READ );
 
     if( hlOffset != 0 )
     {
-	addr += hlOffset;
-        this->split2ByteRegValue( high, low, addr );
-	m_h = high;
-	m_l = low;
+	m_regs.hl = addr + hlOffset;
     }
     
     return 8;
@@ -1385,24 +1566,13 @@ uint8_t Z80::loadFromA( uint8_t high, uint8_t low, uint16_t hlOffset )
 
 uint8_t Z80::loadA16FromA( void )
 {
-    uint8_t high, low;
-    this->loadImm16( high, low );    
-    this->loadFromA( high, low );
+    uint16_t addr;
+    this->loadImm16( addr );    
+    this->loadFromA( addr );
     
     return 16;
 }
 
-uint8_t Z80::incReg( uint8_t& high, uint8_t& low )
-{
-    uint16_t temp = this->get2ByteRegValue( high, low );
-    temp++;
-
-    high = (temp >> 8);
-    low = (temp & 0xFF);
-    
-    return 8;
-}
-
 uint8_t Z80::incReg( uint16_t& reg )
 {
     reg++;
@@ -1418,13 +1588,14 @@ uint8_t Z80::loadImm8( void )
 
 uint8_t Z80::loadImm8( uint8_t& reg )
 {
-    mp_bus->access( ++m_pc, reg, READ );
+    m_regs.pc++;
+    reg = m_operands[ m_operandIndex++ ];
     return 8;
 }
 
 uint8_t Z80::loadImm8ToHL( void )
 {
-    uint16_t addr = this->get2ByteRegValue( m_h, m_l );
+    uint16_t addr = m_regs.hl;
     uint8_t val;
     this->loadImm8( val );    
     mp_bus->access( addr, val, WRITE );
@@ -1432,91 +1603,55 @@ uint8_t Z80::loadImm8ToHL( void )
     return 12;
 }
 
-uint8_t Z80::loadImm16( uint8_t& high, uint8_t& low )
-{
-    mp_bus->access( ++m_pc, low, READ );
-    mp_bus->access( ++m_pc, high, READ );
-    return 12;
-}
-
 uint8_t Z80::loadImm16( uint16_t& reg )
 {
-    uint16_t value = 0;
-    uint8_t high, low;
-    
-    this->loadImm16( high, low );
-    value = this->get2ByteRegValue( high, low );
-    
-    reg = value;
-    
+    m_regs.pc += 2;
+    reg = ( m_operands[ 1 ] << 8 ) | m_operands[ 0 ];
     return 12;
 }
 
 uint8_t Z80::rst( uint8_t loc )
 {
-    this->pushWord( m_pc + 1 );
-    m_pc = loc - 1;
+    this->pushWord( m_regs.pc + 1 );
+    m_regs.pc = loc - 1;
     
     return 16;
 }
 
 uint8_t Z80::jpa16( bool flag )
 {
-    uint8_t high, low;
-    this->loadImm16( high, low );
+    uint16_t addr;
+    this->loadImm16( addr );
     
     if( flag == false )
     {
 	return 12;
     }
 
-    m_pc = this->get2ByteRegValue( high, low );
-    m_pc--; // go to the address before the jump
+    m_regs.pc = addr;
+    m_regs.pc--; // go to the address before the jump
     
     return 16;
 }
 
 uint8_t Z80::daa( void )
 {
-    uint8_t delta = 0;
-    bool carry = false;
-
-    if( this->getFlag( c_halfCarry) ||
-	( (this->getFlag( c_sub ) == false) &&
-	  ((m_a & 0x0F) > 9) ) )
-    {
-	// if half carry or lower nibble greater than nine, add 6
-	delta += 0x06;
-    }
-
-    if( this->getFlag( c_carry ) ||
-	( (this->getFlag( c_sub ) == false) &&
-	  (m_a > 0x99) ) )
-    {
-	// if carry or a is greater than 0x99, add 0x60
-	delta += 0x60;
-	carry = true;
-    }
+    uint16_t entry = c_alu.daa[ (this->getFlags() >> 4) & 0x07 ][ m_regs.a ];
 
-    if( this->getFlag( c_sub ) ) { m_a -= delta; }
-    else { m_a += delta; }
-    
-    // Set flags
-    this->setFlag( c_zero, (m_a == 0x00) );
-    this->setFlag( c_halfCarry, false );
-    this->setFlag( c_carry, carry );
+    m_regs.a = entry >> 8;
+    m_regs.f = entry & 0xFF;
     
     return 4;
 }
 
 uint8_t Z80::loadSPImm8ToHL( void )
 {
-    uint16_t oldSP = m_sp;
+    uint16_t oldSP = m_regs.sp;
 
     this->addImm8ToSP();
-    this->split2ByteRegValue( m_h, m_l, m_sp );
+    m_regs.hl = m_regs.sp;
     
-    m_sp = oldSP;
+    m_regs.sp = oldSP;
     return 12;
 }
 
@@ -1529,17 +1664,17 @@ uint8_t Z80::addImm8ToSP( void )
     uint8_t r8;
     this->loadImm8( r8 );
 
-    uint16_t prevSP = m_sp;
+    uint16_t prevSP = m_regs.sp;
     
     if( BIT( r8, 7 ) )
     {
 	uint8_t magnitude = ~r8;
 	magnitude = magnitude + 1;
-	m_sp -= magnitude;
+	m_regs.sp -= magnitude;
     }
     else
     {	
-	m_sp += r8;
+	m_regs.sp += r8;
     }
     
     carry = ( (prevSP & 0xFF) + r8 ) > 0xFF;
@@ -1554,863 +1689,487 @@ uint8_t Z80::addImm8ToSP( void )
     return 16;
 }
 
-uint16_t Z80::get2ByteRegValue( uint8_t high, uint8_t low )
-{
-    uint16_t value = high;
-    value = value << 8;
-    value += low;
-
-    return value;
-}
-
-void Z80::split2ByteRegValue( uint8_t& high, uint8_t& low, uint16_t value)
-{
-    high = (uint8_t)(value >> 8);
-    low = (uint8_t)(value & 0xFF);
-}
-
 void Z80::setFlag( uint8_t mask, bool value )
 {
-    if( value ) { m_flags |= mask; }
-    else { m_flags &= (~mask); }
+    this->evaluateFlags();
+    
+    if( value ) { m_regs.f |= mask; }
+    else { m_regs.f &= (~mask); }
 }
 
 bool Z80::getFlag( uint8_t mask )
 {
-    bool flag = ( (m_flags & mask) != 0 );
-    return flag;
-}
-
-void Z80::setHalfCarry( uint8_t prev, uint8_t delta, bool subtract, int offset )
-{
-    bool halfCarryFlag = false;
-    
-    if( subtract )
+    // conditions, carry-in and INC/DEC only need zero or carry, which can
+    // be found from the deferred operation without evaluating the rest
+    if( (m_flagOp != C_FLAGS_EVALUATED) && (mask == c_zero) )
     {
-	halfCarryFlag = ( ( ((int)prev & 0xF) -
-			    ((int)delta & 0xF) -
-			    offset ) < 0 );
+	return (m_flagOp != C_FLAGS_ROTATE_A) && (m_flagResult == 0);
     }
-    else
+    else if( (m_flagOp != C_FLAGS_EVALUATED) && (mask == c_carry) )
     {
-	halfCarryFlag = ( ( ((int)prev & 0xF) +
-			    (delta & 0xF) + offset
-			      ) & 0xF0 ) != 0;
+	switch( m_flagOp )
+	{
+	case C_FLAGS_ADD:
+	    return ( m_flagPrev + m_flagDelta + m_flagCarry ) > 0xFF;
+	case C_FLAGS_SUB:
+	    return m_flagPrev < ( m_flagDelta + m_flagCarry );
+	case C_FLAGS_AND:
+	case C_FLAGS_LOGIC:
+	    return false;
+	default:
+	    // INC and DEC carry the previous carry forward
+	    return m_flagCarry;
+	}
     }
 
-    this->setFlag( c_halfCarry, halfCarryFlag );
+    this->evaluateFlags();
+    
+    bool flag = ( (m_regs.f & mask) != 0 );
+    return flag;
 }
 
-void Z80::setCarry( uint8_t prev, uint8_t delta, bool subtract, int offset )
+uint8_t Z80::getFlags( void )
 {
-    bool carryFlag = false;
-    if( subtract )
-    {
-	carryFlag = ( ((int)prev - (int)delta - offset) < 0 );
-    }
-    else
-    {
-	carryFlag = ( ((int)prev + (int)delta + (int)offset)
-		  & 0xF00 ) != 0;
-    }
-    
-    this->setFlag( c_carry, carryFlag );
+    this->evaluateFlags();
+    return m_regs.f;
 }
 
-uint8_t Z80::fetchNextInstruction( void )
+void Z80::deferFlags( FlagOp op, uint8_t result, uint8_t prev, uint8_t delta, bool carry )
 {
-    uint8_t opcode;
-    mp_bus->access( m_pc, opcode, READ );
-
-    return opcode;
+    m_flagOp = op;
+    m_flagResult = result;
+    m_flagPrev = prev;
+    m_flagDelta = delta;
+    m_flagCarry = carry;
 }
 
-uint8_t Z80::rl( uint8_t& reg, bool hl )
+void Z80::evaluateFlags( void )
 {
-    bool carry, nextCarry, nextZero;    
-    uint8_t ticks = 8;
-
-    carry = this->getFlag( c_carry );
-    
-    if( hl )
-    {
-	uint16_t addr = this->get2ByteRegValue( m_h, m_l );
-	uint8_t val;
-	
-	mp_bus->access( addr, val, READ );
-
-	nextCarry = BIT( val, 7 );
-	val = val << 1;
-	if( carry ) { val |= 0x01; }
-	nextZero = ( val == 0 );
+    if( m_flagOp == C_FLAGS_EVALUATED ) { return; }
 
-	mp_bus->access( addr, val, WRITE );
+    uint8_t zero = ( m_flagResult == 0 ) ? c_zero : 0;
+    uint8_t carry = m_flagCarry ? c_carry : 0;
 
-	ticks = 16;
-    }
-    else
+    switch( m_flagOp )
     {
-	nextCarry = BIT( reg, 7 );
-	reg = reg << 1;
-	if( carry ) { reg |= 0x01; }
-	nextZero = ( reg == 0 );
+    case C_FLAGS_ADD:
+	m_regs.f = c_alu.add[ m_flagCarry ][ m_flagPrev ][ m_flagDelta ];
+	break;
+    case C_FLAGS_SUB:
+	m_regs.f = c_alu.sub[ m_flagCarry ][ m_flagPrev ][ m_flagDelta ];
+	break;
+    case C_FLAGS_INC:
+	m_regs.f = c_alu.inc[ m_flagPrev ] | carry;
+	break;
+    case C_FLAGS_DEC:
+	m_regs.f = c_alu.dec[ m_flagPrev ] | carry;
+	break;
+    case C_FLAGS_AND:
+	m_regs.f = zero | c_halfCarry;
+	break;
+    case C_FLAGS_LOGIC:
+	m_regs.f = zero;
+	break;
+    case C_FLAGS_ROTATE_A:
+	m_regs.f = carry;
+	break;
+    case C_FLAGS_BIT:
+	m_regs.f = zero | c_halfCarry | carry;
+	break;
+    case C_FLAGS_SHIFT:
+    default:
+	m_regs.f = zero | carry;
+	break;
     }
 
-    // Set flags
-    this->setFlag( c_carry, nextCarry );
-    this->setFlag( c_sub, false );
-    this->setFlag( c_halfCarry, false );
-    this->setFlag( c_zero, nextZero ); 
-    
-    return ticks;
+    m_flagOp = C_FLAGS_EVALUATED;
 }
 
-uint8_t Z80::rr( uint8_t& reg, bool hl )
+void Z80::checkIdleLoop( uint16_t addr, uint8_t ticks )
 {
-    bool carry, nextCarry, nextZero;
-    uint8_t ticks = 8;
+    m_loopTicks += ticks;
+    m_idleLoopTicks = 0;
 
-    carry = this->getFlag( c_carry );
-    
-    if( hl )
+    // only a short backward jump can close a polling loop
+    if( (m_regs.pc >= addr) || ((addr - m_regs.pc) > c_idleLoopSize) )
     {
-	uint16_t addr = this->get2ByteRegValue( m_h, m_l );
-	uint8_t val;
-
-	mp_bus->access( addr, val, READ );
-
-	nextCarry = BIT( val, 0 );
-	val = val >> 1;
-	if( carry ) { val |= 0x80; }
-	nextZero = ( val == 0 );
+	return;
+    }
 
-	mp_bus->access( addr, val, WRITE );
+    this->evaluateFlags();
+    uint32_t writes = mp_bus->getWriteCount();
 
-	ticks = 16;
-    }
-    else
+    // same place, same registers and nothing written: the next
+    // iteration will do exactly what this one did
+    if( (m_regs.af == m_loopRegs.af) && (m_regs.bc == m_loopRegs.bc) &&
+	(m_regs.de == m_loopRegs.de) && (m_regs.hl == m_loopRegs.hl) &&
+	(m_regs.sp == m_loopRegs.sp) && (m_regs.pc == m_loopRegs.pc) &&
+	(m_ime == m_loopIme) && (writes == m_loopWrites) )
     {
-	nextCarry = BIT( reg, 0 );
-	reg = reg >> 1;
-	if( carry ) { reg |= 0x80; }
-	nextZero = ( reg == 0 );
+	m_idleLoopTicks = m_loopTicks;
     }
 
-    // Set flags
-    this->setFlag( c_carry, nextCarry );
-    this->setFlag( c_sub, false );
-    this->setFlag( c_halfCarry, false );
-    this->setFlag( c_zero, nextZero );
-    
-    
-    return ticks;
+    m_loopRegs = m_regs;
+    m_loopIme = m_ime;
+    m_loopWrites = writes;
+    m_loopTicks = 0;
 }
 
-uint8_t Z80::rlc( uint8_t& reg, bool hl )
+const CachedInstruction* Z80::fetchNextInstruction( void )
 {
-    uint8_t ticks = 8;
-    bool nextCarry, nextZero;
-    
-    if( hl )
+    // continue replaying the current block if nothing invalidated it
+    if( (mp_block != NULL) &&
+	(m_blockGeneration == mp_blockCache->getGeneration()) &&
+	(m_blockIndex < mp_block->instructions.size()) )
     {
-	uint16_t addr = this->get2ByteRegValue( m_h, m_l );
-	uint8_t val;
-	
-	mp_bus->access( addr, val, READ );
+	const CachedInstruction* next = &(mp_block->instructions[ m_blockIndex ]);
+	if( next->addr == m_regs.pc )
+	{
+	    m_blockIndex++;
+	    return next;
+	}
+    }
 
-	nextCarry = BIT( val, 7 );
-	val = val << 1;
-	if( nextCarry ) { val |= 0x01; }
-	nextZero = (val == 0);
-	
-	mp_bus->access( addr, val, WRITE );
+    mp_block = NULL;
 
-	ticks = 16;
+    // code the CPU is blocked from must not be cached
+    if( BlockCache::isCacheable( m_regs.pc ) && (mp_bus->isBlocked( m_regs.pc ) == false) )
+    {
+	mp_block = mp_blockCache->find( m_regs.pc );
+	if( mp_block == NULL ) { mp_block = this->decodeBlock( m_regs.pc ); }
     }
-    else
+
+    if( mp_block == NULL )
     {
-	nextCarry = BIT( reg, 7 );
-	reg = reg << 1;
-	if( nextCarry ) { reg |= 0x01; }
-	nextZero = (reg == 0);
+	// code outside of the cache is decoded every time
+	this->decodeInstruction( m_regs.pc, m_instruction );
+	return &m_instruction;
     }
+
+    m_blockGeneration = mp_blockCache->getGeneration();
+    m_blockIndex = 1;
     
-    // Set flags
-    this->setFlag( c_zero, nextZero );
-    this->setFlag( c_sub, false );
-    this->setFlag( c_halfCarry, false );    
-    this->setFlag( c_carry, nextCarry );
-    
-    return ticks;
+    return &(mp_block->instructions[ 0 ]);
 }
 
-uint8_t Z80::rrc( uint8_t& reg, bool hl )
+Block* Z80::decodeBlock( uint16_t addr )
 {
-    uint8_t ticks = 8;
-    bool nextCarry, nextZero;
+    Block block;
+    block.start = addr;
+    
+    uint32_t regionEnd = BlockCache::getRegionEnd( addr );
+    uint32_t pc = addr;
 
-    if( hl )
+    while( block.instructions.size() < BlockCache::c_maxBlockLength )
     {
-	uint16_t addr = this->get2ByteRegValue( m_h, m_l );
-	uint8_t val;
+	uint8_t opcode = mp_bus->fetch( pc );
 
-	mp_bus->access( addr, val, READ );
+	// instructions may not straddle the region's end
+	if( pc + c_opcodeLengths[ opcode ] > regionEnd ) { break; }
 
-	nextCarry = BIT( val, 0 );
-	val = val >> 1;
-	if( nextCarry ) { val |= 0x80; }
-	nextZero = (val == 0);
-	
-	mp_bus->access( addr, val, WRITE );
+	CachedInstruction instruction;
+	this->decodeInstruction( pc, instruction );
+	block.instructions.push_back( instruction );
+	pc += instruction.length;
 
-	ticks = 16;
-    }
-    else
-    {
-	nextCarry = BIT( reg, 0 );
-	reg = reg >> 1;
-	if( nextCarry ) { reg |= 0x80; }
-	nextZero = (reg == 0);
+	if( this->endsBlock( opcode ) ) { break; }
     }
 
-    // Set flags
-    this->setFlag( c_zero, nextZero );
-    this->setFlag( c_sub, false );
-    this->setFlag( c_halfCarry, false );    
-    this->setFlag( c_carry, nextCarry );   
-    
-    return ticks;
+    if( block.instructions.empty() ) { return NULL; }
+
+    block.end = pc;
+    block.executions = 0;
+    block.native = NULL;
+    block.nativeTicks = 0;
+    return mp_blockCache->insert( block );
 }
 
-uint8_t Z80::sla( uint8_t& reg, bool hl )
+void Z80::decodeInstruction( uint16_t addr, CachedInstruction& instruction )
 {
-    uint8_t ticks = 8;
-    bool carry, zero;
-    
-    if( hl )
-    {
-	uint16_t addr = this->get2ByteRegValue( m_h, m_l );
-	uint8_t val;
-
-	mp_bus->access( addr, val, READ );
+    uint8_t opcode = mp_bus->fetch( addr );
 
-	carry = BIT( val, 7 );
-	val = val << 1;
-	zero = ( val == 0x00 );
+    instruction.addr = addr;
+    instruction.opcode = opcode;
+    instruction.length = c_opcodeLengths[ opcode ];
+    instruction.ticks = c_opcodeTicks[ opcode ];
+    instruction.operands[ 0 ] = 0x00;
+    instruction.operands[ 1 ] = 0x00;
 
-	mp_bus->access( addr, val, WRITE );
-
-	ticks = 16;
-    }
-    else
+    for( uint8_t i = 1; i < instruction.length; i++ )
     {
-	carry = BIT( reg, 7 );
-	reg = reg << 1;
-	zero = ( reg == 0x00 );
+	instruction.operands[ i - 1 ] = mp_bus->fetch( addr + i );
     }
 
-    // Set flags
-    this->setFlag( c_zero, zero );
-    this->setFlag( c_sub, false );
-    this->setFlag( c_halfCarry, false );
-    this->setFlag( c_carry, carry );
-    
-    return ticks;
+    if( opcode == 0xCB )
+    {
+	uint8_t cbOpcode = instruction.operands[ 0 ];
+	instruction.handler = c_cbOpcodeTable[ cbOpcode ];
+	instruction.ticks = ( (cbOpcode & 0x07) == 0x06 ) ? 16 : 8;
+    }
+    else
+    {
+	instruction.handler = c_opcodeTable[ opcode ];
+    }
 }
 
-uint8_t Z80::sra( uint8_t& reg, bool hl )
+#ifdef DYNAREC_ENABLED
+uint32_t Z80::executeNative( Block* block, uint32_t budget )
 {
-    uint8_t ticks = 8;
-    bool carry, zero;
+    // RAM may be modified, so only ROM code is compiled
+    if( block->start >= 0x8000 ) { return 0; }
 
-    if( hl )
+    if( block->native == NULL )
     {
-	uint16_t addr = this->get2ByteRegValue( m_h, m_l );
-	uint8_t val;
+	// each block is compiled once, when it becomes hot
+	if( block->executions <= Dynarec::c_hotThreshold ) { block->executions++; }
+	if( (block->executions != Dynarec::c_hotThreshold) ||
+	    (mp_dynarec->compile( *block ) == false) )
+	{
+	    return 0;
+	}
+    }
 
-	mp_bus->access( addr, val, READ );
+    // native code does not check watchpoints, OAM DMA or interrupts, and
+    // may not run past hardware's next update
+    if( (block->nativeTicks > budget) || mp_bus->hasWatchpoints() ||
+	mp_bus->isBlocked( block->start ) )
+    {
+	return 0;
+    }
 
-	uint8_t prev = val & 0x80;
-	carry = BIT( val, 0 );
-	val = val >> 1;
-	val |= prev;
-	zero = ( val == 0x00 );
+    // a pending interrupt is taken after the next instruction
+    uint8_t ieReg, ifReg;
+    mp_bus->defaultAccess( 0xFFFF, ieReg, READ );
+    mp_bus->defaultAccess( 0xFF0F, ifReg, READ );
+    if( m_ime && ((ieReg & ifReg) != 0) ) { return 0; }
 
-	mp_bus->access( addr, val, WRITE );
+    // native code starts from the flags register
+    this->evaluateFlags();
 
-	ticks = 16;
-    }
-    else
-    {
-	uint8_t prev = reg & 0x80;
+    uint64_t result = block->native( this, budget );
+    uint32_t ticks = result >> 8;
+    const NativeExit& exit = block->nativeExits[ result & 0xFF ];
+
+    // left before the first instruction
+    if( ticks == 0 ) { return 0; }
 
-	carry = BIT( reg, 0 );
-	reg = reg >> 1;
-	reg |= prev;
-	
-	zero = ( reg == 0 );
+    m_blockIndex = exit.index;
+    m_instructionTicks = exit.lastTicks;
+
+    // only the last instruction can branch, so it is the only one that
+    // can close an idle loop
+    if( exit.loopTicks != 0 )
+    {
+	m_loopTicks += exit.loopTicks - exit.lastTicks;
+	this->checkIdleLoop( block->instructions[ exit.index - 1 ].addr, exit.lastTicks );
     }
 
-    // Set flags
-    this->setFlag( c_zero, zero );
-    this->setFlag( c_sub, false );
-    this->setFlag( c_halfCarry, false );
-    this->setFlag( c_carry, carry );
-    
     return ticks;
 }
 
-uint8_t Z80::swap( uint8_t& reg, bool hl )
+uint32_t Z80::nativeRead( Z80* z80, uint32_t addr )
 {
-    uint8_t ticks = 8;
-    bool zero;
+    if( z80->mp_bus->isMemory( addr, READ ) == false ) { return Dynarec::c_bail; }
 
-    if( hl )
-    {
-	uint16_t addr = this->get2ByteRegValue( m_h, m_l );
-	uint8_t val;
+    uint8_t val;
+    z80->mp_bus->access( addr, val, READ );
+    return val;
+}
 
-	mp_bus->access( addr, val, READ );
+uint32_t Z80::nativeWrite( Z80* z80, uint32_t addr, uint32_t val )
+{
+    if( z80->mp_bus->isMemory( addr, WRITE ) == false ) { return Dynarec::c_bail; }
 
-	uint8_t high, low;
-	high = val >> 4;
-	low = val & 0x0F;
-	val = ( low << 4 ) | high;
-	zero = ( val == 0x00 );
-	
-	mp_bus->access( addr, val, WRITE );
-	
-	ticks = 16;
-    }
-    else
+    uint8_t data = val;
+    z80->mp_bus->access( addr, data, WRITE );
+    return 0;
+}
+
+uint32_t Z80::nativePush( Z80* z80, uint32_t addr, uint32_t word )
+{
+    uint16_t sp = addr;
+    uint8_t high = word >> 8;
+    uint8_t low = word & 0xFF;
+
+    if( (z80->mp_bus->isMemory( sp + 1, WRITE ) == false) ||
+	(z80->mp_bus->isMemory( sp, WRITE ) == false) )
     {
-	uint8_t high, low;
-	high = reg >> 4;
-	low = reg & 0x0F;
-	reg = ( low << 4 ) | high;
-	zero = ( reg == 0x00 );
+	return Dynarec::c_bail;
     }
-    
-    // Set flags
-    this->setFlag( c_zero, zero );
-    this->setFlag( c_sub, false );
-    this->setFlag( c_halfCarry, false );
-    this->setFlag( c_carry, false );
-    
-    return ticks;
+
+    z80->mp_bus->access( sp + 1, high, WRITE );
+    z80->mp_bus->access( sp, low, WRITE );
+    return 0;
 }
 
-uint8_t Z80::srl( uint8_t& reg, bool hl )
+uint32_t Z80::nativePop( Z80* z80, uint32_t addr )
 {
-    uint8_t ticks = 8;
-    bool zero, carry;
-    
-    if( hl )
-    {
-	uint16_t addr = this->get2ByteRegValue( m_h, m_l );
-	uint8_t val;
-	
-	mp_bus->access( addr, val, READ );
+    uint16_t sp = addr;
+    uint8_t high, low;
 
-	carry = BIT( val, 0 );
-	val = val >> 1;
-	zero = ( val == 0 );
-	
-	mp_bus->access( addr, val, WRITE );
-	
-	ticks = 16;
-    }
-    else
+    if( (z80->mp_bus->isMemory( sp + 1, READ ) == false) ||
+	(z80->mp_bus->isMemory( sp, READ ) == false) )
     {
-	carry = BIT( reg, 0 );
-	reg = reg >> 1;
-	zero = ( reg == 0 );
+	return Dynarec::c_bail;
     }
 
-    // Set flags
-    this->setFlag( c_zero, zero );
-    this->setFlag( c_sub, false );
-    this->setFlag( c_halfCarry, false );
-    this->setFlag( c_carry, carry );
-    
-    return ticks;
+    z80->mp_bus->access( sp + 1, high, READ );
+    z80->mp_bus->access( sp, low, READ );
+    return ( high << 8 ) | low;
 }
 
-
-uint8_t Z80::bit( uint8_t& reg, uint8_t bit, bool hl )
+uint32_t Z80::nativeExecute( Z80* z80, const CachedInstruction* instruction )
 {
-    uint8_t ticks = 8;
-    bool zero;
-    
-    if( hl )
+    if( (instruction->opcode == 0xCB) && ((instruction->operands[ 0 ] & 0x07) == 0x06) )
     {
-	uint16_t addr = this->get2ByteRegValue( m_h, m_l );
-	uint8_t val;
-	
-	mp_bus->access( addr, val, READ );
+	// BIT only reads (HL), the other CB operations also write it
+	uint16_t hl = z80->m_regs.hl;
+	bool write = ( (instruction->operands[ 0 ] & 0xC0) != 0x40 );
 
-	zero = !BIT( val, bit );
-	
-	ticks = 16;
-    }
-    else
-    {
-	zero = !BIT( reg, bit );
+	if( (z80->mp_bus->isMemory( hl, READ ) == false) ||
+	    (write && (z80->mp_bus->isMemory( hl, WRITE ) == false)) )
+	{
+	    return Dynarec::c_bail;
+	}
     }
 
-    // Set flags
-    this->setFlag( c_zero, zero );
-    this->setFlag( c_sub, false );
-    this->setFlag( c_halfCarry, true );
+    z80->m_regs.pc = instruction->addr;
+    z80->m_operands[ 0 ] = instruction->operands[ 0 ];
+    z80->m_operands[ 1 ] = instruction->operands[ 1 ];
+    z80->m_operandIndex = 0;
 
-    return ticks;
+    (z80->*instruction->handler)();
+    z80->evaluateFlags();
+
+    return 0;
 }
 
-uint8_t Z80::res( uint8_t& reg, uint8_t bit, bool hl )
+void Z80::nativeEvaluate( Z80* z80 )
 {
-    uint8_t ticks = 8;
+    z80->evaluateFlags();
+}
 
-    if( hl )
-    {
-	uint16_t addr = this->get2ByteRegValue( m_h, m_l );
-	uint8_t val;
-	
-	mp_bus->access( addr, val, READ );
-	val = RES( val, bit );
-	mp_bus->access( addr, val, WRITE );
+uint32_t Z80::nativeLoop( Z80* z80, uint32_t addr, uint32_t ticks )
+{
+    z80->checkIdleLoop( addr, ticks );
+    return z80->m_idleLoopTicks;
+}
+#endif
 
-	ticks = 16;
-    }
-    else
+bool Z80::endsBlock( uint8_t opcode )
+{
+    switch( opcode )
     {
-	reg = RES( reg, bit );
+    case 0x10: // STOP
+    case 0x18: case 0x20: case 0x28: case 0x30: case 0x38: // JR
+    case 0x76: // HALT
+    case 0xC0: case 0xC8: case 0xC9: case 0xD0: case 0xD8: case 0xD9: // RET
+    case 0xC2: case 0xC3: case 0xCA: case 0xD2: case 0xDA: case 0xE9: // JP
+    case 0xC4: case 0xCC: case 0xCD: case 0xD4: case 0xDC: // CALL
+    case 0xC7: case 0xCF: case 0xD7: case 0xDF: // RST
+    case 0xE7: case 0xEF: case 0xF7: case 0xFF:
+	return true;
+    default:
+	return false;
     }
+}
+
+uint8_t Z80::rl( uint8_t val )
+{
+    bool carry = this->getFlag( c_carry );
+    bool nextCarry = BIT( val, 7 );
+
+    val = val << 1;
+    if( carry ) { val |= 0x01; }
+
+    // Set flags
+    this->deferFlags( C_FLAGS_SHIFT, val, 0, 0, nextCarry );
     
-    return ticks;
+    return val;
 }
 
-uint8_t Z80::set( uint8_t& reg, uint8_t bit, bool hl )
+uint8_t Z80::rr( uint8_t val )
 {
-    uint8_t ticks = 8;
+    bool carry = this->getFlag( c_carry );
+    bool nextCarry = BIT( val, 0 );
 
-    if( hl )
-    {
-	uint16_t addr = this->get2ByteRegValue( m_h, m_l );
-	uint8_t val;
-	
-	mp_bus->access( addr, val, READ );
-	val = SET( val, bit );
-	mp_bus->access( addr, val, WRITE );
+    val = val >> 1;
+    if( carry ) { val |= 0x80; }
 
-	ticks = 16;
-    }
-    else
-    {
-	reg = SET( reg, bit );
-    }
+    // Set flags
+    this->deferFlags( C_FLAGS_SHIFT, val, 0, 0, nextCarry );
     
-    return ticks;
+    return val;
 }
 
-uint8_t Z80::executeCBInstruction( uint8_t opcode )
+uint8_t Z80::rlc( uint8_t val )
 {
-    uint8_t ticks = 0;
-    uint8_t high = opcode >> 4;
-    uint8_t low = opcode & 0x0F;
+    bool nextCarry = BIT( val, 7 );
+
+    val = val << 1;
+    if( nextCarry ) { val |= 0x01; }
     
-    if( (opcode >= 0x00) && (opcode <= 0x07) )
-    {
-	// RLC
-	switch( low )
-	{
-	case 0x00:
-	    ticks = this->rlc( m_b );
-	    break;
-	case 0x01:
-	    ticks = this->rlc( m_c );
-	    break;
-	case 0x02:
-	    ticks = this->rlc( m_d );
-	    break;
-	case 0x03:
-	    ticks = this->rlc( m_e );
-	    break;
-	case 0x04:
-	    ticks = this->rlc( m_h );
-	    break;
-	case 0x05:
-	    ticks = this->rlc( m_l );
-	    break;
-	case 0x06:
-	    ticks = this->rlc( m_a, true );
-	    break;
-	case 0x07:
-	default:
-	    ticks = this->rlc( m_a );
-	    break;
-	}        
-    }
+    // Set flags
+    this->deferFlags( C_FLAGS_SHIFT, val, 0, 0, nextCarry );
+    
+    return val;
+}
 
-    if( (opcode >= 0x08) && (opcode <= 0x0F) )
-    {
-	// RRC
-	switch( low )
-	{
-	case 0x08:
-	    ticks = this->rrc( m_b );
-	    break;
-	case 0x09:
-	    ticks = this->rrc( m_c );
-	    break;
-	case 0x0A:
-	    ticks = this->rrc( m_d );
-	    break;
-	case 0x0B:
-	    ticks = this->rrc( m_e );
-	    break;
-	case 0x0C:
-	    ticks = this->rrc( m_h );
-	    break;
-	case 0x0D:
-	    ticks = this->rrc( m_l );
-	    break;
-	case 0x0E:
-	    ticks = this->rrc( m_a, true );
-	    break;
-	case 0x0F:
-	default:
-	    ticks = this->rrc( m_a );
-	    break;
-	}     
-    }
+uint8_t Z80::rrc( uint8_t val )
+{
+    bool nextCarry = BIT( val, 0 );
 
-    if( (opcode >= 0x10) && (opcode <= 0x17) )
-    {
-	// RL
-	switch( low )
-	{
-	case 0x00:
-	    ticks = this->rl( m_b );
-	    break;
-	case 0x01:
-	    ticks = this->rl( m_c );
-	    break;
-	case 0x02:
-	    ticks = this->rl( m_d );
-	    break;
-	case 0x03:
-	    ticks = this->rl( m_e );
-	    break;
-	case 0x04:
-	    ticks = this->rl( m_h );
-	    break;
-	case 0x05:
-	    ticks = this->rl( m_l );
-	    break;
-	case 0x06:
-	    ticks = this->rl( m_a, true );
-	    break;
-	case 0x07:
-	default:
-	    ticks = this->rl( m_a );
-	    break;
-	}        
-    }
+    val = val >> 1;
+    if( nextCarry ) { val |= 0x80; }
 
-    if( (opcode >= 0x18) && (opcode <= 0x1F) )
-    {
-	// RR
-	switch( low )
-	{
-	case 0x08:
-	    ticks = this->rr( m_b );
-	    break;
-	case 0x09:
-	    ticks = this->rr( m_c );
-	    break;
-	case 0x0A:
-	    ticks = this->rr( m_d );
-	    break;
-	case 0x0B:
-	    ticks = this->rr( m_e );
-	    break;
-	case 0x0C:
-	    ticks = this->rr( m_h );
-	    break;
-	case 0x0D:
-	    ticks = this->rr( m_l );
-	    break;
-	case 0x0E:
-	    ticks = this->rr( m_a, true );
-	    break;
-	case 0x0F:
-	default:
-	    ticks = this->rr( m_a );
-	    break;
-	}
-    }
+    // Set flags
+    this->deferFlags( C_FLAGS_SHIFT, val, 0, 0, nextCarry );
+    
+    return val;
+}
 
-    if( (opcode >= 0x20) && (opcode <= 0x27) )
-    {
-	// SLA
-	switch( low )
-	{
-	case 0x00:
-	    ticks = this->sla( m_b );
-	    break;
-	case 0x01:
-	    ticks = this->sla( m_c );
-	    break;
-	case 0x02:
-	    ticks = this->sla( m_d );
-	    break;
-	case 0x03:
-	    ticks = this->sla( m_e );
-	    break;
-	case 0x04:
-	    ticks = this->sla( m_h );
-	    break;
-	case 0x05:
-	    ticks = this->sla( m_l );
-	    break;
-	case 0x06:
-	    ticks = this->sla( m_a, true );
-	    break;
-	case 0x07:
-	default:
-	    ticks = this->sla( m_a );
-	    break;
-	}
-    }
+uint8_t Z80::sla( uint8_t val )
+{
+    bool carry = BIT( val, 7 );
 
-    if( (opcode >= 0x28) && (opcode <= 0x2F) )
-    {
-	// SRA
-	switch( low )
-	{
-	case 0x08:
-	    ticks = this->sra( m_b );
-	    break;
-	case 0x09:
-	    ticks = this->sra( m_c );
-	    break;
-	case 0x0A:
-	    ticks = this->sra( m_d );
-	    break;
-	case 0x0B:
-	    ticks = this->sra( m_e );
-	    break;
-	case 0x0C:
-	    ticks = this->sra( m_h );
-	    break;
-	case 0x0D:
-	    ticks = this->sra( m_l );
-	    break;
-	case 0x0E:
-	    ticks = this->sra( m_a, true );
-	    break;
-	case 0x0F:
-	default:
-	    ticks = this->sra( m_a );
-	    break;
-	}
-    }
+    val = val << 1;
 
-    if( (opcode >= 0x30) && (opcode <= 0x37) )
-    {
-	// SWAP
-	switch( low )
-	{
-	case 0x00:
-	    ticks = this->swap( m_b );
-	    break;
-	case 0x01:
-	    ticks = this->swap( m_c );
-	    break;
-	case 0x02:
-	    ticks = this->swap( m_d );
-	    break;
-	case 0x03:
-	    ticks = this->swap( m_e );
-	    break;
-	case 0x04:
-	    ticks = this->swap( m_h );
-	    break;
-	case 0x05:
-	    ticks = this->swap( m_l );
-	    break;
-	case 0x06:
-	    ticks = this->swap( m_a, true );
-	    break;
-	case 0x07:
-	default:
-	    ticks = this->swap( m_a );
-	    break;
-	}
-    }
+    // Set flags
+    this->deferFlags( C_FLAGS_SHIFT, val, 0, 0, carry );
+    
+    return val;
+}
 
-    if( (opcode >= 0x38) && (opcode <= 0x3F) )
-    {
-	// SRL
-	switch( low )
-	{
-	case 0x08:
-	    ticks = this->srl( m_b );
-	    break;
-	case 0x09:
-	    ticks = this->srl( m_c );
-	    break;
-	case 0x0A:
-	    ticks = this->srl( m_d );
-	    break;
-	case 0x0B:
-	    ticks = this->srl( m_e );
-	    break;
-	case 0x0C:
-	    ticks = this->srl( m_h );
-	    break;
-	case 0x0D:
-	    ticks = this->srl( m_l );
-	    break;
-	case 0x0E:
-	    ticks = this->srl( m_a, true );
-	    break;
-	case 0x0F:
-	default:
-	    ticks = this->srl( m_a );
-	    break;
-	}
-    }
+uint8_t Z80::sra( uint8_t val )
+{
+    bool carry = BIT( val, 0 );
 
-    if( (opcode >= 0x40) && (opcode <= 0x7F) )
-    {
-	// BIT n,-
-	uint8_t val = (2 * (high - 0x04)) + (low / 0x08);
-	
-	switch( low )
-	{
-	case 0x00:
-	case 0x08:
-	    ticks = this->bit( m_b, val );
-	    break;
-	case 0x01:
-	case 0x09:
-	    ticks = this->bit( m_c, val );
-	    break;
-	case 0x02:
-	case 0x0A:
-	    ticks = this->bit( m_d, val );
-	    break;
-	case 0x03:
-	case 0x0B:
-	    ticks = this->bit( m_e, val );
-	    break;
-	case 0x04:
-	case 0x0C:
-	    ticks = this->bit( m_h, val );
-	    break;
-	case 0x05:
-	case 0x0D:
-	    ticks = this->bit( m_l, val );
-	    break;
-	case 0x06:
-	case 0x0E:
-	    ticks = this->bit( m_a, val, true );
-	    break;
-	case 0x07:
-	case 0x0F:
-	default:
-	    ticks = this->bit( m_a, val );
-	    break;
-	}
-    }
+    val = (val >> 1) | (val & 0x80);
 
-    if( (opcode >= 0x80) && (opcode <= 0xBF) )
-    {
-	// RES n,-
-	uint8_t val = (2 * (high - 0x08)) + (low / 0x08);
-	
-	switch( low )
-	{
-	case 0x00:
-	case 0x08:
-	    ticks = this->res( m_b, val );
-	    break;
-	case 0x01:
-	case 0x09:
-	    ticks = this->res( m_c, val );
-	    break;
-	case 0x02:
-	case 0x0A:
-	    ticks = this->res( m_d, val );
-	    break;
-	case 0x03:
-	case 0x0B:
-	    ticks = this->res( m_e, val );
-	    break;
-	case 0x04:
-	case 0x0C:
-	    ticks = this->res( m_h, val );
-	    break;
-	case 0x05:
-	case 0x0D:
-	    ticks = this->res( m_l, val );
-	    break;
-	case 0x06:
-	case 0x0E:
-	    ticks = this->res( m_a, val, true );
-	    break;
-	case 0x07:
-	case 0x0F:
-	default:
-	    ticks = this->res( m_a, val );
-	    break;
-	}
-    }
+    // Set flags
+    this->deferFlags( C_FLAGS_SHIFT, val, 0, 0, carry );
+    
+    return val;
+}
 
-    if( (opcode >= 0xC0) && (opcode <= 0xFF) )
-    {
-	// SET n,-
-	uint8_t val = (2 * (high - 0x0C)) + (low / 0x08);
-	
-	switch( low )
-	{
-	case 0x00:
-	case 0x08:
-	    ticks = this->set( m_b, val );
-	    break;
-	case 0x01:
-	case 0x09:
-	    ticks = this->set( m_c, val );
-	    break;
-	case 0x02:
-	case 0x0A:
-	    ticks = this->set( m_d, val );
-	    break;
-	case 0x03:
-	case 0x0B:
-	    ticks = this->set( m_e, val );
-	    break;
-	case 0x04:
-	case 0x0C:
-	    ticks = this->set( m_h, val );
-	    break;
-	case 0x05:
-	case 0x0D:
-	    ticks = this->set( m_l, val );
-	    break;
-	case 0x06:
-	case 0x0E:
-	    ticks = this->set( m_a, val, true );
-	    break;
-	case 0x07:
-	case 0x0F:
-	default:
-	    ticks = this->set( m_a, val );
-	    break;
-	}
-    }
+uint8_t Z80::swap( uint8_t val )
+{
+    val = (val << 4) | (val >> 4);
     
-    return ticks;
+    // Set flags
+    this->deferFlags( C_FLAGS_LOGIC, val );
+    
+    return val;
 }
 
+uint8_t Z80::srl( uint8_t val )
+{
+    bool carry = BIT( val, 0 );
+
+    val = val >> 1;
+
+    // Set flags
+    this->deferFlags( C_FLAGS_SHIFT, val, 0, 0, carry );
+    
+    return val;
+}
@@ -1,8 +1,33 @@
 #pragma once
 
 #include "bus.h"
+#include "blockcache.h"
+#include "dynarec.h"
 #include <stdint.h>
 
+// A pair of 8-bit registers that can also be accessed as one 16-bit value
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define Z80_REGISTER_PAIR( pair, high, low )				\
+    union { uint16_t pair; struct { uint8_t high, low; }; };
+#else
+#define Z80_REGISTER_PAIR( pair, high, low )				\
+    union { uint16_t pair; struct { uint8_t low, high; }; };
+#endif
+
+/**
+ * @author Rick Hallman
+ * The CPU's register file. Every register lives in one cache line, so
+ * the pairs are native 16-bit values and a snapshot is a plain copy.
+ */
+struct alignas( 64 ) Registers
+{
+    Z80_REGISTER_PAIR( af, a, f )
+    Z80_REGISTER_PAIR( bc, b, c )
+    Z80_REGISTER_PAIR( de, d, e )
+    Z80_REGISTER_PAIR( hl, h, l )
+    uint16_t sp, pc;
+};
+
 /**
  * @author Rick Hallman
  *
@@ -26,6 +51,29 @@ public:
      * Gets the value of the program counter.
      */
     uint16_t getPC( void );
+
+    /**
+     * Gets the CPU's registers.
+     * @return the register file
+     */
+    const Registers& getRegisters( void );
+
+    /**
+     * Whether or not the CPU is halted waiting for an interrupt.
+     * @return true if yes, false otherwise
+     */
+    bool isHalting( void );
+
+    /**
+     * Gets the length of the idle loop the CPU is spinning in. A loop is
+     * idle when an iteration wrote nothing and ended in the same state it
+     * started in, so it will repeat exactly until hardware changes memory.
+     * @return the ticks per iteration, or 0 if not in an idle loop
+     */
+    uint32_t getIdleLoopTicks( void );
+
+    // the longest backward jump (in bytes) that can close an idle loop
+    static const uint16_t c_idleLoopSize = 32;
     
     /**
      * Prints the CPU's current status to the command line.
@@ -33,10 +81,19 @@ public:
     void printStatus( void );
     
     /**
-     * Executes the next instruction pointed to by the PC.
-     * @return the number of ticks this instruction took
+     * Executes the next instruction pointed to by the PC. Compiled code
+     * may run several instructions at once, as long as they fit in the
+     * budget.
+     * @param budget the most ticks compiled code may take (DEFAULT: 0)
+     * @return the number of ticks taken
      */
-    uint8_t executeNextInstruction( void );
+    uint32_t executeNextInstruction( uint32_t budget=0 );
+
+    /**
+     * Gets the number of ticks the last instruction executed took.
+     * @return the ticks
+     */
+    uint8_t getInstructionTicks( void );
     
     // Interrupt masks
     static const uint8_t c_vBlank = 0x01;
@@ -53,6 +110,35 @@ public:
     
 private:
 
+    // generates code that works on the registers and deferred flags
+    friend class Dynarec;
+
+    // a member function that executes a single opcode
+    typedef uint8_t (Z80::*Instruction)( void );
+
+    // opcode dispatch tables, indexed by opcode
+    static const Instruction c_opcodeTable[ 256 ];
+    static const Instruction c_cbOpcodeTable[ 256 ];
+
+    // instruction lengths and maximum ticks, indexed by opcode
+    static const uint8_t c_opcodeLengths[ 256 ];
+    static const uint8_t c_opcodeTicks[ 256 ];
+
+    // operations whose flags may be calculated later
+    typedef enum
+    {
+	C_FLAGS_EVALUATED,
+	C_FLAGS_ADD,
+	C_FLAGS_SUB,
+	C_FLAGS_INC,
+	C_FLAGS_DEC,
+	C_FLAGS_AND,
+	C_FLAGS_LOGIC,
+	C_FLAGS_SHIFT,
+	C_FLAGS_ROTATE_A,
+	C_FLAGS_BIT
+    } FlagOp;
+    
     /**
      * Halts the CPU.
      * @return the number of interrupts this instruction took.
@@ -73,44 +159,177 @@ private:
     void setFlag( uint8_t mask, bool value=true );
 
     /**
-     * Gets the value of a given flag.
+     * Gets the value of a given flag. Zero and carry are found without
+     * evaluating deferred flags.
      * @param the flag's mask
      * @return the flag's value
      */
     bool getFlag( uint8_t mask );
     
     /**
-     * Sets the half carry flag based on the previous and current values
-     * of an 8-bit value.
-     * @param prev the previous value
-     * @param delta the change to prev
-     * @param subtract whether or not this is being performed on a subtract operation (DEFAULT: FALSE)
-     * @param offset for adc/sbc (DEFAULT: 0)
+     * Gets the flags register, evaluating any deferred flags.
+     * @return the flags register
      */
-    void setHalfCarry( uint8_t prev, uint8_t delta, bool subtract=false, int offset=0 );
-    
+    uint8_t getFlags( void );
+
     /**
-     * Sets the carry flag based on the previous and current values
-     * of an 8-bit value.
-     * @param prev the previous value
-     * @param delta the change to prev
-     * @param subtract whether or not this was a subtract operation (DEFAULT: false)
-     * @param offset for adc/sbc (DEFAULT: 0)
+     * Records the inputs of a flag-setting operation. The flags are only
+     * calculated once something reads them.
+     * @param op the kind of operation
+     * @param result the 8-bit result
+     * @param prev the previous value (DEFAULT: 0)
+     * @param delta the change to prev (DEFAULT: 0)
+     * @param carry the carry in, or the carry out for shifts (DEFAULT: false)
      */
-    void setCarry( uint8_t prev, uint8_t delta, bool subtract=false, int offset=0 );
+    void deferFlags( FlagOp op, uint8_t result, uint8_t prev=0, uint8_t delta=0, bool carry=false );
 
     /**
-     * Fetches the next instruction and increments the program counter.
-     * @return the instruction's opcode
+     * Calculates any deferred flags into the flags register.
      */
-    uint8_t fetchNextInstruction( void );
+    void evaluateFlags( void );
 
     /**
-     * Executes a CB-prefixed instruction.
-     * @param opcode the instruction to execute
+     * Called after each instruction. Compares the CPU's state on each short
+     * backward jump with its state on the previous one to find idle loops.
+     * @param addr the instruction's address
+     * @param ticks the number of ticks the instruction took
+     */
+    void checkIdleLoop( uint16_t addr, uint8_t ticks );
+
+    /**
+     * Fetches the predecoded instruction at the program counter, replaying
+     * the current block where possible.
+     * @return the instruction
+     */
+    const CachedInstruction* fetchNextInstruction( void );
+
+    /**
+     * Decodes and caches the block starting at an address.
+     * @param addr the block's start address
+     * @return the block, or NULL if no instruction fits in its region
+     */
+    Block* decodeBlock( uint16_t addr );
+
+    /**
+     * Decodes a single instruction.
+     * @param addr the instruction's address
+     * @param instruction the decoded instruction
+     */
+    void decodeInstruction( uint16_t addr, CachedInstruction& instruction );
+
+    /**
+     * Whether or not an opcode ends a block (jumps, calls, returns, halts).
+     * @param opcode the opcode
+     * @return true if yes, false otherwise
+     */
+    static bool endsBlock( uint8_t opcode );
+
+#ifdef DYNAREC_ENABLED
+    /**
+     * Runs a block's native code, compiling the block once it is hot.
+     * @param block the block being entered
+     * @param budget the most ticks the native code may take
+     * @return the number of ticks the native code took, or 0 if the
+     *         block must be interpreted
+     */
+    uint32_t executeNative( Block* block, uint32_t budget );
+
+    /**
+     * Reads plain memory on behalf of native code.
+     * @param z80 the cpu
+     * @param addr the address
+     * @return the value, or Dynarec::c_bail if not plain memory
+     */
+    static uint32_t nativeRead( Z80* z80, uint32_t addr );
+
+    /**
+     * Writes plain memory on behalf of native code.
+     * @param z80 the cpu
+     * @param addr the address
+     * @param val the value
+     * @return 0, or Dynarec::c_bail if not plain memory
+     */
+    static uint32_t nativeWrite( Z80* z80, uint32_t addr, uint32_t val );
+
+    /**
+     * Pushes a word on behalf of native code. Both bytes are written, or
+     * neither is.
+     * @param z80 the cpu
+     * @param addr the new stack pointer
+     * @param word the word
+     * @return 0, or Dynarec::c_bail if not plain memory
+     */
+    static uint32_t nativePush( Z80* z80, uint32_t addr, uint32_t word );
+
+    /**
+     * Pops a word on behalf of native code.
+     * @param z80 the cpu
+     * @param addr the stack pointer
+     * @return the word, or Dynarec::c_bail if not plain memory
+     */
+    static uint32_t nativePop( Z80* z80, uint32_t addr );
+
+    /**
+     * Runs an instruction's handler on behalf of native code, leaving the
+     * flags evaluated.
+     * @param z80 the cpu
+     * @param instruction the instruction
+     * @return 0, or Dynarec::c_bail if it accesses anything but plain memory
+     */
+    static uint32_t nativeExecute( Z80* z80, const CachedInstruction* instruction );
+
+    /**
+     * Evaluates the deferred flags on behalf of native code.
+     * @param z80 the cpu
+     */
+    static void nativeEvaluate( Z80* z80 );
+
+    /**
+     * Checks for an idle loop when native code jumps back to the start of
+     * its block.
+     * @param z80 the cpu
+     * @param addr the address of the branch
+     * @param ticks the ticks since the last check
+     * @return the ticks per iteration, or 0 if not in an idle loop
+     */
+    static uint32_t nativeLoop( Z80* z80, uint32_t addr, uint32_t ticks );
+#endif
+
+    /**
+     * Executes a single base opcode. One instance exists per opcode,
+     * so each dispatch table entry is a dedicated handler.
+     * @return the number of ticks this instruction took
+     */
+    template <uint8_t opcode>
+    uint8_t executeOpcode( void );
+
+    /**
+     * Executes a single CB-prefixed opcode. One instance exists per opcode.
      * @return the number of ticks this instruction took
      */
-    uint8_t executeCBInstruction( uint8_t opcode );
+    template <uint8_t opcode>
+    uint8_t executeCBOpcode( void );
+
+    /**
+     * Gets the register encoded in the low three bits of a CB opcode.
+     * @return the register (A for (HL), which is accessed through the bus)
+     */
+    template <uint8_t operand>
+    uint8_t& getCBOperand( void );
+
+    /**
+     * Reads the operand encoded in the low three bits of a CB opcode.
+     * @return the operand's value
+     */
+    template <uint8_t operand>
+    uint8_t readCBOperand( void );
+
+    /**
+     * Writes the operand encoded in the low three bits of a CB opcode.
+     * @param val the value to write
+     */
+    template <uint8_t operand>
+    void writeCBOperand( uint8_t val );
 
     /**
      * Executes a single byte load command. These fall between
@@ -168,14 +387,6 @@ private:
      */
     uint8_t executeGroupBx8( uint8_t opcode );
 
-    /**
-     * Adds a two-byte word to HL.
-     * @param high the most significant byte
-     * @param low the least significant byte
-     * @return the number of ticks this addition took
-     */
-    uint8_t addToHL( uint8_t high, uint8_t low );
-
     /**
      * Adds a two-byte word to HL.
      * @param val the value to add
@@ -197,21 +408,12 @@ private:
      */
     uint8_t pushWord( uint16_t word );
     
-    /**
-     * Pushes a two-byte word to the stack.
-     * @param high the most significant byte
-     * @param low the least significant byte
-     * @return the number of ticks this push took
-     */
-    uint8_t pushWord( uint8_t high, uint8_t low );
-
     /**
      * Pops a two-byte word from the stack.
-     * @param high the most significant byte
-     * @param low the least significant byte
+     * @param word the word popped
      * @return the number of ticks this pop took
      */
-    uint8_t popWord( uint8_t& high, uint8_t& low );
+    uint8_t popWord( uint16_t& word );
 
     /**
      * Relative jump.
@@ -278,14 +480,6 @@ private:
      */
     uint8_t decReg( uint8_t& reg );
 
-    /**
-     * Decrements the value of a 2-byte register by one.
-     * @param high the high byte
-     * @param low the low byte
-     * @return the number of ticks this decrement took
-     */
-    uint8_t decReg( uint8_t& high, uint8_t& low );
-
     /**
      * Decrements the value of a 2-byte register by one.
      * @param reg the register to decrement
@@ -312,14 +506,6 @@ private:
      */
     uint8_t decHL( void );
     
-    /**
-     * Increments the value of a 2-byte register by one.
-     * @param high the high byte
-     * @param low the low byte
-     * @return the number of ticks this increment took
-     */
-    uint8_t incReg( uint8_t& high, uint8_t& low );
-
     /**
      * Increments the value of a 2-byte register by one.
      * @param reg the register to increment
@@ -336,12 +522,11 @@ private:
     
     /**
      * Loads the value pointed to by a 2-byte register to A.
-     * @param high the high byte
-     * @param low the low byte
+     * @param addr the address
      * @param hlOffset the offset to add to HL (DEFAULT: 0)
      * @return the number of ticks this load took
      */
-    uint8_t loadToA( uint8_t high, uint8_t low, uint16_t hlOffset=0 );
+    uint8_t loadToA( uint16_t addr, uint16_t hlOffset=0 );
 
     /**
      * Loads the immediate 2-byte register to A.
@@ -351,12 +536,11 @@ private:
 
     /**
      * Loads the value of A to the address pointed to by 2-byte register.
-     * @param high the high byte
-     * @param low the low byte
-     * @param offset the offset to add to the address (DEFAULT: 0)
+     * @param addr the address
+     * @param offset the offset to add to HL (DEFAULT: 0)
      * @return the number of ticks this load took
      */
-    uint8_t loadFromA( uint8_t high, uint8_t low, uint16_t hlOffset=0 );
+    uint8_t loadFromA( uint16_t addr, uint16_t hlOffset=0 );
 
     /**
      * Loads the value of A to the address pointed to by the immediate
@@ -384,14 +568,6 @@ private:
      */
     uint8_t loadImm8ToHL( void );
     
-    /**
-     * Loads the immediate 16 bit value into a 2-byte register.
-     * @param high the high byte
-     * @param low the low byte
-     * @return the number of ticks this load took took
-     */
-    uint8_t loadImm16( uint8_t& high, uint8_t& low );
-
     /**
      * Loads the immediate 16 bit value into a 2-byte register.
      * @param reg the 2-byte register
@@ -433,123 +609,103 @@ private:
 
     /**
      * Performs an RL operation.
-     * @param reg the register to perform this on
-     * @param hl flag to perform this operation on (HL) (DEFAULT: false)
-     * @return the number of ticks this instruction took
+     * @param val the value to perform this on
+     * @return the result
      */
-    uint8_t rl( uint8_t& reg, bool hl = false );
+    uint8_t rl( uint8_t val );
 
     /**
      * Performs an RR operation.
-     * @param reg the register to perform this on
-     * @param hl flag to perform this operation on (HL) (DEFAULT: false)
-     * @return the number of ticks this instruction took
+     * @param val the value to perform this on
+     * @return the result
      */
-    uint8_t rr( uint8_t& reg, bool hl = false );
-    
-    
+    uint8_t rr( uint8_t val );
+
     /**
      * Performs an RLC operation.
-     * @param reg the register to perform this on
-     * @param hl flag to perform this operation on (HL) (DEFAULT: false)
-     * @return the number of ticks this instruction took
+     * @param val the value to perform this on
+     * @return the result
      */
-    uint8_t rlc( uint8_t& reg, bool hl = false );
+    uint8_t rlc( uint8_t val );
 
     /**
      * Performs an RRC operation.
-     * @param reg the register to perform this on
-     * @param hl flag to perform this operation on (HL) (DEFAULT: false)
-     * @return the number of ticks this instruction took
+     * @param val the value to perform this on
+     * @return the result
      */
-    uint8_t rrc( uint8_t& reg, bool hl = false );
+    uint8_t rrc( uint8_t val );
 
     /**
      * Performs an SLA operation.
-     * @param reg the register to perform this on
-     * @param hl flag to perform this operation on (HL) (DEFAULT: false)
-     * @return the number of ticks this instruction took
+     * @param val the value to perform this on
+     * @return the result
      */
-    uint8_t sla( uint8_t& reg, bool hl = false );
+    uint8_t sla( uint8_t val );
 
     /**
      * Performs an SRA operation.
-     * @param reg the register to perform this on
-     * @param hl flag to perform this operation on (HL) (DEFAULT: false)
-     * @return the number of ticks this instruction took
+     * @param val the value to perform this on
+     * @return the result
      */
-    uint8_t sra( uint8_t& reg, bool hl = false );
+    uint8_t sra( uint8_t val );
 
     /**
-     * Swaps the first and seconds numbles of a register.
-     * @param reg the register to perform this on
-     * @param hl flag to perform this operation on (HL) (DEFAULT: false)
-     * @return the number of ticks this instruction took
+     * Swaps the first and second nibbles of a value.
+     * @param val the value to perform this on
+     * @return the result
      */
-    uint8_t swap( uint8_t& reg, bool hl = false );
+    uint8_t swap( uint8_t val );
 
     /**
      * Performs an SRL operation.
-     * @param reg the register to perform this on
-     * @param hl flag to perform this operation on (HL) (DEFAULT: false)
-     * @return the number of ticks this instruction took
+     * @param val the value to perform this on
+     * @return the result
      */
-    uint8_t srl( uint8_t& reg, bool hl = false );
+    uint8_t srl( uint8_t val );
 
-    /**
-     * Performs a BIT operation.
-     * @param reg the register to perform this on
-     * @param bit the bit to test
-     * @param hl flag to perform this operation on (HL) (DEFAULT: false)
-     * @return the number of ticks this instruction took
-     */
-    uint8_t bit( uint8_t& reg, uint8_t bit, bool hl = false );
+    Bus* mp_bus;
 
-    /**
-     * Performs a RES operation.
-     * @param reg the register to perform this on
-     * @param bit the bit to test
-     * @param hl flag to perform this operation on (HL) (DEFAULT: false)
-     * @return the number of ticks this instruction took
-     */
-    uint8_t res( uint8_t& reg, uint8_t bit, bool hl = false );
+    // predecoded instructions
+    BlockCache* mp_blockCache;
 
-    /**
-     * Performs a SET operation.
-     * @param reg the register to perform this on
-     * @param bit the bit to test
-     * @param hl flag to perform this operation on (HL) (DEFAULT: false)
-     * @return the number of ticks this instruction took
-     */
-    uint8_t set( uint8_t& reg, uint8_t bit, bool hl = false );
- 
-    
-    /**
-     * Calculates the value of a 2-byte register.
-     * @param high the high byte
-     * @param low the low byte
-     * @return the value of the register
-     */
-    uint16_t get2ByteRegValue( uint8_t high, uint8_t low );
-    
-    /**
-     * Separates a 2-byte register into its two constituent parts.
-     * @param high the high byte
-     * @param low the low byte
-     * @param val the value to split
-     */
-    void split2ByteRegValue( uint8_t& high, uint8_t& low, uint16_t val );
-    
-    Bus* mp_bus;
+    // the block being replayed
+    Block* mp_block;
+    uint32_t m_blockGeneration;
+    unsigned int m_blockIndex;
+
+#ifdef DYNAREC_ENABLED
+    // native code generator
+    Dynarec* mp_dynarec;
+#endif
+
+    // the ticks taken by the last instruction
+    uint8_t m_instructionTicks;
+
+    // an instruction decoded outside of the cache
+    CachedInstruction m_instruction;
+
+    // the operands of the executing instruction
+    uint8_t m_operands[ 2 ];
+    uint8_t m_operandIndex;
 
     // halting flag
     bool m_halting;
     
     // CPU registers
-    uint16_t m_pc, m_sp;
-    uint8_t m_a, m_b, m_c, m_d, m_e, m_h, m_l;
-    uint8_t m_flags;
+    Registers m_regs;
     bool m_ime;
+
+    // CPU state on the last short backward jump, for idle loop detection
+    Registers m_loopRegs;
+    bool m_loopIme;
+    uint32_t m_loopWrites;
+    uint32_t m_loopTicks;
+    uint32_t m_idleLoopTicks;
+
+    // the deferred flag operation and its inputs
+    uint8_t m_flagOp;
+    uint8_t m_flagResult, m_flagPrev, m_flagDelta;
+    bool m_flagCarry;
     
     // flag masks
     const uint8_t c_zero = 0x80;
@@ -26,6 +26,10 @@ int main( int argc, char* argv[] )
     string save = "";
     if( argc >= 3 ) { save = argv[2]; }
 
+    // seconds between writes of battery-backed RAM to the save file
+    int saveInterval = -1;
+    if( argc >= 4 ) { saveInterval = atoi( argv[3] ); }
+
     // load the ROM
     Rom* rom = Rom::Load( path, save );
     if( rom == NULL ) { return 1; }
@@ -35,6 +39,7 @@ int main( int argc, char* argv[] )
 
     // start the emulator
     GB* gb = new GB( rom, baseDir );
+    if( saveInterval >= 0 ) { gb->setSaveInterval( (uint64_t)saveInterval * GB::c_secondTicks ); }
     Window* window = new Window( gb );
     window->run();
 
@@ -22,29 +22,29 @@ void Window::run( void )
 
     while( done == false )
     {
-	// Update the emulator
-	if( mp_gb->update() != 0 ) { done = true; }
-	
-	// Draw the screen if LCD is ready
-	if( mp_gb->getLCD()->readyToDraw() )
+	// Run the emulator until the end of the frame
+	if( mp_gb->runFrame() == GB::C_STOP_BREAKPOINT )
 	{
-	    // Poll window events
-	    while( SDL_PollEvent( &e ) )
-	    {
-		if( e.type == SDL_QUIT ) { done = true; }
-	    }
+	    if( mp_gb->debug() != 0 ) { done = true; }
+	    continue;
+	}
 
-	    // Render to the screen
-	    this->render();
+	// Poll window events
+	while( SDL_PollEvent( &e ) )
+	{
+	    if( e.type == SDL_QUIT ) { done = true; }
+	}
 
-	    // Update the joypad based on keyboard input
-	    mp_gb->getJoyPad()->readKeyboard();
+	// Draw the screen if LCD is ready
+	if( mp_gb->getLCD()->readyToDraw() ) { this->render(); }
 
-	    // Delay accordingly
-	    Uint32 delta = SDL_GetTicks() - m_prevTicks;
-	    m_prevTicks += delta;
-	    if( delta < c_delay ) { SDL_Delay( c_delay - delta ); }
-	}
+	// Update the joypad based on keyboard input
+	mp_gb->getJoyPad()->readKeyboard();
+
+	// Delay accordingly
+	Uint32 delta = SDL_GetTicks() - m_prevTicks;
+	m_prevTicks += delta;
+	if( delta < c_delay ) { SDL_Delay( c_delay - delta ); }
     }
 
     mp_gb->close();